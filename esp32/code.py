@@ -378,6 +378,8 @@ while True:
             client_socket, addr = server_socket.accept()
             client_socket.setblocking(True)
             client_socket.settimeout(5.0)
+            # The host waits for this before sending anything
+            network.send_caps(client_socket)
             connected = True
             disconnected_mode = False
             print(f"Client connected from {addr}")
@@ -9,6 +9,39 @@ MSG_NO_CHANGE = 0x02
 MSG_FLASH_DATA = 0x03
 MSG_RESET = 0x04
 MSG_SET_MODE = 0x05  # Mode selection message
+MSG_DIRTY_RECTS_RLE = 0x06  # Dirty rects with a codec byte per rect
+MSG_TILE_OPS = 0x07  # Tile cache refs, fills, copies and stores, then RLE dirty rects
+MSG_HELLO = 0x08  # Host protocol version, codec mask and tile cache slots it will use
+MSG_CAPS = 0x09  # Sent to the host on connect: what this board decodes
+
+# Capabilities (MSG_CAPS layout in device_caps.hpp)
+PROTOCOL_VERSION = 2
+MAX_RECTS = 255  # rect_header_buffer size
+PIXEL_ORDER_LE = 0
+RECV_BUFFER_BYTES = 5744  # lwIP TCP receive window
+WINDOW_CREDITS = 4  # Messages the host may send ahead of their ACKs
+
+# Windowed ACKs: [ACK_WINDOWED][seq][credits], once the host's HELLO asks for them
+ACK_WINDOWED = 0xA5
+ack_window = 0
+ack_seq = 0
+ack_buffer = bytearray(3)
+
+# Rect payload codecs (MSG_DIRTY_RECTS_RLE)
+CODEC_RAW = 0x00
+CODEC_RLE = 0x01
+CODEC_XOR_RLE = 0x02  # RLE of new XOR current pixels
+CODEC_FILL = 0x03  # One color for the whole rect
+CODEC_MOVE = 0x04  # Move pixels already on screen by (dx, dy), then an XOR RLE residual
+
+# Flash data flags: rect headers carry a codec byte, tile op lists precede the rects
+FLAG_RECT_CODECS = 0x20
+FLAG_TILE_OPS = 0x40
+
+# Tile cache (must match TILE_CACHE_SLOTS in tile_cache.hpp)
+TILE_SIZE = 16
+TILE_BYTES = TILE_SIZE * TILE_SIZE * 2
+TILE_CACHE_SLOTS = 1024
 
 # Mode constants
 MODE_FULL_STREAMING = 0x00
@@ -18,12 +51,22 @@ MODE_FLASH = 0x01
 header_buffer = None
 stream_buffer_bytes = None
 stream_bitmap = None
+rect_header_buffer = None
+row_len_buffer = None
+rle_buffer = None
+move_row_buffer = None
+tile_list_buffer = None
+tile_copy_buffer = None
+tile_store_buffer = None
+tile_cache = None
 last_dirty_dims = (0, 0, 0, 0)
 
 
 def init_buffers(hdr_buf, stream_bytes, stream_bmp, frame_w, frame_h):
     """Initialize shared buffers."""
     global header_buffer, stream_buffer_bytes, stream_bitmap
+    global rect_header_buffer, row_len_buffer, rle_buffer, move_row_buffer
+    global tile_list_buffer, tile_copy_buffer, tile_store_buffer, tile_cache
     global FRAME_WIDTH, FRAME_HEIGHT, FRAME_BYTES
     header_buffer = hdr_buf
     stream_buffer_bytes = stream_bytes
@@ -31,6 +74,18 @@ def init_buffers(hdr_buf, stream_bytes, stream_bmp, frame_w, frame_h):
     FRAME_WIDTH = frame_w
     FRAME_HEIGHT = frame_h
     FRAME_BYTES = frame_w * frame_h * 2
+    # Up to 255 rects with 9 byte headers (x, y, w, h, codec)
+    rect_header_buffer = bytearray(255 * 9)
+    # RLE: row length table, and one encoded row (at most 2 bytes per pixel + 2)
+    row_len_buffer = bytearray(frame_h * 2)
+    rle_buffer = bytearray(frame_w * 2 + 4)
+    move_row_buffer = bytearray(frame_w * 2)
+    # Tile op lists (up to one op per tile), and the cached tiles (PSRAM)
+    tile_list_size = (frame_w // TILE_SIZE) * (frame_h // TILE_SIZE) * 4
+    tile_list_buffer = bytearray(tile_list_size)
+    tile_copy_buffer = bytearray(tile_list_size)
+    tile_store_buffer = bytearray(tile_list_size)
+    tile_cache = bytearray(TILE_CACHE_SLOTS * TILE_BYTES)
 
 
 def recv_exact(client, buffer, count):
@@ -50,9 +105,38 @@ def recv_exact(client, buffer, count):
 
 
 def send_ack(client):
-    """Send ACK byte. Returns True on success."""
+    """Send ACK (one byte, or seq and credits when windowed). Returns True on success."""
+    global ack_seq
+    try:
+        if ack_window:
+            ack_buffer[0] = ACK_WINDOWED
+            ack_buffer[1] = ack_seq
+            ack_buffer[2] = WINDOW_CREDITS
+            client.send(ack_buffer)
+            ack_seq = (ack_seq + 1) & 0xFF
+        else:
+            client.send(b'\x00')
+        return True
+    except OSError:
+        return False
+
+
+def send_caps(client):
+    """Advertise supported messages, codecs and buffers. Returns True on success."""
+    global ack_window, ack_seq
+    ack_window = 0  # New connection: plain ACKs until HELLO
+    ack_seq = 0
+    messages = 0
+    for msg in (MSG_FULL_FRAME, MSG_DIRTY_RECTS, MSG_NO_CHANGE, MSG_FLASH_DATA, MSG_RESET,
+                MSG_SET_MODE, MSG_DIRTY_RECTS_RLE, MSG_TILE_OPS, MSG_HELLO):
+        messages |= 1 << msg
+    codecs = 0
+    for codec in (CODEC_RAW, CODEC_RLE, CODEC_XOR_RLE, CODEC_FILL, CODEC_MOVE):
+        codecs |= 1 << codec
+    fields = struct.pack('<HBHBBIB', messages, codecs, TILE_CACHE_SLOTS, MAX_RECTS,
+                         PIXEL_ORDER_LE, RECV_BUFFER_BYTES, WINDOW_CREDITS)
     try:
-        client.send(b'\x00')
+        client.send(bytes((MSG_CAPS, PROTOCOL_VERSION, len(fields))) + fields)
         return True
     except OSError:
         return False
@@ -75,11 +159,105 @@ def receive_full_frame(client):
     return True
 
 
-def receive_dirty_rects(client, rect_count, target_buffer_bytes=None, target_bitmap=None, skip_transparent=False):
+def decode_xor_row(src, length, target, byte_offset):
+    """Apply one XOR RLE row to target at byte_offset; zero runs are skipped."""
+    pos = 0
+    out = byte_offset
+    while pos < length:
+        hdr = src[pos] | (src[pos + 1] << 8)
+        pos += 2
+        if hdr & 0x8000:
+            count = (hdr & 0x7FFF) + 1
+            lo = src[pos]
+            hi = src[pos + 1]
+            pos += 2
+            if lo or hi:
+                for o in range(out, out + count * 2, 2):
+                    target[o] ^= lo
+                    target[o + 1] ^= hi
+            out += count * 2
+        else:
+            n = (hdr + 1) * 2
+            for i in range(n):
+                target[out + i] ^= src[pos + i]
+            pos += n
+            out += n
+    return True
+
+
+def decode_rle_row(src, length, target, byte_offset, skip_transparent):
+    """Decode one RLE row (see rect_codec.hpp) into target at byte_offset."""
+    pos = 0
+    out = byte_offset
+    while pos < length:
+        hdr = src[pos] | (src[pos + 1] << 8)
+        pos += 2
+        if hdr & 0x8000:
+            count = (hdr & 0x7FFF) + 1
+            lo = src[pos]
+            hi = src[pos + 1]
+            pos += 2
+            if not (skip_transparent and lo == 0x1F and hi == 0xF8):
+                target[out:out + count * 2] = bytes((lo, hi)) * count
+            out += count * 2
+        else:
+            n = (hdr + 1) * 2
+            if skip_transparent:
+                for px in range(0, n, 2):
+                    if src[pos + px] != 0x1F or src[pos + px + 1] != 0xF8:
+                        target[out + px] = src[pos + px]
+                        target[out + px + 1] = src[pos + px + 1]
+            else:
+                target[out:out + n] = src[pos:pos + n]
+            pos += n
+            out += n
+    return True
+
+
+def move_rect(target, x, y, w, h, dx, dy):
+    """Fill rect (x, y, w, h) from the pixels at (x - dx, y - dy); source and rect may overlap."""
+    row_bytes = w * 2
+    tmp = memoryview(move_row_buffer)[:row_bytes]
+    # Copy rows away from the direction of motion so sources are read before they're overwritten
+    rows = range(h - 1, -1, -1) if dy > 0 else range(h)
+    for row in rows:
+        src = ((y - dy + row) * FRAME_WIDTH + x - dx) * 2
+        dst = ((y + row) * FRAME_WIDTH + x) * 2
+        tmp[:] = target[src:src + row_bytes]
+        target[dst:dst + row_bytes] = tmp
+
+
+def receive_rle_rect(client, x, y, w, h, target_buffer_bytes, skip_transparent, xor=False):
+    """Receive an RLE coded rect: row length table, then one row at a time.
+    
+    With xor, rows are XOR deltas against the pixels already in the target.
+    """
+    if not recv_exact(client, row_len_buffer, h * 2):
+        return False
+    rle_mv = memoryview(rle_buffer)
+    for row in range(h):
+        length = row_len_buffer[row * 2] | (row_len_buffer[row * 2 + 1] << 8)
+        if length > len(rle_buffer):
+            print(f"RLE row too long: {length}")
+            return False
+        if not recv_exact(client, rle_buffer, length):
+            return False
+        byte_offset = ((y + row) * FRAME_WIDTH + x) * 2
+        if xor:
+            decode_xor_row(rle_mv, length, target_buffer_bytes, byte_offset)
+        else:
+            decode_rle_row(rle_mv, length, target_buffer_bytes, byte_offset, skip_transparent)
+    return True
+
+
+def receive_dirty_rects(client, rect_count, target_buffer_bytes=None, target_bitmap=None, skip_transparent=False,
+                        with_codecs=False):
     """Receive dirty rectangles and update bitmap.
     
     If skip_transparent is True, pixels matching 0xF81F (magenta) are not written,
     allowing layers below to show through.
+    If with_codecs is True, each rect header has a trailing codec byte
+    (MSG_DIRTY_RECTS_RLE layout).
     """
     global last_dirty_dims
     
@@ -88,8 +266,9 @@ def receive_dirty_rects(client, rect_count, target_buffer_bytes=None, target_bit
     if target_bitmap is None:
         target_bitmap = stream_bitmap
     
-    header_size = rect_count * 8
-    if not recv_exact(client, header_buffer, header_size):
+    header_stride = 9 if with_codecs else 8
+    headers = rect_header_buffer if with_codecs else header_buffer
+    if not recv_exact(client, headers, rect_count * header_stride):
         return False
 
     min_x = FRAME_WIDTH
@@ -102,17 +281,47 @@ def receive_dirty_rects(client, rect_count, target_buffer_bytes=None, target_bit
     temp_row_buffer = bytearray(FRAME_WIDTH * 2) if skip_transparent else None
     
     for i in range(rect_count):
-        offset = i * 8
-        x = header_buffer[offset] | (header_buffer[offset + 1] << 8)
-        y = header_buffer[offset + 2] | (header_buffer[offset + 3] << 8)
-        w = header_buffer[offset + 4] | (header_buffer[offset + 5] << 8)
-        h = header_buffer[offset + 6] | (header_buffer[offset + 7] << 8)
+        offset = i * header_stride
+        x = headers[offset] | (headers[offset + 1] << 8)
+        y = headers[offset + 2] | (headers[offset + 3] << 8)
+        w = headers[offset + 4] | (headers[offset + 5] << 8)
+        h = headers[offset + 6] | (headers[offset + 7] << 8)
+        codec = headers[offset + 8] if with_codecs else CODEC_RAW
 
         min_x = min(min_x, x)
         min_y = min(min_y, y)
         max_x = max(max_x, x + w)
         max_y = max(max_y, y + h)
 
+        if codec == CODEC_RLE or codec == CODEC_XOR_RLE:
+            if not receive_rle_rect(client, x, y, w, h, target_buffer_bytes, skip_transparent,
+                                    xor=(codec == CODEC_XOR_RLE)):
+                return False
+            continue
+        elif codec == CODEC_MOVE:
+            if not recv_exact(client, header_buffer, 2):
+                return False
+            dx = header_buffer[0] - 256 if header_buffer[0] > 127 else header_buffer[0]
+            dy = header_buffer[1] - 256 if header_buffer[1] > 127 else header_buffer[1]
+            move_rect(target_buffer_bytes, x, y, w, h, dx, dy)
+            if not receive_rle_rect(client, x, y, w, h, target_buffer_bytes, skip_transparent, xor=True):
+                return False
+            continue
+        elif codec == CODEC_FILL:
+            if not recv_exact(client, header_buffer, 2):
+                return False
+            lo = header_buffer[0]
+            hi = header_buffer[1]
+            if not (skip_transparent and lo == 0x1F and hi == 0xF8):
+                fill_row = bytes((lo, hi)) * w
+                for row in range(h):
+                    byte_offset = ((y + row) * FRAME_WIDTH + x) * 2
+                    target_buffer_bytes[byte_offset:byte_offset + w * 2] = fill_row
+            continue
+        elif codec != CODEC_RAW:
+            print(f"Unknown rect codec: {codec}")
+            return False
+
         for row in range(h):
             row_start = (y + row) * FRAME_WIDTH + x
             row_bytes = w * 2
@@ -162,11 +371,20 @@ def receive_flash_data(client, flash_mgr):
     
     # Receive dirty rects into flash manager's stream bitmap
     # Magenta (0xF81F) pixels become transparent via ColorConverter.make_transparent()
-    if rect_count > 0:
+    dirty = False
+    if flags & FLAG_TILE_OPS:
+        target_bytes = memoryview(flash_mgr.stream_bitmap).cast('B')
+        if not receive_tile_ops(client, target_bytes, rect_count):
+            print("Failed to receive flash frame tile ops")
+            return None
+        dirty = last_dirty_dims[2] > last_dirty_dims[0]
+    elif rect_count > 0:
         target_bytes = memoryview(flash_mgr.stream_bitmap).cast('B')
-        if not receive_dirty_rects(client, rect_count, target_bytes, flash_mgr.stream_bitmap):
+        if not receive_dirty_rects(client, rect_count, target_bytes, flash_mgr.stream_bitmap,
+                                   with_codecs=bool(flags & FLAG_RECT_CODECS)):
             print("Failed to receive flash frame dirty rects")
             return None
+        dirty = True
     
     return {
         'weather_index': weather_index,
@@ -177,10 +395,122 @@ def receive_flash_data(client, flash_mgr):
         'weather_temp': weather_temp,
         'train0_mins': train0_mins,
         'train1_mins': train1_mins,
-        'rect_count': rect_count
+        'rect_count': rect_count,
+        'dirty': dirty
     }
 
 
+def receive_tile_list(client, buffer):
+    """Receive one tile op list into buffer. Returns the op count or None."""
+    if not recv_exact(client, header_buffer, 2):
+        return None
+    count = header_buffer[0] | (header_buffer[1] << 8)
+    if count * 4 > len(buffer):
+        print(f"Tile list too long: {count}")
+        return None
+    if count > 0 and not recv_exact(client, buffer, count * 4):
+        return None
+    return count
+
+
+def receive_tile_ops(client, target_buffer_bytes=None, rect_count=None):
+    """Receive tile op lists and the rects that follow them (see dirty_rects.hpp).
+    
+    Refs and fills are drawn first, then the rects, then copies and stores.
+    For MSG_TILE_OPS the rect count follows the lists; flash data passes it.
+    """
+    global last_dirty_dims
+    
+    if target_buffer_bytes is None:
+        target_buffer_bytes = stream_buffer_bytes
+    cache = memoryview(tile_cache)
+    row_bytes = TILE_SIZE * 2
+    touched = [FRAME_WIDTH, FRAME_HEIGHT, 0, 0]
+    
+    def touch(x, y, w, h):
+        touched[0] = min(touched[0], x)
+        touched[1] = min(touched[1], y)
+        touched[2] = max(touched[2], x + w)
+        touched[3] = max(touched[3], y + h)
+    
+    # Refs: draw straight from the cache
+    count = receive_tile_list(client, tile_list_buffer)
+    if count is None:
+        return False
+    for i in range(count):
+        offset = i * 4
+        x = tile_list_buffer[offset] * TILE_SIZE
+        y = tile_list_buffer[offset + 1] * TILE_SIZE
+        slot = tile_list_buffer[offset + 2] | (tile_list_buffer[offset + 3] << 8)
+        src = slot * TILE_BYTES
+        for row in range(TILE_SIZE):
+            dst = ((y + row) * FRAME_WIDTH + x) * 2
+            target_buffer_bytes[dst:dst + row_bytes] = cache[src:src + row_bytes]
+            src += row_bytes
+        touch(x, y, TILE_SIZE, TILE_SIZE)
+    
+    # Fills
+    count = receive_tile_list(client, tile_list_buffer)
+    if count is None:
+        return False
+    for i in range(count):
+        offset = i * 4
+        x = tile_list_buffer[offset] * TILE_SIZE
+        y = tile_list_buffer[offset + 1] * TILE_SIZE
+        fill_row = bytes((tile_list_buffer[offset + 2], tile_list_buffer[offset + 3])) * TILE_SIZE
+        for row in range(TILE_SIZE):
+            dst = ((y + row) * FRAME_WIDTH + x) * 2
+            target_buffer_bytes[dst:dst + row_bytes] = fill_row
+        touch(x, y, TILE_SIZE, TILE_SIZE)
+    
+    # Copies and stores wait until the rects are applied
+    copy_count = receive_tile_list(client, tile_copy_buffer)
+    if copy_count is None:
+        return False
+    store_count = receive_tile_list(client, tile_store_buffer)
+    if store_count is None:
+        return False
+    
+    if rect_count is None:
+        if not recv_exact(client, header_buffer, 1):
+            return False
+        rect_count = header_buffer[0]
+    if rect_count > 0:
+        if not receive_dirty_rects(client, rect_count, target_buffer_bytes, with_codecs=True):
+            return False
+        rx0, ry0, rx1, ry1 = last_dirty_dims
+        touch(rx0, ry0, rx1 - rx0, ry1 - ry0)
+    
+    for i in range(copy_count):
+        offset = i * 4
+        sx = tile_copy_buffer[offset] * TILE_SIZE
+        sy = tile_copy_buffer[offset + 1] * TILE_SIZE
+        x = tile_copy_buffer[offset + 2] * TILE_SIZE
+        y = tile_copy_buffer[offset + 3] * TILE_SIZE
+        for row in range(TILE_SIZE):
+            src = ((sy + row) * FRAME_WIDTH + sx) * 2
+            dst = ((y + row) * FRAME_WIDTH + x) * 2
+            target_buffer_bytes[dst:dst + row_bytes] = target_buffer_bytes[src:src + row_bytes]
+        touch(x, y, TILE_SIZE, TILE_SIZE)
+    
+    for i in range(store_count):
+        offset = i * 4
+        x = tile_store_buffer[offset] * TILE_SIZE
+        y = tile_store_buffer[offset + 1] * TILE_SIZE
+        slot = tile_store_buffer[offset + 2] | (tile_store_buffer[offset + 3] << 8)
+        dst = slot * TILE_BYTES
+        for row in range(TILE_SIZE):
+            src = ((y + row) * FRAME_WIDTH + x) * 2
+            cache[dst:dst + row_bytes] = target_buffer_bytes[src:src + row_bytes]
+            dst += row_bytes
+    
+    if touched[2] > touched[0]:
+        last_dirty_dims = tuple(touched)
+    else:
+        last_dirty_dims = (0, 0, 0, 0)
+    return True
+
+
 def handle_common_message(client, msg_type):
     """Handle message types common to both streaming and flash modes.
     
@@ -190,6 +520,7 @@ def handle_common_message(client, msg_type):
         ('mode_change', mode): Mode change requested
         None: Message type not handled (caller should handle it)
     """
+    global ack_window
     if msg_type == MSG_FULL_FRAME:
         if not receive_full_frame(client):
             return False
@@ -208,11 +539,46 @@ def handle_common_message(client, msg_type):
             return False
         return True
     
+    elif msg_type == MSG_DIRTY_RECTS_RLE:
+        if not recv_exact(client, header_buffer, 1):
+            return False
+        rect_count = header_buffer[0]
+        if rect_count > 0:
+            if not receive_dirty_rects(client, rect_count, with_codecs=True):
+                return False
+        if not send_ack(client):
+            return False
+        return True
+    
+    elif msg_type == MSG_TILE_OPS:
+        if not receive_tile_ops(client):
+            return False
+        if not send_ack(client):
+            return False
+        return True
+    
     elif msg_type == MSG_NO_CHANGE:
         if not send_ack(client):
             return False
         return True
     
+    elif msg_type == MSG_HELLO:
+        if not recv_exact(client, header_buffer, 4):
+            return False
+        host_version = header_buffer[0]
+        codecs = header_buffer[1]
+        slots = header_buffer[2] | (header_buffer[3] << 8)
+        window = 0
+        if host_version >= 2:
+            if not recv_exact(client, header_buffer, 1):
+                return False
+            window = header_buffer[0]
+        print(f"Host protocol v{host_version}, codecs 0x{codecs:02x}, tile cache slots {slots}, window {window}")
+        if not send_ack(client):
+            return False
+        ack_window = window  # Applies from the next ACK
+        return True
+    
     elif msg_type == MSG_SET_MODE:
         if not recv_exact(client, header_buffer, 1):
             return False
@@ -279,7 +645,7 @@ def handle_frame_flash(client, flash_mgr, group):
         flash_mgr.advance_animations()
         
         # Mark dirty region for stream layer
-        if data['rect_count'] > 0:
+        if data['dirty']:
             min_x, min_y, max_x, max_y = last_dirty_dims
             flash_mgr.stream_bitmap.dirty(min_x, min_y, max_x, max_y)
         
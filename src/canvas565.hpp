@@ -0,0 +1,181 @@
+#pragma once
+
+#include "image.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace qualia {
+
+// 8-bit RGBA color, straight (not premultiplied) alpha
+struct Rgba {
+    uint8_t r = 0, g = 0, b = 0, a = 255;
+};
+
+// Maps a drawable's local coordinates (u, v) to texture coordinates:
+//   x = a * u + b * v + tx
+//   y = c * u + d * v + ty
+struct Affine {
+    float a = 1.0f, b = 0.0f, tx = 0.0f;
+    float c = 0.0f, d = 1.0f, ty = 0.0f;
+};
+
+// Software rasterizer that draws straight into a panel frame. Coordinates
+// are those of the landscape render texture skins lay out in (the frame's
+// height x width), and pixels are rotated into the panel as they're
+// written, like textureToRGB565Rot90 (neg90 = false) or
+// textureToRGB565RotNeg90, so there is nothing to read back or convert.
+//
+// Pixels are covered when their center falls inside the transformed
+// rect, and sampled nearest like unsmoothed sf::Textures. Blending is
+// SFML's BlendAlpha, with the destination widened back from RGB565.
+class Canvas565 {
+public:
+    // Draw into frame, resized to the panel from here on
+    void begin(Image& frame, bool neg90) {
+        if (frame.width != DISPLAY_WIDTH || frame.height != DISPLAY_HEIGHT) {
+            frame.resize(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+        }
+        frame_ = &frame;
+        neg90_ = neg90;
+    }
+
+    bool isBound() const { return frame_ != nullptr; }
+    bool neg90() const { return neg90_; }
+
+    // Texture space size
+    int width() const { return frame_ ? frame_->height : 0; }
+    int height() const { return frame_ ? frame_->width : 0; }
+
+    void clear(Rgba color) {
+        if (frame_) frame_->clear(rgb565(color.r, color.g, color.b));
+    }
+
+    // Fill local rect (0, 0, w, h)
+    void fill(const Affine& t, float w, float h, Rgba color) {
+        if (color.a == 0) return;
+        const Pixel opaque = rgb565(color.r, color.g, color.b);
+        rasterize(t, w, h, [&](Pixel& dst, int, int) {
+            if (color.a == 255) {
+                dst = opaque;
+            } else {
+                blend(dst, color.r, color.g, color.b, color.a);
+            }
+        });
+    }
+
+    // Draw srcW x srcH RGBA8 pixels (stride in pixels) over local rect
+    // (0, 0, srcW, srcH), modulated by tint
+    void blit(const uint8_t* src, ptrdiff_t stride, int srcW, int srcH, const Affine& t, Rgba tint) {
+        if (!src || srcW <= 0 || srcH <= 0 || tint.a == 0) return;
+        const bool plain = tint.r == 255 && tint.g == 255 && tint.b == 255 && tint.a == 255;
+        rasterize(t, (float)srcW, (float)srcH, [&](Pixel& dst, int u, int v) {
+            const uint8_t* p = src + (v * stride + u) * 4;
+            if (plain) {
+                if (p[3] == 255) {
+                    dst = rgb565(p[0], p[1], p[2]);
+                } else if (p[3] != 0) {
+                    blend(dst, p[0], p[1], p[2], p[3]);
+                }
+            } else {
+                uint8_t a = modulate(p[3], tint.a);
+                if (a != 0) blend(dst, modulate(p[0], tint.r), modulate(p[1], tint.g), modulate(p[2], tint.b), a);
+            }
+        });
+    }
+
+private:
+    Image* frame_ = nullptr;
+    bool neg90_ = false;
+    std::vector<int> sourceRows_;  // Scratch for axis aligned draws
+
+    // x * y / 255, rounded like the GPU's normalized multiply
+    static uint8_t modulate(uint8_t x, uint8_t y) {
+        return (uint8_t)((x * y + 127) / 255);
+    }
+
+    // 5 or 6 bits back to 8, replicating the top bits into the bottom
+    static uint8_t widen5(int v) { return (uint8_t)((v << 3) | (v >> 2)); }
+    static uint8_t widen6(int v) { return (uint8_t)((v << 2) | (v >> 4)); }
+
+    static void blend(Pixel& dst, uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+        if (a == 255) {
+            dst = rgb565(r, g, b);
+            return;
+        }
+        const int inv = 255 - a;
+        const int dr = widen5(dst >> 11), dg = widen6((dst >> 5) & 0x3F), db = widen5(dst & 0x1F);
+        dst = rgb565((uint8_t)((r * a + dr * inv + 127) / 255),
+                     (uint8_t)((g * a + dg * inv + 127) / 255),
+                     (uint8_t)((b * a + db * inv + 127) / 255));
+    }
+
+    // Call shade(dst, u, v) for each frame pixel whose center maps inside
+    // local rect (0, 0, w, h), with (u, v) the local pixel it lands on.
+    // Walks the frame in panel order so writes stay sequential.
+    template <typename Shade>
+    void rasterize(const Affine& t, float w, float h, Shade&& shade) {
+        if (!frame_ || w <= 0.0f || h <= 0.0f) return;
+        const float det = t.a * t.d - t.b * t.c;
+        if (std::fabs(det) < 1e-6f) return;
+
+        // Texture space bounds of the transformed rect
+        const float xs[4] = {t.tx, t.a * w + t.tx, t.b * h + t.tx, t.a * w + t.b * h + t.tx};
+        const float ys[4] = {t.ty, t.c * w + t.ty, t.d * h + t.ty, t.c * w + t.d * h + t.ty};
+        const int texW = width(), texH = height();
+        const int x0 = std::max((int)std::floor(*std::min_element(xs, xs + 4)), 0);
+        const int x1 = std::min((int)std::ceil(*std::max_element(xs, xs + 4)), texW);
+        const int y0 = std::max((int)std::floor(*std::min_element(ys, ys + 4)), 0);
+        const int y1 = std::min((int)std::ceil(*std::max_element(ys, ys + 4)), texH);
+        if (x0 >= x1 || y0 >= y1) return;
+
+        // Inverse map. Texture column x is panel row py, and panel x runs
+        // over texture rows, down for Rot90 and up for RotNeg90.
+        const float ia = t.d / det, ib = -t.b / det, ic = -t.c / det, id = t.a / det;
+        const int px0 = neg90_ ? y0 : texH - y1;
+        const int px1 = neg90_ ? y1 : texH - y0;
+        auto texY = [&](int px) { return (float)(neg90_ ? px : texH - 1 - px) + 0.5f - t.ty; };
+        const int maxU = (int)std::ceil(w) - 1, maxV = (int)std::ceil(h) - 1;
+
+        if (t.b == 0.0f && t.c == 0.0f) {
+            // Axis aligned, as skins draw: u only changes between panel rows
+            // and v only along them, the same way on every row
+            sourceRows_.resize(px1 - px0);
+            int first = px1, last = px0;
+            for (int px = px0; px < px1; ++px) {
+                const float v = id * texY(px);
+                if (v < 0.0f || v >= h) continue;
+                sourceRows_[px - px0] = std::min((int)v, maxV);
+                first = std::min(first, px);
+                last = std::max(last, px + 1);
+            }
+            for (int x = x0; x < x1; ++x) {
+                const float u = ia * (x + 0.5f - t.tx);
+                if (u < 0.0f || u >= w) continue;
+                const int iu = std::min((int)u, maxU);
+                const int py = neg90_ ? texW - 1 - x : x;
+                Pixel* row = &frame_->pixels[(size_t)py * frame_->width];
+                for (int px = first; px < last; ++px) {
+                    shade(row[px], iu, sourceRows_[px - px0]);
+                }
+            }
+            return;
+        }
+
+        for (int x = x0; x < x1; ++x) {
+            const int py = neg90_ ? texW - 1 - x : x;
+            const float cx = x + 0.5f - t.tx;
+            Pixel* row = &frame_->pixels[(size_t)py * frame_->width];
+            for (int px = px0; px < px1; ++px) {
+                const float cy = texY(px);
+                const float u = ia * cx + ib * cy, v = ic * cx + id * cy;
+                if (u < 0.0f || v < 0.0f || u >= w || v >= h) continue;
+                shade(row[px], std::min((int)u, maxU), std::min((int)v, maxV));
+            }
+        }
+    }
+};
+
+} // namespace qualia
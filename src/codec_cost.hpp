@@ -0,0 +1,225 @@
+#pragma once
+
+#include "rect_codec.hpp"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include "log.hpp"
+
+namespace qualia {
+
+constexpr int RECT_CODEC_COUNT = 5;
+constexpr int RECT_HEADER_BYTES = 9;  // x, y, w, h, codec
+
+inline const char* rectCodecName(RectCodec codec) {
+    switch (codec) {
+        case RectCodec::Raw: return "raw";
+        case RectCodec::Rle: return "rle";
+        case RectCodec::XorRle: return "xor_rle";
+        case RectCodec::Fill: return "fill";
+        case RectCodec::Move: return "move";
+    }
+    return "unknown";
+}
+
+// Estimated end-to-end time of sending a rect with a given codec, in
+// microseconds: wire time plus device decode time (per rect, per row, per
+// pixel and per payload byte). Host encode time is tracked separately and
+// only used to skip codecs that can't pay for themselves.
+//
+// Coefficients start from rough ESP32-S3 CircuitPython figures and are
+// refined online from measured send-to-ACK latency (normalized LMS over the
+// per-message totals), and saved per board.
+class CodecCostModel {
+public:
+    struct DeviceCost {
+        float rectUs;
+        float rowUs;
+        float pixelUs;
+        float byteUs;
+    };
+
+    // Per-message totals, the regression features
+    struct Sample {
+        bool valid = false;
+        float wireBytes = 0;
+        float tileOps = 0;
+        std::array<std::array<float, 4>, RECT_CODEC_COUNT> codec{};  // rects, rows, pixels, payload bytes
+    };
+
+    CodecCostModel() { reset(); }
+
+    void reset() {
+        wireUsPerByte_ = 0.67f;  // ~1.5 MB/s effective Wi-Fi
+        messageUs_ = 3000.0f;    // Dispatch and ACK round trip
+        tileOpUs_ = 40.0f;
+        device_[index(RectCodec::Raw)] = {130.0f, 30.0f, 0.0f, 0.0f};
+        device_[index(RectCodec::Rle)] = {150.0f, 60.0f, 0.0f, 3.0f};
+        device_[index(RectCodec::XorRle)] = {150.0f, 60.0f, 0.0f, 8.0f};
+        device_[index(RectCodec::Fill)] = {150.0f, 15.0f, 0.0f, 0.0f};
+        device_[index(RectCodec::Move)] = {200.0f, 80.0f, 0.0f, 8.0f};
+        hostUsPerPixel_.fill(0.0f);
+        samples_ = 0;
+    }
+
+    const DeviceCost& deviceCost(RectCodec codec) const { return device_[index(codec)]; }
+    float wireUsPerByte() const { return wireUsPerByte_; }
+    uint64_t sampleCount() const { return samples_; }
+
+    // Estimated time to deliver and decode a rect with this payload size
+    float rectUs(RectCodec codec, int w, int h, size_t payloadBytes) const {
+        return fixedUs(codec, w, h) + (wireUsPerByte_ + device_[index(codec)].byteUs) * payloadBytes;
+    }
+
+    // Largest payload for which codec still beats costUs (0 if none does)
+    size_t payloadBudget(RectCodec codec, int w, int h, float costUs) const {
+        float left = costUs - fixedUs(codec, w, h) - hostUs(codec, w, h);
+        if (left <= 0) return 0;
+        return (size_t)(left / (wireUsPerByte_ + device_[index(codec)].byteUs));
+    }
+
+    // Measured host encode time
+    float hostUs(RectCodec codec, int w, int h) const {
+        return hostUsPerPixel_[index(codec)] * w * h;
+    }
+
+    void recordHostTime(RectCodec codec, int w, int h, float us) {
+        if (w * h == 0) return;
+        float& perPixel = hostUsPerPixel_[index(codec)];
+        perPixel += 0.05f * (us / (w * h) - perPixel);
+    }
+
+    static void addRect(Sample& sample, RectCodec codec, int w, int h, size_t payloadBytes) {
+        auto& f = sample.codec[index(codec)];
+        f[0] += 1;
+        f[1] += (float)h;
+        f[2] += (float)w * h;
+        f[3] += (float)payloadBytes;
+    }
+
+    float predictUs(const Sample& s) const {
+        float us = messageUs_ + wireUsPerByte_ * s.wireBytes + tileOpUs_ * s.tileOps;
+        for (int c = 0; c < RECT_CODEC_COUNT; ++c) {
+            const auto& f = s.codec[c];
+            const DeviceCost& d = device_[c];
+            us += d.rectUs * f[0] + d.rowUs * f[1] + d.pixelUs * f[2] + d.byteUs * f[3];
+        }
+        return us;
+    }
+
+    // Refine the coefficients from a measured send-to-ACK time
+    void observe(const Sample& s, float measuredUs) {
+        if (!s.valid || measuredUs <= 0) return;
+
+        // Features and coefficients; each feature is scaled by the inverse of
+        // its typical per-message size so no single one dominates the step
+        struct Term { float x; float* theta; float scale; };
+        std::array<Term, 3 + RECT_CODEC_COUNT * 4> terms;
+        int n = 0;
+        terms[n++] = {1.0f, &messageUs_, 1.0f};
+        terms[n++] = {s.wireBytes, &wireUsPerByte_, 1e-4f};
+        terms[n++] = {s.tileOps, &tileOpUs_, 0.1f};
+        for (int c = 0; c < RECT_CODEC_COUNT; ++c) {
+            DeviceCost& d = device_[c];
+            terms[n++] = {s.codec[c][0], &d.rectUs, 1.0f};
+            terms[n++] = {s.codec[c][1], &d.rowUs, 1e-2f};
+            terms[n++] = {s.codec[c][2], &d.pixelUs, 1e-4f};
+            terms[n++] = {s.codec[c][3], &d.byteUs, 1e-4f};
+        }
+
+        float predicted = predictUs(s);
+        // Clip so one Wi-Fi stall doesn't wreck the model
+        float err = std::clamp(measuredUs - predicted, -predicted, predicted);
+        float norm = 1e-3f;
+        for (int i = 0; i < n; ++i) {
+            float x = terms[i].x * terms[i].scale;
+            norm += x * x;
+        }
+        const float mu = 0.05f;
+        for (int i = 0; i < n; ++i) {
+            if (terms[i].x == 0) continue;
+            // NLMS step on theta / scale, which multiplies x * scale
+            float x = terms[i].x * terms[i].scale;
+            *terms[i].theta = max(0.0f, *terms[i].theta + mu * err * x / norm * terms[i].scale);
+        }
+        wireUsPerByte_ = max(wireUsPerByte_, 0.05f);  // Keep payload size relevant
+        samples_++;
+    }
+
+    bool load(const std::filesystem::path& path) {
+        std::ifstream file(path);
+        if (!file) return false;
+        try {
+            nlohmann::json j = nlohmann::json::parse(file);
+            wireUsPerByte_ = j.value("wire_us_per_byte", wireUsPerByte_);
+            messageUs_ = j.value("message_us", messageUs_);
+            tileOpUs_ = j.value("tile_op_us", tileOpUs_);
+            samples_ = j.value("samples", (uint64_t)0);
+            if (j.contains("codecs")) {
+                for (int c = 0; c < RECT_CODEC_COUNT; ++c) {
+                    const char* name = rectCodecName((RectCodec)c);
+                    if (!j["codecs"].contains(name)) continue;
+                    const auto& jc = j["codecs"][name];
+                    DeviceCost& d = device_[c];
+                    d.rectUs = jc.value("rect_us", d.rectUs);
+                    d.rowUs = jc.value("row_us", d.rowUs);
+                    d.pixelUs = jc.value("pixel_us", d.pixelUs);
+                    d.byteUs = jc.value("byte_us", d.byteUs);
+                    hostUsPerPixel_[c] = jc.value("host_us_per_pixel", 0.0f);
+                }
+            }
+        } catch (const std::exception& e) {
+            LOG_WARN << "Failed to load codec costs from " << path << ": " << e.what() << "\n";
+            reset();
+            return false;
+        }
+        return true;
+    }
+
+    bool save(const std::filesystem::path& path) const {
+        nlohmann::json j;
+        j["wire_us_per_byte"] = wireUsPerByte_;
+        j["message_us"] = messageUs_;
+        j["tile_op_us"] = tileOpUs_;
+        j["samples"] = samples_;
+        for (int c = 0; c < RECT_CODEC_COUNT; ++c) {
+            const DeviceCost& d = device_[c];
+            j["codecs"][rectCodecName((RectCodec)c)] = {
+                {"rect_us", d.rectUs},
+                {"row_us", d.rowUs},
+                {"pixel_us", d.pixelUs},
+                {"byte_us", d.byteUs},
+                {"host_us_per_pixel", hostUsPerPixel_[c]}
+            };
+        }
+        try {
+            std::filesystem::create_directories(path.parent_path());
+            std::ofstream file(path);
+            file << j.dump(2);
+            return (bool)file;
+        } catch (const std::exception& e) {
+            LOG_WARN << "Failed to save codec costs to " << path << ": " << e.what() << "\n";
+            return false;
+        }
+    }
+
+private:
+    float wireUsPerByte_;
+    float messageUs_;
+    float tileOpUs_;
+    std::array<DeviceCost, RECT_CODEC_COUNT> device_;
+    std::array<float, RECT_CODEC_COUNT> hostUsPerPixel_;
+    uint64_t samples_ = 0;
+
+    static int index(RectCodec codec) { return (int)codec; }
+
+    float fixedUs(RectCodec codec, int w, int h) const {
+        const DeviceCost& d = device_[index(codec)];
+        return wireUsPerByte_ * RECT_HEADER_BYTES + d.rectUs + d.rowUs * h + d.pixelUs * w * h;
+    }
+};
+
+} // namespace qualia
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "dirty_rects.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace qualia {
+
+// One drawn item: a stable key, a hash of everything that affects its
+// pixels (texture, string, color, exact position, draw order) and the
+// pixel bounds it can touch
+struct DamageElement {
+    uint32_t key;
+    uint64_t content;
+    DirtyRect bounds;
+};
+
+// Everything a skin drew for one frame. Two snapshots of the same skin
+// can be diffed to find the regions that may differ between the frames.
+struct DamageSnapshot {
+    std::vector<DamageElement> elements;
+    bool valid = false;     // False if the drawer doesn't track its elements
+    uint32_t epoch = 0;     // Changes when resources are (re)loaded
+    uint32_t layout = 0;    // Coordinate space, e.g. panel rotation
+};
+
+inline uint32_t newDamageEpoch() {
+    static std::atomic<uint32_t> next{1};
+    return next++;
+}
+
+constexpr uint32_t damageKey(std::string_view name) {
+    uint32_t h = 2166136261u;  // FNV-1a
+    for (char c : name) {
+        h = (h ^ (uint8_t)c) * 16777619u;
+    }
+    return h;
+}
+
+// Incremental content hash for DamageElement::content
+class DamageHasher {
+public:
+    DamageHasher& add(const void* data, size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            h_ = (h_ ^ p[i]) * 1099511628211ULL;  // FNV-1a 64
+        }
+        return *this;
+    }
+
+    template <typename T>
+    DamageHasher& add(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return add(&value, sizeof(T));
+    }
+
+    DamageHasher& add(std::string_view s) {
+        add(s.size());
+        return add(s.data(), s.size());
+    }
+
+    uint64_t value() const { return h_; }
+
+private:
+    uint64_t h_ = 14695981039346656037ULL;
+};
+
+// Regions that may differ between the frames drawn as `from` and `to`.
+// Returns false if they can't be compared and the whole frame must be scanned.
+inline bool diffDamageSnapshots(const DamageSnapshot& from, const DamageSnapshot& to,
+                                std::vector<DirtyRect>& damage) {
+    damage.clear();
+    if (!from.valid || !to.valid || from.epoch != to.epoch || from.layout != to.layout) {
+        return false;
+    }
+
+    auto find = [](const DamageSnapshot& s, uint32_t key) -> const DamageElement* {
+        for (const auto& e : s.elements) {
+            if (e.key == key) return &e;
+        }
+        return nullptr;
+    };
+    auto sameRect = [](const DirtyRect& a, const DirtyRect& b) {
+        return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+    };
+    auto add = [&](const DirtyRect& r) {
+        if (r.w > 0 && r.h > 0) damage.push_back(r);
+    };
+
+    for (const auto& e : to.elements) {
+        const DamageElement* old = find(from, e.key);
+        if (!old) {
+            add(e.bounds);
+        } else if (old->content != e.content || !sameRect(old->bounds, e.bounds)) {
+            add(old->bounds);
+            add(e.bounds);
+        }
+    }
+    for (const auto& e : from.elements) {
+        if (!find(to, e.key)) add(e.bounds);
+    }
+    return true;
+}
+
+// Elements drawn at the same size but a new position, e.g. a bobbing
+// sprite: their pixels probably moved by that offset
+inline void findMotionHints(const DamageSnapshot& from, const DamageSnapshot& to,
+                            std::vector<MotionHint>& hints) {
+    hints.clear();
+    if (!from.valid || !to.valid || from.epoch != to.epoch || from.layout != to.layout) {
+        return;
+    }
+    for (const auto& e : to.elements) {
+        for (const auto& old : from.elements) {
+            if (old.key != e.key) continue;
+            int dx = (int)e.bounds.x - old.bounds.x;
+            int dy = (int)e.bounds.y - old.bounds.y;
+            if ((dx != 0 || dy != 0) && e.bounds.w == old.bounds.w && e.bounds.h == old.bounds.h &&
+                std::abs(dx) <= MOTION_HINT_MAX && std::abs(dy) <= MOTION_HINT_MAX) {
+                hints.push_back({e.bounds, dx, dy});
+            }
+            break;
+        }
+    }
+}
+
+} // namespace qualia
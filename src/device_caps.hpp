@@ -0,0 +1,65 @@
+#pragma once
+
+#include "rect_codec.hpp"
+#include <cstdint>
+#include <cstddef>
+
+namespace qualia {
+
+constexpr uint8_t PROTOCOL_VERSION = 2;
+constexpr uint8_t ACK_WINDOWED = 0xA5;
+
+// What a board can decode, from the MSG_CAPS it sends when a client
+// connects. Boards without the handshake send nothing and get legacy().
+//
+// MSG_CAPS layout: [0x09][u8 version][u8 n][n bytes], fields below in
+// order, little-endian. Later versions only append fields, so n lets an
+// older host skip what it doesn't know.
+//   u16 message mask   bit i set: message type i is understood
+//   u8  codec mask     bit i set: RectCodec i is understood
+//   u16 tile cache slots
+//   u8  max rects per message
+//   u8  pixel byte order (0: little-endian RGB565)
+//   u32 receive buffer bytes (informational)
+//   u8  credits        frames the board takes in flight (version 2)
+//
+// The host answers with MSG_HELLO: [0x08][u8 version][u8 codec mask]
+// [u16 tile cache slots] it will use, then for version 2 boards [u8 window].
+// A nonzero window switches every later ACK from one byte to
+// [ACK_WINDOWED][u8 seq][u8 credits], seq counting messages after HELLO.
+struct DeviceCaps {
+    enum class PixelOrder : uint8_t { LittleEndian = 0, BigEndian = 1 };
+
+    uint8_t version = 0;          // 0: no handshake
+    uint16_t messages = 0x003F;   // Full frame through set mode
+    uint8_t codecs = 1 << (int)RectCodec::Raw;
+    uint16_t tileCacheSlots = 0;
+    uint8_t maxRects = 255;
+    PixelOrder pixelOrder = PixelOrder::LittleEndian;
+    uint32_t recvBufferBytes = 0;  // 0: unknown. Informational (logged); the window comes from credits
+    uint8_t credits = 0;
+
+    static constexpr size_t FIELD_BYTES = 11;
+
+    // Boards from before the handshake: the original message set only
+    static DeviceCaps legacy() { return DeviceCaps(); }
+
+    bool supportsMessage(uint8_t type) const { return type < 16 && (messages >> type) & 1; }
+    bool supportsCodec(RectCodec codec) const { return (codecs >> (int)codec) & 1; }
+
+    // Parse the fields after the length byte; false if too short
+    bool parse(uint8_t ver, const uint8_t* p, size_t n) {
+        if (ver == 0 || n < FIELD_BYTES) return false;
+        version = ver;
+        messages = (uint16_t)(p[0] | (p[1] << 8));
+        codecs = p[2];
+        tileCacheSlots = (uint16_t)(p[3] | (p[4] << 8));
+        maxRects = p[5];
+        pixelOrder = (PixelOrder)p[6];
+        recvBufferBytes = (uint32_t)p[7] | ((uint32_t)p[8] << 8) | ((uint32_t)p[9] << 16) | ((uint32_t)p[10] << 24);
+        credits = n > FIELD_BYTES ? p[11] : 0;
+        return true;
+    }
+};
+
+} // namespace qualia
@@ -1,10 +1,20 @@
 #pragma once
 
 #include "image.hpp"
+#include "tile_compare.hpp"
+#include "utils/worker_pool.h"
+#include "packet.hpp"
+#include "rect_codec.hpp"
+#include "codec_cost.hpp"
+#include "tile_cache.hpp"
 #include <vector>
 #include <cstring>
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <memory>
+#include <queue>
+#include <unordered_map>
 #include "log.hpp"
 
 namespace qualia {
@@ -13,6 +23,8 @@ namespace qualia {
 constexpr uint8_t MSG_FULL_FRAME = 0x00;
 constexpr uint8_t MSG_DIRTY_RECTS = 0x01;
 constexpr uint8_t MSG_NO_CHANGE = 0x02;
+constexpr uint8_t MSG_DIRTY_RECTS_RLE = 0x06;
+constexpr uint8_t MSG_TILE_OPS = 0x07;
 
 // Tile size for dirty detection (larger = fewer rects but more wasted pixels)
 constexpr int TILE_WIDTH = 16;
@@ -21,12 +33,45 @@ constexpr int TILE_HEIGHT = 16;
 constexpr int TILES_X = (DISPLAY_WIDTH + TILE_WIDTH - 1) / TILE_WIDTH;   // 15 tiles
 constexpr int TILES_Y = (DISPLAY_HEIGHT + TILE_HEIGHT - 1) / TILE_HEIGHT; // 60 tiles
 
+// Hierarchical detection: coarse blocks are compared first, and only dirty
+// blocks are split into tiles and then leaves of LEAF_SIZE_MIN..TILE_WIDTH
+constexpr int BLOCK_SIZE = 64;
+constexpr int BLOCKS_X = (DISPLAY_WIDTH + BLOCK_SIZE - 1) / BLOCK_SIZE;   // 4 blocks
+constexpr int BLOCKS_Y = (DISPLAY_HEIGHT + BLOCK_SIZE - 1) / BLOCK_SIZE; // 15 blocks
+constexpr int LEAF_SIZE_MIN = 4;
+constexpr int CELLS_X = DISPLAY_WIDTH / LEAF_SIZE_MIN;   // 60 cells
+constexpr int CELLS_Y = DISPLAY_HEIGHT / LEAF_SIZE_MIN;  // 240 cells
+
+// Leaf size per block from its recent activity (smoothed fraction of its
+// tiles that changed). Busy regions stop at whole tiles, quiet regions that
+// only see the odd text update are resolved down to 4x4.
+constexpr float LEAF_ACTIVITY_COARSE = 0.25f;  // above: 16x16 leaves
+constexpr float LEAF_ACTIVITY_MEDIUM = 0.05f;  // above: 8x8, otherwise 4x4
+
 // Maximum rectangles to send (keep protocol simple)
 constexpr int MAX_DIRTY_RECTS = 32;
 
+// Rect planning: each rect is only paired with its nearest neighbours, and
+// more rects than PLAN_RECTS_MAX (scattered 4x4 leaves) are pre-merged per
+// grid cell first, so planning stays cheap on sparse changes like dithering
+constexpr int PLAN_NEIGHBOURS = 8;
+constexpr int PLAN_RECTS_MAX = 8 * MAX_DIRTY_RECTS;
+
 // Threshold: if more than this fraction is dirty, send full frame instead
 constexpr float FULL_FRAME_THRESHOLD = 0.6f;
 
+// Tight-bounds refinement: relative cost of scanning one pixel versus sending
+// one pixel over the link. Refinement runs while the measured fraction of
+// bytes it saves stays above this; otherwise it is re-probed periodically.
+constexpr float REFINE_SCAN_COST = 0.01f;
+constexpr int REFINE_PROBE_INTERVAL = 30;  // frames
+
+// How the tracker decides whether a tile changed since the last frame
+enum class ChangeDetection {
+    PixelCompare,  // Keep a copy of the previous frame and compare pixels
+    TileHash       // Keep one 64-bit hash per tile, no previous frame copy
+};
+
 struct DirtyRect {
     uint16_t x, y, w, h;
     
@@ -34,6 +79,45 @@ struct DirtyRect {
     int byteSize() const { return pixelCount() * sizeof(Pixel); }
 };
 
+inline DirtyRect boundingRect(const DirtyRect& a, const DirtyRect& b) {
+    uint16_t minX = min(a.x, b.x);
+    uint16_t minY = min(a.y, b.y);
+    uint16_t maxX = max(a.x + a.w, b.x + b.w);
+    uint16_t maxY = max(a.y + a.h, b.y + b.h);
+    return {minX, minY, (uint16_t)(maxX - minX), (uint16_t)(maxY - minY)};
+}
+
+// Content inside bounds that probably moved by (dx, dy) since the last
+// frame, e.g. a sprite drawn at a new position
+struct MotionHint {
+    DirtyRect bounds;
+    int dx, dy;
+};
+
+constexpr int MOTION_SEARCH_RADIUS = 3;  // Offsets searched around zero, per axis
+constexpr int MOTION_HINT_MAX = 32;      // Largest hinted offset (Move payload is int8)
+
+// Cost of delivering a rect, in byte-equivalents on the wire. Device-side
+// work is converted to bytes at the link rate so both can be traded off.
+struct RectCostModel {
+    float headerBytes = 8.0f;      // x, y, w, h
+    float bytesPerPixel = 2.0f;    // RGB565
+    // CircuitPython decoder overhead: per-rect bookkeeping and one
+    // recv_into() per row. Starting estimates for the ESP32-S3 at ~1.5 MB/s
+    // effective Wi-Fi, i.e. ~1.5 bytes per microsecond of device time.
+    float rectSetupBytes = 200.0f;
+    float rowSetupBytes = 48.0f;
+
+    float rectCost(const DirtyRect& r) const {
+        return headerBytes + rectSetupBytes + rowSetupBytes * r.h + bytesPerPixel * r.pixelCount();
+    }
+
+    // A full frame is one contiguous receive with no per-rect or per-row work
+    float fullFrameCost() const {
+        return bytesPerPixel * DISPLAY_WIDTH * DISPLAY_HEIGHT;
+    }
+};
+
 // Packet header for dirty rect protocol
 // Format:
 //   [1 byte]  message type
@@ -41,6 +125,20 @@ struct DirtyRect {
 //     [1 byte]  rect count
 //     [8 bytes per rect] x, y, w, h as uint16_t little-endian
 //     [pixel data for each rect in sequence]
+//   If MSG_DIRTY_RECTS_RLE:
+//     [1 byte]  rect count
+//     [9 bytes per rect] x, y, w, h as uint16_t little-endian, codec (RectCodec)
+//     [payload for each rect in sequence, raw pixels, RLE or XOR delta RLE, see rect_codec.hpp]
+//   If MSG_TILE_OPS:
+//     [tile op lists]
+//     [MSG_DIRTY_RECTS_RLE body]
+//   Tile op lists (also in flash data with FLAG_TILE_OPS) are each a 2 byte
+//   count, then 4 bytes per op; tile coordinates are in 16 px units:
+//     refs:   tile x, tile y, cache slot uint16_t    draw from the device tile cache
+//     fills:  tile x, tile y, color uint16_t         solid tile
+//     copies: src x, src y, tile x, tile y           duplicate of a tile sent in this message
+//     stores: tile x, tile y, cache slot uint16_t    copy into the tile cache
+//   The device applies refs and fills, then the rects, then copies, then stores.
 //   If MSG_FULL_FRAME:
 //     [raw pixel data]
 //   If MSG_NO_CHANGE:
@@ -51,8 +149,59 @@ public:
     DirtyRectTracker() 
         : prevFrame_(DISPLAY_WIDTH, DISPLAY_HEIGHT)
         , dirtyTiles_(TILES_X * TILES_Y, false)
+        , dirtyCells_(CELLS_X * CELLS_Y, false)
+        , hintTiles_(TILES_X * TILES_Y, false)
+        , blockActivity_(BLOCKS_X * BLOCKS_Y, 0.0f)
         , hasReference_(false) 
-    {}
+    {
+        setDiffKernel(simd::detectDiffKernel());
+    }
+
+    // Select the tile comparison kernel (auto-detected at construction)
+    void setDiffKernel(simd::DiffKernel kernel) {
+        if (!simd::cpuSupports(kernel)) {
+            LOG_WARN << "Diff kernel " << simd::diffKernelName(kernel) << " not supported on this CPU, using scalar\n";
+            kernel = simd::DiffKernel::Scalar;
+        }
+        diffKernel_ = kernel;
+        tileDiff_ = simd::getTileDiff(kernel);
+    }
+
+    simd::DiffKernel getDiffKernel() const { return diffKernel_; }
+
+    // Cost model used to plan rects and choose full frames
+    void setCostModel(const RectCostModel& model) { costModel_ = model; }
+    const RectCostModel& getCostModel() const { return costModel_; }
+
+    // Select change detection mode. In TileHash mode the previous frame is only
+    // kept when verifyOnCollision is set, in which case tiles whose hash did not
+    // change are still compared pixel by pixel to rule out a collision.
+    // Forces the next frame to be full.
+    void setChangeDetection(ChangeDetection mode, bool verifyOnCollision = false) {
+        changeDetection_ = mode;
+        verifyOnCollision_ = verifyOnCollision;
+        if (keepsPreviousFrame()) {
+            prevFrame_.resize(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+        } else {
+            prevFrame_ = Image();  // Release the reference frame
+        }
+        tileHashes_.assign(usesTileHashes() ? TILES_X * TILES_Y : 0, 0);
+        hasReference_ = false;
+    }
+
+    ChangeDetection getChangeDetection() const { return changeDetection_; }
+
+    // Scan tile bands on a worker pool (not owned; nullptr scans serially)
+    void setWorkerPool(WorkerPool* pool) { pool_ = pool; }
+
+    // Hierarchical block -> tile -> leaf detection (default). Needs the
+    // previous frame, so plain TileHash mode always uses flat tiles.
+    void setHierarchical(bool enabled) { hierarchical_ = enabled; }
+    bool isHierarchical() const { return hierarchical_; }
+
+    // Per-tile hashes of the last frame (row-major, TILES_X * TILES_Y).
+    // Empty unless TileHash detection is active.
+    const std::vector<uint64_t>& getTileHashes() const { return tileHashes_; }
 
     // Debug: print rectangles
     void debugPrintRects(const std::vector<DirtyRect>& rects) const {
@@ -64,101 +213,262 @@ public:
     }
     
     // Compare current frame against previous, returns dirty rectangles
-    // Also updates internal reference frame
-    std::vector<DirtyRect> findDirtyRects(const Image& currentFrame) {
+    // Also updates internal reference frame. If damage is given, only tiles
+    // overlapping it are compared: the caller guarantees nothing outside it
+    // changed since the previous call.
+    std::vector<DirtyRect> findDirtyRects(const Image& currentFrame, const std::vector<DirtyRect>* damage = nullptr) {
         std::vector<DirtyRect> rects;
+        hintActive_ = false;
+        clearTileOps();
+        sample_ = {};
         
         if (!hasReference_) {
             // First frame - mark everything dirty
             rects.push_back({0, 0, (uint16_t)DISPLAY_WIDTH, (uint16_t)DISPLAY_HEIGHT});
-            prevFrame_ = currentFrame;
+            if (usesTileHashes()) {
+                for (int ty = 0; ty < TILES_Y; ++ty) {
+                    for (int tx = 0; tx < TILES_X; ++tx) {
+                        tileHashes_[ty * TILES_X + tx] = hashTileAt(currentFrame, tx, ty);
+                    }
+                }
+            }
+            updateReference(currentFrame);
             hasReference_ = true;
             return rects;
         }
-        
-        // Reset dirty tiles
-        std::fill(dirtyTiles_.begin(), dirtyTiles_.end(), false);
-        int dirtyTileCount = 0;
-        
-        // Check each tile for changes
-        for (int ty = 0; ty < TILES_Y; ++ty) {
-            for (int tx = 0; tx < TILES_X; ++tx) {
-                if (isTileDirty(currentFrame, tx, ty)) {
-                    dirtyTiles_[ty * TILES_X + tx] = true;
-                    dirtyTileCount++;
-                }
+
+        if (damage) {
+            if (!markHintTiles(*damage)) {
+                return rects;  // Nothing drawn differently, nothing to compare
             }
         }
         
-        // If too many tiles dirty, return single full-frame rect
-        float dirtyRatio = (float)dirtyTileCount / (TILES_X * TILES_Y);
+        // Tile-row bands are scanned independently (in parallel with a worker pool)
+        int dirtyPixels = usesHierarchy()
+            ? scanBands(dirtyCells_, CELLS_X, BLOCK_SIZE / LEAF_SIZE_MIN,
+                        [&](int band, BandScan& scan) { markCellBand(currentFrame, band, scan); })
+            : scanBands(dirtyTiles_, TILES_X, BLOCK_SIZE / TILE_HEIGHT,
+                        [&](int band, BandScan& scan) { markTileBand(currentFrame, band, scan); });
+
+        // Cached, solid and duplicate tiles are sent as tile ops instead
+        if (tileCache_ || tileDedup_) {
+            dirtyPixels -= extractTileOps(currentFrame);
+        }
+        
+        // If too much is dirty, return single full-frame rect
+        float dirtyRatio = (float)dirtyPixels / (DISPLAY_WIDTH * DISPLAY_HEIGHT);
         if (dirtyRatio > FULL_FRAME_THRESHOLD) {
+            clearDrawOps();
             rects.push_back({0, 0, (uint16_t)DISPLAY_WIDTH, (uint16_t)DISPLAY_HEIGHT});
-            prevFrame_ = currentFrame;
+            updateReference(currentFrame);
             // debugPrintRects(rects);
             return rects;
         }
         
-        // Merge adjacent dirty tiles into rectangles
-        rects = mergeDirtyTiles();
+        // Merge adjacent dirty tiles (or leaves) into rectangles
+        rects = usesHierarchy() ? mergeDirtyCells(dirtyCells_, CELLS_X, dirtyRowBegin_, dirtyRowEnd_, LEAF_SIZE_MIN)
+                                : mergeDirtyCells(dirtyTiles_, TILES_X, dirtyRowBegin_, dirtyRowEnd_, TILE_WIDTH);
+
+        // Shrink tile-snapped rects to the pixels that actually changed
+        refineRects(currentFrame, rects);
         
-        // Limit rectangle count
-        if (rects.size() > MAX_DIRTY_RECTS) {
-            rects = consolidateRects(rects, MAX_DIRTY_RECTS);
+        // Merge rects where it lowers the cost, and down to the rect limit
+        float planCost = planRects(rects, maxRects_);
+
+        // A fragmented frame can still be cheaper to send whole
+        if (planCost >= costModel_.fullFrameCost()) {
+            clearDrawOps();
+            rects.assign(1, {0, 0, (uint16_t)DISPLAY_WIDTH, (uint16_t)DISPLAY_HEIGHT});
         }
         
         // Update reference frame
-        prevFrame_ = currentFrame;
+        updateReference(currentFrame);
 
         // debugPrintRects(rects);
         
         return rects;
     }
     
-    // Build packet with dirty rect header and pixel data
-    std::vector<uint8_t> buildPacket(const Image& frame, const std::vector<DirtyRect>& rects) {
-        std::vector<uint8_t> packet;
-        
-        if (rects.empty()) {
+    // Build packet with dirty rect header and pixel data. Pixel rows are
+    // referenced in frame, which must stay alive until the packet is sent,
+    // and RLE payloads in the tracker, until the next buildPacket.
+    void buildPacket(const Image& frame, const std::vector<DirtyRect>& rects, GatherPacket& packet) {
+        packet.clear();
+        if (rects.empty() && !hasTileOps()) {
             // No changes
-            packet.push_back(MSG_NO_CHANGE);
-            return packet;
+            packet.appendU8(MSG_NO_CHANGE);
+            sample_.valid = true;
+            return;
         }
         
         // Check if it's a full frame
         bool isFullFrame = (rects.size() == 1 && 
                            rects[0].x == 0 && rects[0].y == 0 &&
                            rects[0].w == DISPLAY_WIDTH && rects[0].h == DISPLAY_HEIGHT);
+
+        if (hasTileOps()) {
+            packet.appendU8(MSG_TILE_OPS);
+            appendTileOps(packet, frame);
+            packet.appendU8(static_cast<uint8_t>(rects.size()));
+            appendCodedRects(packet, frame, rects);
+            sample_.valid = true;
+            return;
+        }
+        
+        if (rleEnabled_) {
+            // Full frames only switch message type if RLE actually shrinks them
+            encodeRects(frame, rects, rects.size());
+            if (!isFullFrame || encoded_[0].codec != RectCodec::Raw) {
+                packet.appendU8(MSG_DIRTY_RECTS_RLE);
+                packet.appendU8(static_cast<uint8_t>(rects.size()));
+                appendEncodedRects(packet, frame, rects);
+                sample_.valid = true;
+                return;
+            }
+        }
         
         if (isFullFrame) {
-            packet.push_back(MSG_FULL_FRAME);
+            packet.appendU8(MSG_FULL_FRAME);
             // Append raw pixel data
-            const uint8_t* data = frame.data();
-            packet.insert(packet.end(), data, data + frame.dataSize());
+            packet.appendRef(frame.data(), frame.dataSize());
         } else {
-            packet.push_back(MSG_DIRTY_RECTS);
-            packet.push_back(static_cast<uint8_t>(rects.size()));
-            
-            // Write rect headers
-            for (const auto& rect : rects) {
-                appendU16(packet, rect.x);
-                appendU16(packet, rect.y);
-                appendU16(packet, rect.w);
-                appendU16(packet, rect.h);
-            }
-            
-            // Write pixel data for each rect
-            for (const auto& rect : rects) {
-                appendRectPixels(packet, frame, rect);
-            }
+            packet.appendU8(MSG_DIRTY_RECTS);
+            packet.appendU8(static_cast<uint8_t>(rects.size()));
+            appendRects(packet, frame, rects);
         }
-        
-        return packet;
+        if (!rleEnabled_) {
+            for (const auto& r : rects) mirrorRect(frame, r);  // Otherwise done while encoding
+        }
+        sample_ = {};
+        for (const auto& r : rects) CodecCostModel::addRect(sample_, RectCodec::Raw, r.w, r.h, r.byteSize());
+        sample_.valid = true;
+    }
+
+    // Rect headers followed by each rect's pixel data
+    static void appendRects(GatherPacket& packet, const Image& frame, const std::vector<DirtyRect>& rects,
+                            size_t count = SIZE_MAX) {
+        count = min(count, rects.size());
+        for (size_t i = 0; i < count; ++i) {
+            packet.appendU16(rects[i].x);
+            packet.appendU16(rects[i].y);
+            packet.appendU16(rects[i].w);
+            packet.appendU16(rects[i].h);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            packet.appendRectPixels(frame, rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+        }
+    }
+    
+    // Tile op lists of the last findDirtyRects. They must go out before the
+    // rects (appendCodedRects), in the same message.
+    void appendTileOps(GatherPacket& packet, const Image& frame) {
+        appendTileList(packet, tileRefs_);
+        appendTileList(packet, tileFills_);
+        packet.appendU16(static_cast<uint16_t>(tileCopies_.size()));
+        for (const TileCopy& c : tileCopies_) {
+            packet.appendU8(c.srcX);
+            packet.appendU8(c.srcY);
+            packet.appendU8(c.tx);
+            packet.appendU8(c.ty);
+        }
+        appendTileList(packet, tileStores_);
+        noteDrawOps(frame);  // Rects may be XORed over these tiles
+        sample_.tileOps += (float)(tileRefs_.size() + tileFills_.size() + tileCopies_.size() + tileStores_.size());
+    }
+
+    bool hasTileOps() const {
+        return !tileRefs_.empty() || !tileFills_.empty() || !tileCopies_.empty() || !tileStores_.empty();
+    }
+
+    // Rect headers with codec byte, followed by each rect's payload. Each
+    // rect is a fill if solid, else whichever of raw, RLE and (with
+    // temporal delta) XOR RLE and move the cost model expects to reach the
+    // screen soonest.
+    void appendCodedRects(GatherPacket& packet, const Image& frame, const std::vector<DirtyRect>& rects,
+                          size_t count = SIZE_MAX) {
+        count = min(count, rects.size());
+        encodeRects(frame, rects, count);
+        appendEncodedRects(packet, frame, rects);
+        noteTileCopies(frame);
+    }
+
+    // Cost model features of the last buildPacket packet, to calibrate with
+    // its send-to-ACK time once that arrives (invalid for other packets)
+    CodecCostModel::Sample takeSample(size_t packetBytes) {
+        CodecCostModel::Sample sample = sample_;
+        sample.wireBytes = (float)packetBytes;
+        sample_.valid = false;
+        return sample;
     }
+
+    CodecCostModel& getCodecCosts() { return codecCosts_; }
+    const CodecCostModel& getCodecCosts() const { return codecCosts_; }
+
+    // Run-length coding of rect payloads (MSG_DIRTY_RECTS_RLE); the device must support it
+    void setRleEnabled(bool enabled) { rleEnabled_ = enabled; }
+    bool isRleEnabled() const { return rleEnabled_; }
+
+    // XOR rects against the pixels last sent to the device (needs RLE).
+    // Keeps a mirror of the device frame, which only becomes usable after
+    // a full frame, so this forces the next frame to be full.
+    void setTemporalDelta(bool enabled) {
+        temporalDelta_ = enabled;
+        if (enabled) {
+            deviceFrame_.resize(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+        } else {
+            deviceFrame_ = Image();
+        }
+        deviceFrameValid_ = false;
+        hasReference_ = false;
+    }
+
+    bool isTemporalDelta() const { return temporalDelta_; }
+
+    // Replace dirty tiles the device holds in its tile cache with references
+    // (MSG_TILE_OPS; needs RLE and a device with the cache).
+    // Forces the next frame to be full.
+    void setTileCache(bool enabled, int slots = TILE_CACHE_SLOTS) {
+        tileCache_ = enabled && slots > 0 ? std::make_unique<TileCache>(slots) : nullptr;
+        hasReference_ = false;
+    }
+
+    bool isTileCacheEnabled() const { return tileCache_ != nullptr; }
+
+    // Send solid dirty tiles as fills and repeats of a tile in the same frame
+    // as copies (MSG_TILE_OPS; needs RLE)
+    void setTileDedup(bool enabled) { tileDedup_ = enabled; }
+    bool isTileDedup() const { return tileDedup_; }
+
+    // Try rects as pixels already on the device moved by a small offset plus
+    // an XOR residual (RectCodec::Move; needs temporal delta)
+    void setMotionSearch(bool enabled) { motionSearch_ = enabled; }
+    bool isMotionSearch() const { return motionSearch_; }
+
+    // Rect codecs the device decodes, bit i for RectCodec i (Raw is always allowed)
+    void setCodecMask(uint8_t mask) { codecMask_ = mask | (1 << (int)RectCodec::Raw); }
+    uint8_t getCodecMask() const { return codecMask_; }
+
+    // Most rects per message the device accepts (at most MAX_DIRTY_RECTS)
+    void setMaxRects(int count) { maxRects_ = std::clamp(count, 1, MAX_DIRTY_RECTS); }
+    int getMaxRects() const { return maxRects_; }
+
+    // Trade the coded rect payloads of the last packet for another buffer,
+    // so the packet stays valid while later packets are built
+    void swapPayloads(std::vector<uint8_t>& buffer) { codecScratch_.swap(buffer); }
+
+    // Offsets to try first for the next packet, e.g. from the skin's draw list
+    void setMotionHints(const std::vector<MotionHint>& hints) { motionHints_ = hints; }
+
+    // Tiles drawn from the device cache in the last findDirtyRects
+    size_t getTileRefCount() const { return tileRefs_.size(); }
     
-    // Force next frame to be full (e.g., after reconnect)
+    // Force next frame to be full (e.g., after reconnect). The device frame
+    // and tile cache may be stale too, so delta coding waits for that full
+    // frame and the cache mirror starts empty.
     void invalidate() {
         hasReference_ = false;
+        deviceFrameValid_ = false;
+        if (tileCache_) tileCache_->clear();
     }
     
     // Statistics
@@ -184,7 +494,425 @@ public:
 private:
     Image prevFrame_;
     std::vector<bool> dirtyTiles_;
+    std::vector<bool> dirtyCells_;      // LEAF_SIZE_MIN grid, hierarchical mode
+    std::vector<bool> hintTiles_;       // Tiles overlapping this frame's damage hint
+    bool hintActive_ = false;
+    std::vector<float> blockActivity_;  // Per block, drives leaf size
+    int dirtyRowBegin_ = 0;             // Grid rows that may be set after a scan
+    int dirtyRowEnd_ = 0;
+    WorkerPool* pool_ = nullptr;
+
+    // Scan results for one band (one row of blocks), combined after the scan
+    struct BandScan {
+        std::vector<bool> dirty;  // Band-local rows of the tile or cell grid
+        int dirtyPixels = 0;
+        int rowBegin = 0;         // Band-local rows that may be set
+        int rowEnd = 0;
+    };
+    std::vector<BandScan> bands_;
     bool hasReference_;
+    bool hierarchical_ = true;
+    simd::DiffKernel diffKernel_ = simd::DiffKernel::Scalar;
+    simd::TileDiffFn tileDiff_ = simd::tileDiffScalar;
+    ChangeDetection changeDetection_ = ChangeDetection::PixelCompare;
+    bool verifyOnCollision_ = false;
+    std::vector<uint64_t> tileHashes_;
+    RectCostModel costModel_;
+
+    // Rect payload coding
+    struct EncodedRect {
+        RectCodec codec;
+        size_t offset;  // RLE payload in codecScratch_
+        size_t size;
+    };
+    bool rleEnabled_ = false;
+    bool temporalDelta_ = false;
+    Image deviceFrame_;             // What the device shows, once deviceFrameValid_
+    bool deviceFrameValid_ = false;
+    bool motionSearch_ = false;
+    uint8_t codecMask_ = 0xFF;
+    int maxRects_ = MAX_DIRTY_RECTS;
+    std::vector<MotionHint> motionHints_;
+    RleEncoder rleEncoder_;
+    std::vector<uint8_t> codecScratch_;
+    std::vector<EncodedRect> encoded_;
+    CodecCostModel codecCosts_;
+    CodecCostModel::Sample sample_;  // Features of the last packet, for calibration
+
+    // Tile ops (MSG_TILE_OPS)
+    struct TileRef {
+        uint8_t tx;
+        uint8_t ty;
+        uint16_t slot;  // Cache slot, or color for fills
+    };
+    struct TileCopy {
+        uint8_t srcX;
+        uint8_t srcY;
+        uint8_t tx;
+        uint8_t ty;
+    };
+    std::unique_ptr<TileCache> tileCache_;
+    bool tileDedup_ = false;
+    std::vector<TileRef> tileRefs_;    // Drawn from the cache this frame
+    std::vector<TileRef> tileFills_;   // Solid tiles
+    std::vector<TileCopy> tileCopies_; // Copies of literal tiles sent this frame
+    std::vector<TileRef> tileStores_;  // Copied into the cache after this frame
+    std::vector<TileRef> tileMisses_;  // Scratch: literal tiles
+    std::unordered_map<uint64_t, TileRef> literalTiles_;  // Scratch: copy sources by hash
+
+    static_assert(TILE_CACHE_TILE == TILE_WIDTH && TILE_CACHE_TILE == TILE_HEIGHT &&
+                  DISPLAY_WIDTH % TILE_WIDTH == 0 && DISPLAY_HEIGHT % TILE_HEIGHT == 0,
+                  "Tile ops work on whole dirty tiles");
+
+    void clearTileOps() {
+        clearDrawOps();
+        tileStores_.clear();
+    }
+
+    // Ops that replace sending a tile's pixels (not needed once a full frame is sent)
+    void clearDrawOps() {
+        tileRefs_.clear();
+        tileFills_.clear();
+        tileCopies_.clear();
+    }
+
+    // Turns dirty tiles into refs to the device cache, fills or copies of
+    // another dirty tile, and clears them from the dirty grid. Picks literal
+    // tiles to add to the cache. Returns the dirty pixels removed.
+    int extractTileOps(const Image& current) {
+        const bool cells = usesHierarchy();
+        std::vector<bool>& grid = cells ? dirtyCells_ : dirtyTiles_;
+        const int cols = cells ? CELLS_X : TILES_X;
+        const int unit = cells ? LEAF_SIZE_MIN : TILE_WIDTH;
+        const int per = TILE_WIDTH / unit;
+        const int stride = current.width;
+        auto tilePixels = [&](int tx, int ty) {
+            return current.pixels.data() + (size_t)ty * TILE_HEIGHT * stride + tx * TILE_WIDTH;
+        };
+        auto tileHash = [&](int tx, int ty) {
+            return usesTileHashes() ? tileHashes_[ty * TILES_X + tx] : hashTileAt(current, tx, ty);
+        };
+        auto sameTile = [&](const Pixel* a, const Pixel* b) {
+            for (int y = 0; y < TILE_HEIGHT; ++y) {
+                if (std::memcmp(a + (size_t)y * stride, b + (size_t)y * stride, TILE_WIDTH * sizeof(Pixel)) != 0) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        int removed = 0;
+        tileMisses_.clear();
+        literalTiles_.clear();
+        for (int ty = dirtyRowBegin_ / per; ty < (dirtyRowEnd_ + per - 1) / per; ++ty) {
+            for (int tx = 0; tx < TILES_X; ++tx) {
+                int set = 0;
+                for (int r = 0; r < per; ++r) {
+                    for (int c = 0; c < per; ++c) {
+                        set += grid[(ty * per + r) * cols + tx * per + c];
+                    }
+                }
+                if (set == 0) continue;
+
+                const Pixel* pixels = tilePixels(tx, ty);
+                const TileRef tile = {(uint8_t)tx, (uint8_t)ty, 0};
+                Pixel color;
+                if (tileDedup_ && solidColor(pixels, stride, TILE_WIDTH, TILE_HEIGHT, color)) {
+                    tileFills_.push_back({tile.tx, tile.ty, color});
+                } else {
+                    uint64_t hash = tileHash(tx, ty);
+                    int slot = tileCache_ ? tileCache_->find(hash, pixels, stride) : -1;
+                    if (slot >= 0) {
+                        tileRefs_.push_back({tile.tx, tile.ty, (uint16_t)slot});
+                    } else {
+                        auto src = tileDedup_ ? literalTiles_.find(hash) : literalTiles_.end();
+                        if (src != literalTiles_.end() && sameTile(tilePixels(src->second.tx, src->second.ty), pixels)) {
+                            tileCopies_.push_back({src->second.tx, src->second.ty, tile.tx, tile.ty});
+                        } else {
+                            if (tileDedup_) literalTiles_.emplace(hash, tile);
+                            tileMisses_.push_back(tile);
+                            continue;
+                        }
+                    }
+                }
+
+                for (int r = 0; r < per; ++r) {
+                    for (int c = 0; c < per; ++c) {
+                        grid[(ty * per + r) * cols + tx * per + c] = false;
+                    }
+                }
+                removed += set * unit * unit;
+            }
+        }
+
+        // Stores are captured after refs are drawn, so they can't be
+        // referenced until the next frame
+        if (tileCache_) {
+            for (const TileRef& miss : tileMisses_) {
+                if ((int)tileStores_.size() >= MAX_TILE_STORES) break;
+                uint64_t hash = tileHash(miss.tx, miss.ty);
+                const Pixel* pixels = tilePixels(miss.tx, miss.ty);
+                if (!tileCache_->seenBefore(hash) || tileCache_->find(hash, pixels, stride) >= 0) continue;
+                int slot = tileCache_->insert(hash, pixels, stride);
+                tileStores_.push_back({miss.tx, miss.ty, (uint16_t)slot});
+            }
+        }
+        return removed;
+    }
+
+    static void appendTileList(GatherPacket& packet, const std::vector<TileRef>& tiles) {
+        packet.appendU16(static_cast<uint16_t>(tiles.size()));
+        for (const TileRef& t : tiles) {
+            packet.appendU8(t.tx);
+            packet.appendU8(t.ty);
+            packet.appendU16(t.slot);
+        }
+    }
+
+    void copyTileToDevice(const Image& frame, int tx, int ty) {
+        for (int y = ty * TILE_HEIGHT; y < (ty + 1) * TILE_HEIGHT; ++y) {
+            size_t offset = (size_t)y * frame.width + tx * TILE_WIDTH;
+            std::memcpy(deviceFrame_.pixels.data() + offset, frame.pixels.data() + offset,
+                        TILE_WIDTH * sizeof(Pixel));
+        }
+    }
+
+    // Apply refs and fills to the device frame mirror (copies land after the rects)
+    void noteDrawOps(const Image& frame) {
+        if (!temporalDelta_ || !deviceFrameValid_) return;
+        for (const TileRef& t : tileRefs_) copyTileToDevice(frame, t.tx, t.ty);
+        for (const TileRef& t : tileFills_) copyTileToDevice(frame, t.tx, t.ty);
+    }
+
+    void encodeRects(const Image& frame, const std::vector<DirtyRect>& rects, size_t count) {
+        codecScratch_.clear();
+        encoded_.clear();
+        for (size_t i = 0; i < count; ++i) {
+            encoded_.push_back(encodeRect(frame, rects[i]));
+            CodecCostModel::addRect(sample_, encoded_.back().codec, rects[i].w, rects[i].h, encoded_.back().size);
+            // Later rects in the message see this one already applied
+            mirrorRect(frame, rects[i]);
+        }
+        motionHints_.clear();
+    }
+
+    // Fastest encoding of one rect by the cost model; payload appended to codecScratch_
+    EncodedRect encodeRect(const Image& frame, const DirtyRect& r) {
+        const size_t offset = codecScratch_.size();
+        Pixel color;
+        if (codecAllowed(RectCodec::Fill) &&
+            solidColor(frame.pixels.data() + (size_t)r.y * frame.width + r.x, frame.width, r.w, r.h, color)) {
+            codecScratch_.push_back((uint8_t)(color & 0xFF));
+            codecScratch_.push_back((uint8_t)(color >> 8));
+            return {RectCodec::Fill, offset, 2};
+        }
+
+        // Each candidate is encoded after the best so far, limited to the
+        // payload size at which it stops being faster (counting its own
+        // encode time), and replaces it if it fits
+        EncodedRect best = {RectCodec::Raw, offset, (size_t)r.byteSize()};
+        float bestUs = codecCosts_.rectUs(RectCodec::Raw, r.w, r.h, best.size);
+        auto tryCodec = [&](RectCodec codec, auto&& encode) {
+            if (!codecAllowed(codec)) return;
+            size_t limit = codecCosts_.payloadBudget(codec, r.w, r.h, bestUs);
+            if (limit == 0) return;
+            size_t start = codecScratch_.size();
+            auto t0 = std::chrono::steady_clock::now();
+            size_t size = encode(limit);
+            codecCosts_.recordHostTime(codec, r.w, r.h,
+                std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - t0).count());
+            if (size == 0) return;
+            codecScratch_.erase(codecScratch_.begin() + offset, codecScratch_.begin() + start);
+            best = {codec, offset, size};
+            bestUs = codecCosts_.rectUs(codec, r.w, r.h, size);
+        };
+
+        tryCodec(RectCodec::Rle, [&](size_t limit) {
+            return rleEncoder_.encodeRect(frame, r.x, r.y, r.w, r.h, codecScratch_, limit);
+        });
+        if (!rleEnabled_ || !temporalDelta_ || !deviceFrameValid_) return best;
+
+        tryCodec(RectCodec::XorRle, [&](size_t limit) {
+            return rleEncoder_.encodeXorRect(frame, r.x, r.y, r.w, r.h, deviceFrame_, r.x, r.y, codecScratch_, limit);
+        });
+        int dx, dy;
+        if (motionSearch_ && findMotion(frame, r, dx, dy)) {
+            tryCodec(RectCodec::Move, [&](size_t limit) -> size_t {
+                if (limit <= 2) return 0;
+                codecScratch_.push_back((uint8_t)(int8_t)dx);
+                codecScratch_.push_back((uint8_t)(int8_t)dy);
+                size_t size = rleEncoder_.encodeXorRect(frame, r.x, r.y, r.w, r.h, deviceFrame_, r.x - dx, r.y - dy,
+                                                        codecScratch_, limit - 2);
+                if (size == 0) {
+                    codecScratch_.resize(codecScratch_.size() - 2);
+                    return 0;
+                }
+                return size + 2;
+            });
+        }
+        return best;
+    }
+
+    bool codecAllowed(RectCodec codec) const { return (codecMask_ >> (int)codec) & 1; }
+
+    // Pixels of r that match the device frame shifted by (dx, dy), on every
+    // other row. -1 if the source would leave the frame.
+    int motionScore(const Image& frame, const DirtyRect& r, int dx, int dy) const {
+        if (r.x - dx < 0 || r.y - dy < 0 || r.x - dx + r.w > DISPLAY_WIDTH || r.y - dy + r.h > DISPLAY_HEIGHT) {
+            return -1;
+        }
+        int score = 0;
+        for (int y = r.y; y < r.y + r.h; y += 2) {
+            const Pixel* cur = frame.pixels.data() + (size_t)y * frame.width + r.x;
+            const Pixel* ref = deviceFrame_.pixels.data() + (size_t)(y - dy) * deviceFrame_.width + r.x - dx;
+            for (int x = 0; x < r.w; ++x) score += cur[x] == ref[x];
+        }
+        return score;
+    }
+
+    // Best offset for moving pixels already on the device into r: the motion
+    // hints that overlap it, and small offsets around zero. False if nothing
+    // beats XOR against the unmoved pixels by at least a row.
+    bool findMotion(const Image& frame, const DirtyRect& r, int& bestDx, int& bestDy) const {
+        const int still = motionScore(frame, r, 0, 0);
+        int bestScore = still;
+        auto tryOffset = [&](int dx, int dy) {
+            if (dx == 0 && dy == 0) return;
+            int score = motionScore(frame, r, dx, dy);
+            if (score > bestScore) {
+                bestScore = score;
+                bestDx = dx;
+                bestDy = dy;
+            }
+        };
+        for (const MotionHint& hint : motionHints_) {
+            if (hint.bounds.x < r.x + r.w && r.x < hint.bounds.x + hint.bounds.w &&
+                hint.bounds.y < r.y + r.h && r.y < hint.bounds.y + hint.bounds.h) {
+                tryOffset(hint.dx, hint.dy);
+            }
+        }
+        for (int dy = -MOTION_SEARCH_RADIUS; dy <= MOTION_SEARCH_RADIUS; ++dy) {
+            for (int dx = -MOTION_SEARCH_RADIUS; dx <= MOTION_SEARCH_RADIUS; ++dx) {
+                tryOffset(dx, dy);
+            }
+        }
+        return bestScore >= still + r.w;
+    }
+
+    // Apply a sent rect to the device frame mirror
+    void mirrorRect(const Image& frame, const DirtyRect& r) {
+        if (!temporalDelta_) return;
+        if (r.x == 0 && r.y == 0 && r.w == DISPLAY_WIDTH && r.h == DISPLAY_HEIGHT) {
+            deviceFrame_.pixels = frame.pixels;  // Keyframe
+            deviceFrameValid_ = true;
+        } else if (deviceFrameValid_) {
+            for (int y = r.y; y < r.y + r.h; ++y) {
+                size_t offset = (size_t)y * frame.width + r.x;
+                std::memcpy(deviceFrame_.pixels.data() + offset, frame.pixels.data() + offset,
+                            r.w * sizeof(Pixel));
+            }
+        }
+    }
+
+    // Apply tile copies to the device frame mirror (they land after the rects)
+    void noteTileCopies(const Image& frame) {
+        if (!temporalDelta_ || !deviceFrameValid_) return;
+        for (const TileCopy& c : tileCopies_) copyTileToDevice(frame, c.tx, c.ty);
+    }
+
+    void appendEncodedRects(GatherPacket& packet, const Image& frame, const std::vector<DirtyRect>& rects) const {
+        for (size_t i = 0; i < encoded_.size(); ++i) {
+            packet.appendU16(rects[i].x);
+            packet.appendU16(rects[i].y);
+            packet.appendU16(rects[i].w);
+            packet.appendU16(rects[i].h);
+            packet.appendU8(static_cast<uint8_t>(encoded_[i].codec));
+        }
+        for (size_t i = 0; i < encoded_.size(); ++i) {
+            const DirtyRect& r = rects[i];
+            if (encoded_[i].codec != RectCodec::Raw) {
+                packet.appendRef(codecScratch_.data() + encoded_[i].offset, encoded_[i].size);
+            } else {
+                packet.appendRectPixels(frame, r.x, r.y, r.w, r.h);
+            }
+        }
+    }
+    float refineYield_ = 1.0f;  // Smoothed fraction of bytes saved by refinement
+    int framesSinceRefine_ = 0;
+
+    bool usesTileHashes() const { return changeDetection_ == ChangeDetection::TileHash; }
+    bool keepsPreviousFrame() const { return !usesTileHashes() || verifyOnCollision_; }
+    bool usesHierarchy() const { return hierarchical_ && changeDetection_ == ChangeDetection::PixelCompare; }
+
+    void updateReference(const Image& currentFrame) {
+        if (!keepsPreviousFrame()) return;
+        if (!hintActive_) {
+            prevFrame_ = currentFrame;
+            return;
+        }
+        // Only hinted tiles can differ from the reference
+        for (int ty = 0; ty < TILES_Y; ++ty) {
+            int startY = ty * TILE_HEIGHT;
+            int endY = min(startY + TILE_HEIGHT, DISPLAY_HEIGHT);
+            for (int tx = 0; tx < TILES_X; ++tx) {
+                if (!hintTiles_[ty * TILES_X + tx]) continue;
+                int run = 1;
+                while (tx + run < TILES_X && hintTiles_[ty * TILES_X + tx + run]) run++;
+                int startX = tx * TILE_WIDTH;
+                int width = min(run * TILE_WIDTH, DISPLAY_WIDTH - startX);
+                for (int y = startY; y < endY; ++y) {
+                    size_t offset = (size_t)y * currentFrame.width + startX;
+                    std::memcpy(prevFrame_.pixels.data() + offset, currentFrame.pixels.data() + offset,
+                                width * sizeof(Pixel));
+                }
+                tx += run - 1;
+            }
+        }
+    }
+
+    // Build the tile mask for a damage hint. Returns false if it is empty.
+    bool markHintTiles(const std::vector<DirtyRect>& damage) {
+        std::fill(hintTiles_.begin(), hintTiles_.end(), false);
+        bool any = false;
+        for (const auto& r : damage) {
+            int x1 = min((int)r.x + r.w, DISPLAY_WIDTH);
+            int y1 = min((int)r.y + r.h, DISPLAY_HEIGHT);
+            if (r.x >= x1 || r.y >= y1) continue;
+            for (int ty = r.y / TILE_HEIGHT; ty <= (y1 - 1) / TILE_HEIGHT; ++ty) {
+                for (int tx = r.x / TILE_WIDTH; tx <= (x1 - 1) / TILE_WIDTH; ++tx) {
+                    hintTiles_[ty * TILES_X + tx] = true;
+                }
+            }
+            any = true;
+        }
+        hintActive_ = true;
+        return any;
+    }
+
+    bool isTileHinted(int tx, int ty) const {
+        return !hintActive_ || hintTiles_[ty * TILES_X + tx];
+    }
+
+    uint64_t hashTileAt(const Image& current, int tx, int ty) const {
+        int startX = tx * TILE_WIDTH;
+        int startY = ty * TILE_HEIGHT;
+        int endX = min(startX + TILE_WIDTH, DISPLAY_WIDTH);
+        int endY = min(startY + TILE_HEIGHT, DISPLAY_HEIGHT);
+        return simd::hashTile(current.pixels.data() + (size_t)startY * current.width + startX,
+                              current.width, endX - startX, endY - startY);
+    }
+
+    // Hash comparison; also refreshes the stored hash for the tile
+    bool isTileHashDirty(const Image& current, int tx, int ty) {
+        uint64_t& stored = tileHashes_[ty * TILES_X + tx];
+        uint64_t hash = hashTileAt(current, tx, ty);
+        if (hash != stored) {
+            stored = hash;
+            return true;
+        }
+        // Equal hashes - only a full compare can rule out a collision
+        return verifyOnCollision_ && isTileDirty(current, tx, ty);
+    }
     
     bool isTileDirty(const Image& current, int tx, int ty) const {
         int startX = tx * TILE_WIDTH;
@@ -192,41 +920,233 @@ private:
         int endX = min(startX + TILE_WIDTH, DISPLAY_WIDTH);
         int endY = min(startY + TILE_HEIGHT, DISPLAY_HEIGHT);
         
-        for (int y = startY; y < endY; ++y) {
-            for (int x = startX; x < endX; ++x) {
-                if (current.at(x, y) != prevFrame_.at(x, y)) {
-                    return true;
+        size_t offset = (size_t)startY * current.width + startX;
+        return tileDiff_(current.pixels.data() + offset, prevFrame_.pixels.data() + offset,
+                         current.width, endX - startX, endY - startY);
+    }
+    
+    bool isBlockDirty(const Image& current, int x, int y, int w, int h) const {
+        size_t offset = (size_t)y * current.width + x;
+        return tileDiff_(current.pixels.data() + offset, prevFrame_.pixels.data() + offset,
+                         current.width, w, h);
+    }
+
+    // Runs scanBand for each band of rowsPerBand grid rows, on the worker
+    // pool if one is set. Bands only write their own bitmap, which are then
+    // copied into grid. Returns dirty pixel count.
+    template <typename ScanBand>
+    int scanBands(std::vector<bool>& grid, int cols, int rowsPerBand, ScanBand&& scanBand) {
+        bands_.resize(BLOCKS_Y);
+        auto runBand = [&](int band) {
+            BandScan& scan = bands_[band];
+            scan.dirty.assign(cols * rowsPerBand, false);
+            scan.dirtyPixels = 0;
+            scan.rowBegin = rowsPerBand;
+            scan.rowEnd = 0;
+            scanBand(band, scan);
+        };
+        if (pool_) {
+            pool_->parallelFor(BLOCKS_Y, runBand);
+        } else {
+            for (int band = 0; band < BLOCKS_Y; ++band) runBand(band);
+        }
+
+        std::fill(grid.begin(), grid.end(), false);
+        const int rows = (int)grid.size() / cols;
+        dirtyRowBegin_ = rows;
+        dirtyRowEnd_ = 0;
+        int dirtyPixels = 0;
+        for (int band = 0; band < BLOCKS_Y; ++band) {
+            const BandScan& scan = bands_[band];
+            const int offset = band * rowsPerBand;
+            for (int r = scan.rowBegin; r < scan.rowEnd; ++r) {
+                for (int c = 0; c < cols; ++c) {
+                    if (scan.dirty[r * cols + c]) grid[(offset + r) * cols + c] = true;
                 }
             }
+            if (scan.rowBegin < scan.rowEnd) {
+                dirtyRowBegin_ = min(dirtyRowBegin_, offset + scan.rowBegin);
+                dirtyRowEnd_ = max(dirtyRowEnd_, offset + scan.rowEnd);
+            }
+            dirtyPixels += scan.dirtyPixels;
         }
-        return false;
+        return dirtyPixels;
     }
-    
-    // Simple greedy algorithm to merge adjacent dirty tiles into rectangles
-    std::vector<DirtyRect> mergeDirtyTiles() {
+
+    // Flat detection over the fixed tile grid, one band of tile rows
+    void markTileBand(const Image& current, int band, BandScan& scan) {
+        const int rowsPerBand = BLOCK_SIZE / TILE_HEIGHT;
+        const int firstRow = band * rowsPerBand;
+        const int endRow = min(firstRow + rowsPerBand, TILES_Y);
+        for (int ty = firstRow; ty < endRow; ++ty) {
+            for (int tx = 0; tx < TILES_X; ++tx) {
+                if (!isTileHinted(tx, ty)) continue;
+                bool dirty = usesTileHashes() ? isTileHashDirty(current, tx, ty)
+                                              : isTileDirty(current, tx, ty);
+                if (dirty) {
+                    int r = ty - firstRow;
+                    scan.dirty[r * TILES_X + tx] = true;
+                    scan.rowBegin = min(scan.rowBegin, r);
+                    scan.rowEnd = max(scan.rowEnd, r + 1);
+                    scan.dirtyPixels += min(TILE_WIDTH, DISPLAY_WIDTH - tx * TILE_WIDTH) *
+                                        min(TILE_HEIGHT, DISPLAY_HEIGHT - ty * TILE_HEIGHT);
+                }
+            }
+        }
+    }
+
+    // Hierarchical detection for one row of blocks: a clean 64x64 block costs
+    // one early-exit compare; dirty blocks are split into tiles, and dirty
+    // tiles into leaves sized by the block's recent activity.
+    void markCellBand(const Image& current, int by, BandScan& scan) {
+        const int blockY = by * BLOCK_SIZE;
+        const int blockH = min(BLOCK_SIZE, DISPLAY_HEIGHT - blockY);
+
+        for (int bx = 0; bx < BLOCKS_X; ++bx) {
+            float& activity = blockActivity_[by * BLOCKS_X + bx];
+            int blockX = bx * BLOCK_SIZE;
+            int blockW = min(BLOCK_SIZE, DISPLAY_WIDTH - blockX);
+
+            // With a hint, go straight to the hinted tiles
+            bool hinted = false;
+            for (int ty = blockY / TILE_HEIGHT; ty < (blockY + blockH) / TILE_HEIGHT; ++ty) {
+                for (int tx = blockX / TILE_WIDTH; tx < (blockX + blockW) / TILE_WIDTH; ++tx) {
+                    hinted = hinted || isTileHinted(tx, ty);
+                }
+            }
+            if (!hinted || (!hintActive_ && !isBlockDirty(current, blockX, blockY, blockW, blockH))) {
+                activity *= 0.9f;
+                continue;
+            }
+
+            int leaf = activity > LEAF_ACTIVITY_COARSE ? TILE_WIDTH
+                     : activity > LEAF_ACTIVITY_MEDIUM ? TILE_WIDTH / 2
+                     : LEAF_SIZE_MIN;
+
+            int tiles = 0;
+            int dirtyTiles = 0;
+            for (int ty = blockY; ty < blockY + blockH; ty += TILE_HEIGHT) {
+                for (int tx = blockX; tx < blockX + blockW; tx += TILE_WIDTH) {
+                    int tileW = min(TILE_WIDTH, blockX + blockW - tx);
+                    int tileH = min(TILE_HEIGHT, blockY + blockH - ty);
+                    tiles++;
+                    if (!isTileHinted(tx / TILE_WIDTH, ty / TILE_HEIGHT) ||
+                        !isBlockDirty(current, tx, ty, tileW, tileH)) continue;
+                    dirtyTiles++;
+
+                    for (int ly = ty; ly < ty + tileH; ly += leaf) {
+                        for (int lx = tx; lx < tx + tileW; lx += leaf) {
+                            int leafW = min(leaf, tx + tileW - lx);
+                            int leafH = min(leaf, ty + tileH - ly);
+                            if (leaf == TILE_WIDTH || isBlockDirty(current, lx, ly, leafW, leafH)) {
+                                markCells(scan, lx, ly - blockY, leafW, leafH);
+                                scan.dirtyPixels += leafW * leafH;
+                            }
+                        }
+                    }
+                }
+            }
+            activity = activity * 0.9f + 0.1f * (float)dirtyTiles / tiles;
+        }
+    }
+
+    // Mark a leaf in a band's cell bitmap (y relative to the band)
+    void markCells(BandScan& scan, int x, int y, int w, int h) const {
+        const int rowBegin = y / LEAF_SIZE_MIN;
+        const int rowEnd = (y + h) / LEAF_SIZE_MIN;
+        for (int cy = rowBegin; cy < rowEnd; ++cy) {
+            for (int cx = x / LEAF_SIZE_MIN; cx < (x + w) / LEAF_SIZE_MIN; ++cx) {
+                scan.dirty[cy * CELLS_X + cx] = true;
+            }
+        }
+        scan.rowBegin = min(scan.rowBegin, rowBegin);
+        scan.rowEnd = max(scan.rowEnd, rowEnd);
+    }
+
+    // Shrink a rect to the bounding box of changed pixels using per-row
+    // first/last difference scans. Returns false if nothing in it changed.
+    bool refineRect(const Image& current, DirtyRect& rect) const {
+        const int stride = current.width;
+        auto curRow = [&](int y) { return current.pixels.data() + (size_t)y * stride + rect.x; };
+        auto prevRow = [&](int y) { return prevFrame_.pixels.data() + (size_t)y * stride + rect.x; };
+
+        int top = rect.y;
+        int bottom = rect.y + rect.h - 1;
+        while (top <= bottom && !tileDiff_(curRow(top), prevRow(top), stride, rect.w, 1)) top++;
+        if (top > bottom) return false;
+        while (!tileDiff_(curRow(bottom), prevRow(bottom), stride, rect.w, 1)) bottom--;
+
+        // Columns only need searching outside the span found so far
+        int left = rect.w;
+        int right = -1;
+        for (int y = top; y <= bottom && (left > 0 || right < rect.w - 1); ++y) {
+            const Pixel* c = curRow(y);
+            const Pixel* p = prevRow(y);
+            int first = simd::firstDiff(c, p, left);
+            if (first < left) left = first;
+            int last = simd::lastDiff(c + right + 1, p + right + 1, rect.w - right - 1);
+            if (last >= 0) right = right + 1 + last;
+        }
+
+        rect.x = (uint16_t)(rect.x + left);
+        rect.y = (uint16_t)top;
+        rect.w = (uint16_t)(right - left + 1);
+        rect.h = (uint16_t)(bottom - top + 1);
+        return true;
+    }
+
+    // Tighten all rects when it has recently paid off (needs the previous frame)
+    void refineRects(const Image& current, std::vector<DirtyRect>& rects) {
+        if (!keepsPreviousFrame() || rects.empty()) return;
+
+        framesSinceRefine_++;
+        if (refineYield_ < REFINE_SCAN_COST && framesSinceRefine_ < REFINE_PROBE_INTERVAL) return;
+        framesSinceRefine_ = 0;
+
+        int before = 0;
+        int after = 0;
+        for (auto& rect : rects) {
+            before += rect.pixelCount();
+            if (!refineRect(current, rect)) {
+                rect.w = 0;
+            }
+            after += rect.pixelCount();
+        }
+        rects.erase(std::remove_if(rects.begin(), rects.end(), [](const DirtyRect& r) { return r.w == 0; }),
+                    rects.end());
+
+        // Track the fraction of bytes refinement removes
+        float yield = before > 0 ? (float)(before - after) / before : 0.0f;
+        refineYield_ = refineYield_ * 0.75f + yield * 0.25f;
+    }
+
+    // Simple greedy algorithm to merge adjacent dirty cells of a square grid
+    // (tiles or leaves) into rectangles. Only rows [rowBegin, rowEnd) are scanned.
+    std::vector<DirtyRect> mergeDirtyCells(const std::vector<bool>& dirty, int cols, int rowBegin, int rowEnd,
+                                           int cellSize) {
         std::vector<DirtyRect> rects;
-        std::vector<bool> processed(dirtyTiles_.size(), false);
+        std::vector<bool> processed(dirty.size(), false);
         
-        for (int ty = 0; ty < TILES_Y; ++ty) {
-            for (int tx = 0; tx < TILES_X; ++tx) {
-                int idx = ty * TILES_X + tx;
-                if (!dirtyTiles_[idx] || processed[idx]) continue;
+        for (int cy = rowBegin; cy < rowEnd; ++cy) {
+            for (int cx = 0; cx < cols; ++cx) {
+                int idx = cy * cols + cx;
+                if (!dirty[idx] || processed[idx]) continue;
                 
-                // Find maximum width of consecutive dirty tiles in this row
+                // Find maximum width of consecutive dirty cells in this row
                 int width = 1;
-                while (tx + width < TILES_X && 
-                       dirtyTiles_[ty * TILES_X + tx + width] &&
-                       !processed[ty * TILES_X + tx + width]) {
+                while (cx + width < cols && 
+                       dirty[cy * cols + cx + width] &&
+                       !processed[cy * cols + cx + width]) {
                     width++;
                 }
                 
-                // Extend height while all tiles in the strip are dirty
+                // Extend height while all cells in the strip are dirty
                 int height = 1;
-                while (ty + height < TILES_Y) {
+                while (cy + height < rowEnd) {
                     bool rowOk = true;
                     for (int i = 0; i < width; ++i) {
-                        int checkIdx = (ty + height) * TILES_X + tx + i;
-                        if (!dirtyTiles_[checkIdx] || processed[checkIdx]) {
+                        int checkIdx = (cy + height) * cols + cx + i;
+                        if (!dirty[checkIdx] || processed[checkIdx]) {
                             rowOk = false;
                             break;
                         }
@@ -235,19 +1155,19 @@ private:
                     height++;
                 }
                 
-                // Mark tiles as processed
+                // Mark cells as processed
                 for (int dy = 0; dy < height; ++dy) {
                     for (int dx = 0; dx < width; ++dx) {
-                        processed[(ty + dy) * TILES_X + tx + dx] = true;
+                        processed[(cy + dy) * cols + cx + dx] = true;
                     }
                 }
                 
                 // Create rect in pixel coordinates
                 DirtyRect rect;
-                rect.x = tx * TILE_WIDTH;
-                rect.y = ty * TILE_HEIGHT;
-                rect.w = min(width * TILE_WIDTH, DISPLAY_WIDTH - rect.x);
-                rect.h = min(height * TILE_HEIGHT, DISPLAY_HEIGHT - rect.y);
+                rect.x = cx * cellSize;
+                rect.y = cy * cellSize;
+                rect.w = min(width * cellSize, DISPLAY_WIDTH - rect.x);
+                rect.h = min(height * cellSize, DISPLAY_HEIGHT - rect.y);
                 rects.push_back(rect);
             }
         }
@@ -255,50 +1175,116 @@ private:
         return rects;
     }
     
-    // Consolidate too many rects by merging small ones
-    std::vector<DirtyRect> consolidateRects(std::vector<DirtyRect>& rects, int maxCount) {
-        // Sort by area (smallest first)
-        std::sort(rects.begin(), rects.end(), [](const DirtyRect& a, const DirtyRect& b) {
-            return a.pixelCount() < b.pixelCount();
-        });
-        
-        while (rects.size() > maxCount && rects.size() > 1) {
-            // Merge two smallest rects into bounding box
-            DirtyRect& a = rects[0];
-            DirtyRect& b = rects[1];
-            
-            uint16_t minX = min(a.x, b.x);
-            uint16_t minY = min(a.y, b.y);
-            uint16_t maxX = max(a.x + a.w, b.x + b.w);
-            uint16_t maxY = max(a.y + a.h, b.y + b.h);
-            
-            DirtyRect merged = {minX, minY, (uint16_t)(maxX - minX), (uint16_t)(maxY - minY)};
-            
-            rects.erase(rects.begin(), rects.begin() + 2);
-            rects.push_back(merged);
-            
-            // Re-sort
-            std::sort(rects.begin(), rects.end(), [](const DirtyRect& a, const DirtyRect& b) {
-                return a.pixelCount() < b.pixelCount();
-            });
-        }
-        
-        return rects;
+    // Gap between two rects' bounding boxes, 0 when they touch or overlap
+    static int rectGap(const DirtyRect& a, const DirtyRect& b) {
+        int dx = max(0, max(a.x - (b.x + b.w), b.x - (a.x + a.w)));
+        int dy = max(0, max(a.y - (b.y + b.h), b.y - (a.y + a.h)));
+        return dx + dy;
     }
-    
-    void appendU16(std::vector<uint8_t>& packet, uint16_t val) {
-        packet.push_back(val & 0xFF);
-        packet.push_back((val >> 8) & 0xFF);
+
+    // Merge rects into one bounding box per grid cell (by top-left corner),
+    // doubling the cell from a tile until at most maxCount are left
+    static void preMergeRects(std::vector<DirtyRect>& rects, size_t maxCount) {
+        for (int cell = TILE_WIDTH; rects.size() > maxCount; cell *= 2) {
+            const int cols = (DISPLAY_WIDTH + cell - 1) / cell;
+            const int rows = (DISPLAY_HEIGHT + cell - 1) / cell;
+            std::vector<int> slot(cols * rows, -1);
+            size_t out = 0;
+            for (size_t i = 0; i < rects.size(); ++i) {
+                int& s = slot[(rects[i].y / cell) * cols + rects[i].x / cell];
+                if (s < 0) {
+                    s = (int)out;
+                    rects[out++] = rects[i];
+                } else {
+                    rects[s] = boundingRect(rects[s], rects[i]);
+                }
+            }
+            rects.resize(out);
+        }
     }
-    
-    void appendRectPixels(std::vector<uint8_t>& packet, const Image& frame, const DirtyRect& rect) {
-        for (int y = rect.y; y < rect.y + rect.h; ++y) {
-            for (int x = rect.x; x < rect.x + rect.w; ++x) {
-                Pixel p = frame.at(x, y);
-                packet.push_back(p & 0xFF);
-                packet.push_back((p >> 8) & 0xFF);
+
+    // Rect planning: repeatedly merge the pair whose bounding box adds the
+    // least cost (or saves the most), using a priority queue of candidate
+    // pairs with lazy invalidation. Candidates are each rect's
+    // PLAN_NEIGHBOURS nearest rects by gap. Merging stops once no pair
+    // lowers the total cost and the count fits in maxCount. Returns the
+    // planned cost.
+    float planRects(std::vector<DirtyRect>& rects, int maxCount) {
+        if ((int)rects.size() > PLAN_RECTS_MAX) {
+            preMergeRects(rects, PLAN_RECTS_MAX);
+        }
+
+        struct Candidate {
+            float delta;       // cost(bbox) - cost(a) - cost(b)
+            int a, b;
+            int versionA, versionB;
+            bool operator>(const Candidate& o) const { return delta > o.delta; }
+        };
+
+        const int n = (int)rects.size();
+        std::vector<int> version(n, 0);
+        std::vector<bool> alive(n, true);
+        std::vector<float> cost(n);
+        float total = 0.0f;
+        for (int i = 0; i < n; ++i) {
+            cost[i] = costModel_.rectCost(rects[i]);
+            total += cost[i];
+        }
+
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> queue;
+        auto pushPair = [&](int a, int b) {
+            float delta = costModel_.rectCost(boundingRect(rects[a], rects[b])) - cost[a] - cost[b];
+            queue.push({delta, a, b, version[a], version[b]});
+        };
+        std::vector<std::pair<int, int>> nearest;  // (gap, rect)
+        auto pushNeighbours = [&](int a) {
+            nearest.clear();
+            for (int k = 0; k < n; ++k) {
+                if (k != a && alive[k]) nearest.push_back({rectGap(rects[a], rects[k]), k});
+            }
+            size_t keep = min(nearest.size(), (size_t)PLAN_NEIGHBOURS);
+            std::nth_element(nearest.begin(), nearest.begin() + keep, nearest.end());
+            for (size_t i = 0; i < keep; ++i) {
+                pushPair(min(a, nearest[i].second), max(a, nearest[i].second));
+            }
+        };
+
+        // A rect whose neighbours all merged elsewhere has no pairs left, so
+        // when the queue runs dry after merging, pair everything up again
+        int count = n;
+        bool merged = true;
+        while (merged && queue.empty()) {
+            merged = false;
+            for (int i = 0; i < n; ++i) {
+                if (alive[i]) pushNeighbours(i);
+            }
+
+            while (!queue.empty()) {
+                Candidate c = queue.top();
+                if (c.delta >= 0.0f && count <= maxCount) break;
+                queue.pop();
+                if (!alive[c.a] || !alive[c.b] || version[c.a] != c.versionA || version[c.b] != c.versionB) {
+                    continue;  // Stale pair
+                }
+
+                rects[c.a] = boundingRect(rects[c.a], rects[c.b]);
+                alive[c.b] = false;
+                version[c.a]++;
+                total += c.delta;
+                cost[c.a] = costModel_.rectCost(rects[c.a]);
+                count--;
+                merged = true;
+
+                pushNeighbours(c.a);
             }
         }
+
+        size_t out = 0;
+        for (int i = 0; i < n; ++i) {
+            if (alive[i]) rects[out++] = rects[i];
+        }
+        rects.resize(out);
+        return total;
     }
 };
 
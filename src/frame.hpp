@@ -1,10 +1,16 @@
 #include "tcp.hpp"
 #include "skins/flash_exporter.hpp"
 #include "image.hpp"
+#include "damage.hpp"
+#include "device_caps.hpp"
+#include "rate_control.hpp"
+#include "telemetry.hpp"
 #include <mutex>
 #include <atomic>
-#include <condition_variable>
-#include <deque>
+#include <cmath>
+#include <filesystem>
+#include "utils/spsc_ring.h"
+#include "utils/triple_buffer.h"
 
 // Protocol message types
 namespace protocol {
@@ -14,6 +20,10 @@ namespace protocol {
     constexpr uint8_t MSG_FLASH_DATA = 0x03;
     constexpr uint8_t MSG_RESET = 0x04;
     constexpr uint8_t MSG_SET_MODE = 0x05;
+    constexpr uint8_t MSG_DIRTY_RECTS_RLE = 0x06;  // Dirty rects with a per-rect codec (raw or RLE)
+    constexpr uint8_t MSG_TILE_OPS = 0x07;         // Tile cache refs, fills, copies and stores + RLE dirty rects
+    constexpr uint8_t MSG_HELLO = 0x08;            // Host version and what it will use, after the board's caps
+    constexpr uint8_t MSG_CAPS = 0x09;             // Board to host, on connect (see device_caps.hpp)
     
     // Mode constants
     constexpr uint8_t MODE_FULL_STREAMING = 0x00;
@@ -21,13 +31,28 @@ namespace protocol {
 }
 
 constexpr int TIMEOUT_ACK = 20000; // ms
+constexpr int TIMEOUT_CAPS = 1500;  // ms; boards that stay silent this long are legacy
+constexpr int MAX_WINDOW = 8;       // Frames in flight
+constexpr int ACK_POLL_MS = 100;    // ACK wait slice, so stop() isn't held up
 
-// Threaded frame sender with frame lock support
+// Threaded frame sender with frame lock support. Frames go through three
+// stages, each on its own thread and connected by lock-free rings of
+// packet slots: encode (dirty detection and packet building), transmit,
+// and ACK handling. Frame N+1 is encoded while frame N is on the wire.
 class FrameSender {
 public:
     FrameSender(int fpsWindow = 10) 
-        : running_(false), frameReady_(false), sendError_(false), fpsWindow_(fpsWindow),
-          frameConsumed_(false) {}
+        : running_(false), sendError_(false), fpsWindow_(fpsWindow),
+          frameConsumed_(false) {
+        dirtyTracker_.setWorkerPool(&scanPool_);
+        // Frames rotate between these and the slots, so all are display sized
+        for (PendingFrame& p : frames_.buffers()) {
+            p.frame.resize(qualia::DISPLAY_WIDTH, qualia::DISPLAY_HEIGHT);
+        }
+        for (Slot& s : slots_) {
+            s.frame.resize(qualia::DISPLAY_WIDTH, qualia::DISPLAY_HEIGHT);
+        }
+    }
     
     ~FrameSender() {
         stop();
@@ -35,62 +60,77 @@ public:
     
     void start(TcpConnection* conn) {
         connection_ = conn;
+        freeSlots_.clear();
+        txQueue_.clear();
+        ackQueue_.clear();
+        calibrations_.clear();
+        for (int i = 0; i < SLOT_COUNT; ++i) freeSlots_.push(i);
         running_ = true;
         sendError_ = false;
         frameConsumed_ = false;
         pendingModeSelection_ = false;
+        pendingReset_ = false;
         modeSyncFinished_ = false;
         modeSyncResult_ = false;
         dirtyTracker_.invalidate();  // Reset tracker on new connection
+        rate_.reset();
         sendThread_ = std::thread(&FrameSender::sendLoop, this);
     }
     
     void stop() {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            running_ = false;
-        }
-        cv_.notify_one();
+        running_ = false;
+        wakeStages();
+        // The encode thread starts the other two, so it goes first
         if (sendThread_.joinable()) {
             sendThread_.join();
         }
+        if (txThread_.joinable()) {
+            txThread_.join();
+        }
+        if (ackThread_.joinable()) {
+            ackThread_.join();
+        }
+        if (!calibrationFile_.empty() && dirtyTracker_.getCodecCosts().sampleCount() > 0) {
+            dirtyTracker_.getCodecCosts().save(calibrationFile_);
+        }
     }
     
-    // Queue a frame for sending (called from main thread)
-    void queueFrame(const qualia::Image& frame) {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            pendingFrame_ = frame;
-            frameReady_ = true;
-            flashMode_ = false;
-        }
-        cv_.notify_one();
+    // Buffer to render the next frame into (main thread). Owned by the
+    // sender; it changes after every queueFrame()/queueFlashUpdate().
+    qualia::Image& frameBuffer() { return frames_.back().frame; }
+
+    // Pool the tracker scans on; other per-frame work can share it, as its
+    // calls run alongside the scans instead of waiting for them
+    WorkerPool& workerPool() { return scanPool_; }
+
+    // Queue frameBuffer() for sending (called from main thread). Never
+    // blocks: a frame the sender hasn't picked up yet is replaced.
+    // snapshot: what the skin drew for this frame, in panel coordinates; lets
+    // the tracker compare only regions that differ from the last sent frame
+    void queueFrame(qualia::DamageSnapshot snapshot = {}) {
+        PendingFrame& p = frames_.back();
+        p.snapshot = std::move(snapshot);
+        p.flashMode = false;
+        publishFrame();
     }
     
-    // Queue a flash mode update (stats + optional dirty rects)
-    void queueFlashUpdate(const flash::FlashStatsMessage& stats, 
-                          const qualia::Image& frame) {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            pendingFlashStats_ = stats;
-            pendingFrame_ = frame;
-            frameReady_ = true;
-            flashMode_ = true;
-        }
-        cv_.notify_one();
+    // Queue frameBuffer() as a flash mode update (stats + optional dirty rects)
+    void queueFlashUpdate(const flash::FlashStatsMessage& stats) {
+        PendingFrame& p = frames_.back();
+        p.flashStats = stats;
+        p.snapshot = {};
+        p.flashMode = true;
+        publishFrame();
     }
     
     // Queue a mode selection (called from main thread)
     // Check modeSyncFinished() and getModeSyncResult() for completion
     void queueModeSelection(bool flashMode) {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            pendingModeSelection_ = true;
-            pendingModeValue_ = flashMode;
-            modeSyncFinished_ = false;
-            modeSyncResult_ = false;
-        }
-        cv_.notify_one();
+        pendingModeValue_ = flashMode;
+        modeSyncFinished_ = false;
+        modeSyncResult_ = false;
+        pendingModeSelection_ = true;
+        wakeEncoder();
     }
     
     bool modeSyncFinished() const { return modeSyncFinished_; }
@@ -98,64 +138,108 @@ public:
     
     // Check if sender is ready for next frame (for frame lock mode)
     bool isReadyForFrame() const {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return !frameReady_;
+        return !frames_.fresh();
     }
     
     // Check and clear the frame consumed flag (for frame lock mode)
     bool checkAndClearFrameConsumed() {
-        std::lock_guard<std::mutex> lock(consumedMutex_);
-        bool consumed = frameConsumed_;
-        frameConsumed_ = false;
-        return consumed;
+        return frameConsumed_.exchange(false);
     }
 
+    // Queue a board reset (called from main thread). It goes out through the
+    // transmit stage, between packets, as the socket is that stage's to send on.
     bool sendReset() {
-        if (!connection_) return false;
-        uint8_t cmd = protocol::MSG_RESET;
-        return connection_->sendPacket(&cmd, 1);
+        if (!connection_ || !active()) return false;
+        pendingReset_ = true;
+        wakeEncoder();
+        return true;
     }
 
     void invalidateDirtyTracker() {
         dirtyTracker_.invalidate();
     }
-    
-    // Get current FPS (thread-safe)
-    double getFPS() const {
-        std::lock_guard<std::mutex> lock(fpsMutex_);
-        
-        while (!frameTimestamps_.empty()) {
-            if (frameTimestamps_.size() > fpsWindow_) {
-                frameTimestamps_.pop_front();
-            } else {
-                break;
-            }
-        }
 
-        if (frameTimestamps_.empty()) {
-            return 0.0;
-        }
+    // Encoder features below are requests: on connect they are narrowed to
+    // what the board's caps say it decodes.
 
-        auto latest = frameTimestamps_.back();
-        double timeSpan = std::chrono::duration<double>(latest - frameTimestamps_.front()).count();
-        return timeSpan > 0.0 ? frameTimestamps_.size() / timeSpan : 0.0;
+    // Enable RLE coded dirty rects (call while the sender is stopped)
+    void setRleEnabled(bool enabled) {
+        requested_.rle = enabled;
+        dirtyTracker_.setRleEnabled(enabled);
     }
-    
-    // Get compression stats
-    float getCompressionRatio() const {
-        std::lock_guard<std::mutex> lock(statsMutex_);
-        return lastCompressionRatio_;
+
+    // Enable XOR delta rects against the last sent frame (call while the sender is stopped)
+    void setTemporalDelta(bool enabled) {
+        requested_.temporalDelta = enabled;
+        dirtyTracker_.setTemporalDelta(enabled);
     }
-    
-    int getLastRectCount() const {
+
+    // Enable the device tile cache (call while the sender is stopped)
+    void setTileCache(bool enabled) {
+        requested_.tileCache = enabled;
+        dirtyTracker_.setTileCache(enabled);
+    }
+
+    // Send solid and repeated tiles as fills and copies (call while the sender is stopped)
+    void setTileDedup(bool enabled) {
+        requested_.tileDedup = enabled;
+        dirtyTracker_.setTileDedup(enabled);
+    }
+
+    // Search for moved content in dirty rects (call while the sender is stopped)
+    void setMotionSearch(bool enabled) {
+        requested_.motionSearch = enabled;
+        dirtyTracker_.setMotionSearch(enabled);
+    }
+
+    // Frames sent ahead of their ACKs; 0 picks it from the measured latency
+    // and ACK rate. Capped by the board's credits, and 1 (stop-and-wait)
+    // for boards without windowed ACKs. (call while the sender is stopped)
+    void setWindow(int frames) {
+        window_ = std::clamp(frames, 0, MAX_WINDOW);
+    }
+
+    // Caps of the connected board (valid once the handshake is done)
+    qualia::DeviceCaps getDeviceCaps() const {
         std::lock_guard<std::mutex> lock(statsMutex_);
-        return lastRectCount_;
+        return deviceCaps_;
+    }
+
+    // Load the codec cost calibration of this board, and save it there on
+    // stop() (call while the sender is stopped)
+    void setCalibrationFile(const std::filesystem::path& path) {
+        calibrationFile_ = path;
+        qualia::CodecCostModel& costs = dirtyTracker_.getCodecCosts();
+        if (costs.load(path)) {
+            LOG_INFO << "Loaded codec calibration (" << costs.sampleCount() << " samples) from " << path << "\n";
+        } else {
+            costs.reset();
+        }
+    }
+
+    // Configure how dirty tiles are detected (call while the sender is stopped)
+    void setChangeDetection(qualia::ChangeDetection mode, bool verifyOnCollision = false) {
+        dirtyTracker_.setChangeDetection(mode, verifyOnCollision);
     }
     
-    size_t getLastPacketSize() const {
-        std::lock_guard<std::mutex> lock(statsMutex_);
-        return lastPacketSize_;
+    // Get current FPS (thread-safe)
+    double getFPS() const {
+        return telemetry_.fps(fpsWindow_);
     }
+    
+    // Get compression stats
+    float getCompressionRatio() const { return lastCompressionRatio_; }
+    int getLastRectCount() const { return lastRectCount_; }
+    size_t getLastPacketSize() const { return lastPacketSize_; }
+
+    // Per-stage latency histograms. The sender records diff through ACK;
+    // the render loop records its own stages here too.
+    qualia::Telemetry& telemetry() { return telemetry_; }
+    const qualia::Telemetry& telemetry() const { return telemetry_; }
+
+    // Seconds between frames the link and board currently sustain
+    float getSendInterval() const { return rate_.interval(); }
+    qualia::RateController::Status getRateStatus() const { return rate_.status(); }
 
     // For debugging: get dirty rectangles from last frame
     std::vector<qualia::DirtyRect> getLastDirtyRects() const {
@@ -167,29 +251,52 @@ public:
     void clearError() { sendError_ = false; }
     
 private:
+    // Encode stage. Runs the handshake, then starts the other stages.
     void sendLoop() {
+        if (!handshake()) {
+            fail();
+            return;
+        }
+        txThread_ = std::thread(&FrameSender::transmitLoop, this);
+        ackThread_ = std::thread(&FrameSender::ackLoop, this);
+
         while (true) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            cv_.wait(lock, [this] { return frameReady_ || pendingModeSelection_ || !running_; });
-            
-            if (!running_) break;
+            const uint32_t seen = encoderWake_.load();
+            if (!active()) break;
             
+            // Before mode changes and frames: the board restarts on reset
+            if (pendingReset_.exchange(false)) {
+                int slot = acquireSlot(windowLimit());
+                if (slot < 0) break;
+                Slot& s = slots_[slot];
+                s.kind = SlotKind::Reset;
+                s.packet.clear();
+                s.packet.appendU8(protocol::MSG_RESET);
+                s.sample = {};
+                s.encodedAt = std::chrono::steady_clock::now();
+                txQueue_.push(slot);
+                continue;
+            }
+
             // Handle mode selection first (blocks frames until complete)
-            if (pendingModeSelection_) {
+            if (pendingModeSelection_.exchange(false)) {
                 bool targetMode = pendingModeValue_;
-                pendingModeSelection_ = false;
-                lock.unlock();
                 
                 LOG_INFO << "Syncing mode to device: " << (targetMode ? "flash" : "streaming") << "\n";
                 
-                uint8_t packet[2] = {
-                    protocol::MSG_SET_MODE,
-                    targetMode ? protocol::MODE_FLASH : protocol::MODE_FULL_STREAMING
-                };
-                
+                // Frames in flight were drawn for the old mode, let them land first
+                int slot = acquireSlot(0);
                 bool success = false;
-                if (connection_->sendPacket(packet, 2)) {
-                    success = connection_->waitForAck(TIMEOUT_ACK);
+                if (slot >= 0) {
+                    Slot& s = slots_[slot];
+                    s.kind = SlotKind::ModeChange;
+                    s.packet.clear();
+                    s.packet.appendU8(protocol::MSG_SET_MODE);
+                    s.packet.appendU8(targetMode ? protocol::MODE_FLASH : protocol::MODE_FULL_STREAMING);
+                    s.sample = {};
+                    s.encodedAt = std::chrono::steady_clock::now();
+                    txQueue_.push(slot);
+                    success = waitDrained();
                 }
                 
                 if (success) {
@@ -205,172 +312,459 @@ private:
                 continue;  // Re-check conditions
             }
             
-            if (frameReady_) {
-                // Copy data while holding lock
-                qualia::Image frameToSend = std::move(pendingFrame_);
-                bool isFlashMode = flashMode_;
-                flash::FlashStatsMessage flashStats = pendingFlashStats_;
-                // Don't set frameReady_ = false yet - wait for ACK first
-                lock.unlock();
-                
-                bool sendSuccess = false;
-                
-                if (isFlashMode) {
-                    // Flash mode: send stats + dirty rects
-                    sendSuccess = sendFlashUpdate(flashStats, frameToSend);
+            if (frames_.fresh()) {
+                // Wait for room: the window in flight, plus this one queued
+                int slot = acquireSlot(windowLimit());
+                if (slot < 0) break;
+                Slot& s = slots_[slot];
+
+                // Take the latest frame. Its pixels go to the slot, as the
+                // packet references them; the slot's old buffer goes back to
+                // the render loop in their place.
+                frames_.acquire();
+                PendingFrame& p = frames_.front();
+                std::swap(s.frame, p.frame);
+
+                applyCalibrations();
+                s.kind = SlotKind::Frame;
+                if (p.flashMode) {
+                    // Flash mode: stats + dirty rects
+                    encodeFlashUpdate(p.flashStats, s.frame, s.packet);
                 } else {
-                    // Normal mode: send dirty rects
-                    sendSuccess = sendNormalFrame(frameToSend);
+                    // Normal mode: dirty rects
+                    encodeNormalFrame(s.frame, p.snapshot, s.packet);
                 }
-                
-                if (sendSuccess) {
-                    // Wait for ACK from remote
-                    if (connection_->waitForAck(TIMEOUT_ACK)) {
-                        recordFrameSent();
-                        // Now mark frame as consumed - main thread can queue next
-                        {
-                            std::lock_guard<std::mutex> l(mutex_);
-                            frameReady_ = false;
-                        }
-                        {
-                            std::lock_guard<std::mutex> consumedLock(consumedMutex_);
-                            frameConsumed_ = true;
-                        }
-                    } else {
-                        // ACK timeout - connection problem
-                        sendError_ = true;
-                        {
-                            std::lock_guard<std::mutex> l(mutex_);
-                            frameReady_ = false;  // Clear so we don't retry
-                        }
-                    }
-                } else {
-                    sendError_ = true;
-                    {
-                        std::lock_guard<std::mutex> l(mutex_);
-                        frameReady_ = false;  // Clear so we don't retry
-                    }
+                // The packet references these until the slot comes back
+                dirtyTracker_.swapPayloads(s.payloads);
+                s.sample = dirtyTracker_.takeSample(s.packet.size());
+                s.encodedAt = std::chrono::steady_clock::now();
+                txQueue_.push(slot);
+
+                // Now mark frame as consumed (for frame lock)
+                frameConsumed_ = true;
+                continue;
+            }
+
+            encoderWake_.wait(seen);
+        }
+    }
+
+    // Transmit stage: sends encoded slots in order, with at most the window
+    // in flight
+    void transmitLoop() {
+        int slot;
+        while (true) {
+            txQueue_.wait([this] { return !txQueue_.empty() || !active(); });
+            ackQueue_.wait([this] { return (int)ackQueue_.size() < windowLimit() || !active(); });
+            if (!active() || !txQueue_.pop(slot)) return;
+
+            Slot& s = slots_[slot];
+            const auto start = std::chrono::steady_clock::now();
+            // Only frames sent into an empty pipe time the device alone
+            s.idlePipe = ackQueue_.empty();
+            s.sentAt = start;
+            rate_.onSend(s.rate, s.packet.size(), ackQueue_.size(), start);
+            telemetry_.record(qualia::Stage::Queue, s.encodedAt, start);
+            // Queued for its ACK first, as the ACK can beat sendGather's
+            // return. The slot is the ACK stage's from here: sendGather is
+            // done with the packet once its last byte is out, and nothing
+            // else reads it.
+            ackQueue_.push(slot);
+            if (!connection_->sendGather(s.packet)) {
+                fail();
+                return;
+            }
+            telemetry_.record(qualia::Stage::Send, start, std::chrono::steady_clock::now());
+        }
+    }
+
+    // ACK stage: matches ACKs to sent slots, in order, and frees the slots
+    void ackLoop() {
+        int slot;
+        while (true) {
+            ackQueue_.wait([this] { return !ackQueue_.empty() || !active(); });
+            if (!active()) return;
+            if (!receiveAck()) {
+                // ACK timeout or bad ACK - connection problem
+                fail();
+                return;
+            }
+
+            const auto now = std::chrono::steady_clock::now();
+            const Slot& s = slots_[ackQueue_.front()];
+            const float latencyUs = std::chrono::duration<float, std::micro>(now - s.sentAt).count();
+            if (s.kind == SlotKind::Frame) {
+                telemetry_.noteFrameDelivered(now);
+                if (s.idlePipe && s.sample.valid) {
+                    calibrations_.push({s.sample, latencyUs});  // Dropped if the encoder is behind
                 }
             }
+            telemetry_.record(qualia::Stage::Ack, s.sentAt, now);
+            tuneWindow(now, latencyUs, ackQueue_.size() > 1);
+            rate_.onAck(s.rate, ackQueue_.size() - 1, now);
+            ackQueue_.pop(slot);
+            freeSlots_.push(slot);
         }
     }
-    
-    bool sendNormalFrame(const qualia::Image& frame) {
-        // Find dirty rectangles
-        auto rects = dirtyTracker_.findDirtyRects(frame);
+
+    // Packet slots, owned by one stage at a time
+    enum class SlotKind : uint8_t { Frame, ModeChange, Reset };
+    struct Slot {
+        SlotKind kind = SlotKind::Frame;
+        qualia::Image frame;             // Pixel rows the packet references
+        std::vector<uint8_t> payloads;   // Coded rect payloads the packet references
+        qualia::GatherPacket packet;
+        qualia::CodecCostModel::Sample sample;  // Valid for normal frames
+        std::chrono::steady_clock::time_point encodedAt;
+        std::chrono::steady_clock::time_point sentAt;
+        bool idlePipe = false;           // Nothing else was in flight when it was sent
+        qualia::RateController::SendState rate;
+    };
+    static constexpr int SLOT_COUNT = MAX_WINDOW + 2;
+    static constexpr size_t RING_SIZE = 16;
+
+    struct Calibration {
+        qualia::CodecCostModel::Sample sample;
+        float latencyUs;
+    };
+
+    bool active() const { return running_ && !sendError_; }
+
+    void fail() {
+        sendError_ = true;
+        wakeStages();
+    }
+
+    void publishFrame() {
+        frames_.publish();
+        wakeEncoder();
+    }
+
+    void wakeEncoder() {
+        encoderWake_.fetch_add(1);
+        encoderWake_.notify_one();
+    }
+
+    void wakeStages() {
+        wakeEncoder();
+        freeSlots_.wake();
+        txQueue_.wake();
+        ackQueue_.wake();
+    }
+
+    // A free slot, once at most maxOutstanding slots are encoded and not
+    // yet ACKed; -1 when stopping
+    int acquireSlot(int maxOutstanding) {
+        freeSlots_.wait([&] { return SLOT_COUNT - (int)freeSlots_.size() <= maxOutstanding || !active(); });
+        int slot;
+        if (!active() || !freeSlots_.pop(slot)) return -1;
+        return slot;
+    }
+
+    // Wait until every slot is ACKed; false when stopping
+    bool waitDrained() {
+        freeSlots_.wait([this] { return (int)freeSlots_.size() == SLOT_COUNT || !active(); });
+        return active();
+    }
+
+    // Cost model updates from the ACK stage (the model is the encoder's)
+    void applyCalibrations() {
+        Calibration c;
+        while (calibrations_.pop(c)) {
+            dirtyTracker_.getCodecCosts().observe(c.sample, c.latencyUs);
+        }
+    }
+
+    int windowLimit() const {
+        int window = window_ > 0 ? window_ : autoWindow_.load();
+        return std::clamp(window, 1, max(1, (int)credits_.load()));
+    }
+
+    // Next ACK, waited for in short slices so stop() isn't held up by a
+    // silent board. An ACK split across slices is picked up where it left off.
+    bool receiveAck() {
+        const size_t size = windowedAcks_ ? 3 : 1;
+        uint8_t ack[3];
+        size_t received = 0;
+        int waited = 0;
+        while (received < size) {
+            int result = connection_->receiveSome(ack + received, size - received, ACK_POLL_MS);
+            if (result < 0 || !running_) return false;
+            if (result == 0 && (waited += ACK_POLL_MS) >= TIMEOUT_ACK) return false;
+            received += result;
+        }
+        if (windowedAcks_) {
+            if (ack[0] != qualia::ACK_WINDOWED || ack[1] != ackSeq_) {
+                LOG_ERROR << "Unexpected ACK " << (int)ack[0] << " seq " << (int)ack[1]
+                          << ", expected " << (int)ackSeq_ << "\n";
+                connection_->disconnect();
+                return false;
+            }
+            ackSeq_++;
+            credits_ = ack[2];
+        }
+        return true;
+    }
+
+    // Enough frames in flight to cover the unloaded latency at the rate the
+    // board ACKs them when busy (Little's law), so the link never idles
+    // waiting on an ACK, but no more, as extra frames only queue.
+    void tuneWindow(std::chrono::steady_clock::time_point now, float latencyUs, bool pipeBusy) {
+        // Lowest latency over a sliding epoch, so it can rise again
+        if (++latencySamples_ >= 64) {
+            latencySamples_ = 0;
+            minLatencyUs_ = epochMinLatencyUs_;
+            epochMinLatencyUs_ = latencyUs;
+        }
+        epochMinLatencyUs_ = min(epochMinLatencyUs_, latencyUs);
+        minLatencyUs_ = min(minLatencyUs_, latencyUs);
+
+        // ACK spacing while the next message was already queued behind this one
+        if (lastAckValid_) {
+            float intervalUs = std::chrono::duration<float, std::micro>(now - lastAck_).count();
+            ackIntervalUs_ = ackIntervalUs_ > 0 ? ackIntervalUs_ + 0.1f * (intervalUs - ackIntervalUs_) : intervalUs;
+        }
+        lastAck_ = now;
+        lastAckValid_ = pipeBusy;
+
+        if (ackIntervalUs_ > 0) {
+            autoWindow_ = std::clamp((int)std::ceil(minLatencyUs_ / ackIntervalUs_), 1, MAX_WINDOW);
+        }
+    }
+
+    // Read the board's caps (legacy boards send none), answer with HELLO,
+    // and narrow the encoder to what the board decodes
+    bool handshake() {
+        windowedAcks_ = false;
+        ackSeq_ = 0;
+        credits_ = 0;
+        autoWindow_ = 2;
+        minLatencyUs_ = epochMinLatencyUs_ = 1e9f;
+        latencySamples_ = 0;
+        ackIntervalUs_ = 0;
+        lastAckValid_ = false;
+
+        qualia::DeviceCaps caps = qualia::DeviceCaps::legacy();
+        uint8_t head[3];
+        if (connection_->receiveExact(head, 3, TIMEOUT_CAPS)) {
+            uint8_t fields[255];
+            if (head[0] != protocol::MSG_CAPS || !connection_->receiveExact(fields, head[2], TIMEOUT_ACK) ||
+                !caps.parse(head[1], fields, head[2])) {
+                LOG_ERROR << "Invalid caps message from device\n";
+                return false;
+            }
+            applyCaps(caps);
+            // [version][codec mask][u16 cache slots] the host will use, [window]
+            uint16_t slots = dirtyTracker_.isTileCacheEnabled() ? caps.tileCacheSlots : 0;
+            const bool windowed = caps.version >= 2 && caps.credits > 0;
+            uint8_t hello[6] = {
+                protocol::MSG_HELLO,
+                qualia::PROTOCOL_VERSION,
+                dirtyTracker_.getCodecMask(),
+                (uint8_t)(slots & 0xFF),
+                (uint8_t)(slots >> 8),
+                (uint8_t)(windowed ? MAX_WINDOW : 0)
+            };
+            size_t helloSize = caps.version >= 2 ? 6 : 5;
+            if (!connection_->sendPacket(hello, helloSize) || !connection_->waitForAck(TIMEOUT_ACK)) {
+                LOG_ERROR << "Handshake with device failed\n";
+                return false;
+            }
+            // ACKs after HELLO carry sequence numbers and credits
+            windowedAcks_ = windowed;
+            credits_ = windowed ? caps.credits : 0;
+        } else if (connection_->isConnected()) {
+            LOG_INFO << "No caps from device, using the legacy protocol\n";
+            applyCaps(caps);
+        } else {
+            return false;
+        }
+
+        LOG_INFO << "Device protocol v" << (int)caps.version
+                 << ": codec mask " << (int)dirtyTracker_.getCodecMask()
+                 << ", rle " << dirtyTracker_.isRleEnabled()
+                 << ", delta " << dirtyTracker_.isTemporalDelta()
+                 << ", tile cache " << (dirtyTracker_.isTileCacheEnabled() ? caps.tileCacheSlots : 0)
+                 << ", max rects " << dirtyTracker_.getMaxRects()
+                 << ", recv buffer " << caps.recvBufferBytes
+                 << ", credits " << (int)credits_.load() << "\n";
+        if (caps.pixelOrder != qualia::DeviceCaps::PixelOrder::LittleEndian) {
+            LOG_WARN << "Device prefers big-endian pixels; only little-endian is sent\n";
+        }
+        {
+            std::lock_guard<std::mutex> lock(statsMutex_);
+            deviceCaps_ = caps;
+        }
+        return true;
+    }
+
+    // Requested encoder features that the board supports
+    void applyCaps(const qualia::DeviceCaps& caps) {
+        using qualia::RectCodec;
+        const bool rle = requested_.rle && caps.supportsMessage(protocol::MSG_DIRTY_RECTS_RLE) &&
+                         caps.supportsCodec(RectCodec::Rle);
+        const bool delta = rle && requested_.temporalDelta && caps.supportsCodec(RectCodec::XorRle);
+        const bool tileOps = rle && caps.supportsMessage(protocol::MSG_TILE_OPS);
+        dirtyTracker_.setCodecMask(caps.codecs);
+        dirtyTracker_.setMaxRects(caps.maxRects);
+        dirtyTracker_.setRleEnabled(rle);
+        dirtyTracker_.setTemporalDelta(delta);
+        dirtyTracker_.setTileCache(tileOps && requested_.tileCache, caps.tileCacheSlots);
+        dirtyTracker_.setTileDedup(tileOps && requested_.tileDedup);
+        dirtyTracker_.setMotionSearch(delta && requested_.motionSearch && caps.supportsCodec(RectCodec::Move));
+    }
+
+    void encodeNormalFrame(const qualia::Image& frame, const qualia::DamageSnapshot& snapshot,
+                           qualia::GatherPacket& packet) {
+        const auto start = std::chrono::steady_clock::now();
+        // Find dirty rectangles, only where the skin drew something different
+        std::vector<qualia::DirtyRect> damage;
+        bool hinted = qualia::diffDamageSnapshots(sentSnapshot_, snapshot, damage);
+        if (dirtyTracker_.isMotionSearch()) {
+            qualia::findMotionHints(sentSnapshot_, snapshot, motionHints_);
+            dirtyTracker_.setMotionHints(motionHints_);
+        }
+        auto rects = dirtyTracker_.findDirtyRects(frame, hinted ? &damage : nullptr);
+        sentSnapshot_ = snapshot;
+        const auto diffed = std::chrono::steady_clock::now();
+        telemetry_.record(qualia::Stage::Diff, start, diffed);
         
-        // Build packet with dirty rect protocol
-        std::vector<uint8_t> packet = dirtyTracker_.buildPacket(frame, rects);
+        // Build packet with dirty rect protocol (pixel rows stay in frame)
+        dirtyTracker_.buildPacket(frame, rects, packet);
+        telemetry_.record(qualia::Stage::Encode, diffed, std::chrono::steady_clock::now());
         
         // Update stats
+        auto stats = dirtyTracker_.getLastStats(rects);
+        lastCompressionRatio_ = stats.compressionRatio;
+        lastRectCount_ = stats.rectCount;
+        lastPacketSize_ = packet.size();
         {
             std::lock_guard<std::mutex> slock(statsMutex_);
-            auto stats = dirtyTracker_.getLastStats(rects);
-            lastCompressionRatio_ = stats.compressionRatio;
-            lastRectCount_ = stats.rectCount;
-            lastPacketSize_ = packet.size();
             lastDirtyRects_ = rects;
         }
-        
-        return connection_->sendPacket(packet.data(), packet.size());
     }
     
-    bool sendFlashUpdate(const flash::FlashStatsMessage& stats,
-                         const qualia::Image& frame) {
+    void encodeFlashUpdate(const flash::FlashStatsMessage& stats, const qualia::Image& frame,
+                           qualia::GatherPacket& packet) {
         // Find dirty rects using normal comparison
+        const auto start = std::chrono::steady_clock::now();
         auto rects = dirtyTracker_.findDirtyRects(frame);
+        sentSnapshot_ = {};
+        const auto diffed = std::chrono::steady_clock::now();
+        telemetry_.record(qualia::Stage::Diff, start, diffed);
         
         // Build flash stats header
         uint8_t rectCount = min((size_t)255, rects.size());
-        std::vector<uint8_t> header = stats.serialize(rectCount);
-        
-        // Build dirty rect data (same format as normal mode)
-        std::vector<uint8_t> rectData;
-        if (rectCount > 0) {
-            // Rect headers
-            for (size_t i = 0; i < rectCount; i++) {
-                const auto& r = rects[i];
-                rectData.push_back(r.x & 0xFF);
-                rectData.push_back((r.x >> 8) & 0xFF);
-                rectData.push_back(r.y & 0xFF);
-                rectData.push_back((r.y >> 8) & 0xFF);
-                rectData.push_back(r.w & 0xFF);
-                rectData.push_back((r.w >> 8) & 0xFF);
-                rectData.push_back(r.h & 0xFF);
-                rectData.push_back((r.h >> 8) & 0xFF);
-            }
-            
-            // Rect pixel data
-            for (size_t i = 0; i < rectCount; i++) {
-                const auto& r = rects[i];
-                for (int y = r.y; y < r.y + r.h; y++) {
-                    for (int x = r.x; x < r.x + r.w; x++) {
-                        uint16_t px = frame.getPixel(x, y);
-                        rectData.push_back(px & 0xFF);
-                        rectData.push_back((px >> 8) & 0xFF);
-                    }
-                }
-            }
+        const bool tileOps = dirtyTracker_.hasTileOps();
+        const bool coded = tileOps || dirtyTracker_.isRleEnabled();
+        flash::FlashStatsMessage message = stats;
+        if (coded) {
+            message.flags |= flash::FlashStatsMessage::FLAG_RECT_CODECS;
+        }
+        if (tileOps) {
+            message.flags |= flash::FlashStatsMessage::FLAG_TILE_OPS;
         }
+        std::vector<uint8_t> header = message.serialize(rectCount);
         
-        // Combine and send
-        std::vector<uint8_t> packet;
-        packet.reserve(header.size() + rectData.size());
-        packet.insert(packet.end(), header.begin(), header.end());
-        packet.insert(packet.end(), rectData.begin(), rectData.end());
+        // Dirty rect data follows (same format as normal mode, or as
+        // MSG_DIRTY_RECTS_RLE / MSG_TILE_OPS when rect codecs are on)
+        packet.clear();
+        packet.appendBytes(header.data(), header.size());
+        if (tileOps) {
+            dirtyTracker_.appendTileOps(packet, frame);
+        }
+        if (coded) {
+            dirtyTracker_.appendCodedRects(packet, frame, rects, rectCount);
+        } else {
+            qualia::DirtyRectTracker::appendRects(packet, frame, rects, rectCount);
+        }
+        telemetry_.record(qualia::Stage::Encode, diffed, std::chrono::steady_clock::now());
         
         // Update stats
+        lastCompressionRatio_ = (float)rectCount / 100.0f;  // Rough indicator
+        lastRectCount_ = rectCount;
+        lastPacketSize_ = packet.size();
         {
             std::lock_guard<std::mutex> slock(statsMutex_);
-            lastCompressionRatio_ = (float)rectCount / 100.0f;  // Rough indicator
-            lastRectCount_ = rectCount;
-            lastPacketSize_ = packet.size();
             lastDirtyRects_ = rects;
         }
-        
-        return connection_->sendPacket(packet.data(), packet.size());
-    }
-    
-    void recordFrameSent() {
-        std::lock_guard<std::mutex> lock(fpsMutex_);
-        frameTimestamps_.push_back(std::chrono::steady_clock::now());
     }
     
     TcpConnection* connection_ = nullptr;
-    std::thread sendThread_;
-    mutable std::mutex mutex_;
-    std::condition_variable cv_;
-    qualia::Image pendingFrame_;
+    std::thread sendThread_;  // Encode stage
+    std::thread txThread_;
+    std::thread ackThread_;
     std::atomic<bool> running_;
-    std::atomic<bool> frameReady_;
     std::atomic<bool> sendError_;
-    
-    // Flash mode pending data
-    bool flashMode_ = false;
-    flash::FlashStatsMessage pendingFlashStats_;
+    std::atomic<uint32_t> encoderWake_{0};  // Bumped when the encode stage has work
+
+    // Frames handed from the render loop to the encode stage
+    struct PendingFrame {
+        qualia::Image frame;
+        qualia::DamageSnapshot snapshot;
+        bool flashMode = false;
+        flash::FlashStatsMessage flashStats;  // Flash mode only
+    };
+    TripleBuffer<PendingFrame> frames_;
     
     // Mode selection state
-    bool pendingModeSelection_ = false;
-    bool pendingModeValue_ = false;
+    std::atomic<bool> pendingModeSelection_{false};
+    std::atomic<bool> pendingModeValue_{false};
     std::atomic<bool> modeSyncFinished_{false};
     std::atomic<bool> modeSyncResult_{false};
+
+    std::atomic<bool> pendingReset_{false};
     
     // Frame consumed signaling (for frame lock)
-    mutable std::mutex consumedMutex_;
-    bool frameConsumed_;
+    std::atomic<bool> frameConsumed_;
     
-    // Dirty rect tracker
+    // Dirty rect tracker, with a pool for scanning tile bands in parallel
+    WorkerPool scanPool_;
     qualia::DirtyRectTracker dirtyTracker_;
     std::vector<qualia::DirtyRect> lastDirtyRects_;
+    qualia::DamageSnapshot sentSnapshot_;  // Draw snapshot of the tracker's reference frame
+    std::vector<qualia::MotionHint> motionHints_;
+    std::filesystem::path calibrationFile_;
+
+    // Encoder features asked for, and what the connected board supports
+    struct EncoderRequest {
+        bool rle = false;
+        bool temporalDelta = false;
+        bool tileCache = false;
+        bool tileDedup = false;
+        bool motionSearch = false;
+    };
+    EncoderRequest requested_;
+    qualia::DeviceCaps deviceCaps_;
+
+    // Pipeline stages and the slots passed between them
+    std::array<Slot, SLOT_COUNT> slots_;
+    SpscRing<int, RING_SIZE> freeSlots_;   // ACK -> encode
+    SpscRing<int, RING_SIZE> txQueue_;     // Encode -> transmit
+    SpscRing<int, RING_SIZE> ackQueue_;    // Transmit -> ACK, in send order
+    SpscRing<Calibration, RING_SIZE> calibrations_;  // ACK -> encode
+
+    // Windowed delivery (ACK stage, except the window read by the others)
+    int window_ = 0;               // Requested, 0 = auto
+    std::atomic<int> autoWindow_{2};
+    bool windowedAcks_ = false;
+    uint8_t ackSeq_ = 0;           // Sequence number of the next ACK
+    std::atomic<uint8_t> credits_{0};  // Frames the board takes in flight, from its last ACK
+    qualia::RateController rate_;  // Frame pacing, fed by the transmit and ACK stages
+    float minLatencyUs_ = 1e9f;    // Send-to-ACK, lowest recently
+    float epochMinLatencyUs_ = 1e9f;
+    int latencySamples_ = 0;
+    float ackIntervalUs_ = 0;      // Smoothed ACK spacing with a full pipe
+    std::chrono::steady_clock::time_point lastAck_;
+    bool lastAckValid_ = false;    // Next message was in flight at lastAck_
 
-    // FPS tracking
+    // FPS tracking and stage latencies
     const int fpsWindow_;
-    mutable std::mutex fpsMutex_;
-    mutable std::deque<std::chrono::steady_clock::time_point> frameTimestamps_;
+    qualia::Telemetry telemetry_;
     
     // Stats
-    mutable std::mutex statsMutex_;
-    float lastCompressionRatio_ = 1.0f;
-    int lastRectCount_ = 0;
-    size_t lastPacketSize_ = 0;
+    mutable std::mutex statsMutex_;  // Dirty rects and device caps
+    std::atomic<float> lastCompressionRatio_{1.0f};
+    std::atomic<int> lastRectCount_{0};
+    std::atomic<size_t> lastPacketSize_{0};
 };
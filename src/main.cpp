@@ -10,6 +10,7 @@
 #include "tcp.hpp"
 #include "tray.hpp"
 #include "utils/rgb565.h"
+#include "utils/texture_readback.h"
 #include "utils/util.h"
 #include "limit_instance.h"
 #include "startup.hpp"
@@ -93,10 +94,11 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     LOG_INFO << "Initialized system tray manager\n";
     
     // Create the window when needed
+    unsigned int loopFps = 30;  // Raised while the sender paces frames faster
     auto createWindow = [&]() {
         if (!window.has_value()) {
             window.emplace(sf::VideoMode(sf::Vector2u(windowWidth, windowHeight)), "Sketchbook", sf::Style::Titlebar | sf::Style::Close);
-            window->setFramerateLimit(30);
+            window->setFramerateLimit(loopFps);
             hwnd = window->getNativeHandle();
             trayManager.UpdateMainWindowHandle(hwnd);
         }
@@ -182,13 +184,31 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     // Secondary texture for frame lock with real-time preview (renders the locked frame for sending)
     sf::RenderTexture lockedTexture(sf::Vector2u(qualia::DISPLAY_HEIGHT, qualia::DISPLAY_WIDTH));
     
-    // RGB565 image buffer for sending
-    qualia::Image frameBuffer(qualia::DISPLAY_WIDTH, qualia::DISPLAY_HEIGHT);
+    // Reads back only the regions the skin redrew since the last send,
+    // through pixel buffers one frame late with async_readback
+    TextureReadback readback;
+
+    // With cpu_raster, skins draw the frames sent straight into the sender's
+    // buffer on the CPU; the render textures only feed the preview
+    CanvasTarget canvasTarget;
     
     // TCP connection and sender thread
     TcpConnection connection;
     FrameSender sender;
     bool connected = false;
+    if (settings.streaming.changeDetection == "hash" || settings.streaming.changeDetection == "hash_verify") {
+        sender.setChangeDetection(qualia::ChangeDetection::TileHash, settings.streaming.changeDetection == "hash_verify");
+        LOG_INFO << "Using tile hash change detection" << (settings.streaming.changeDetection == "hash_verify" ? " (verify on collision)" : "") << "\n";
+    }
+    sender.setRleEnabled(settings.streaming.rle);
+    sender.setTemporalDelta(settings.streaming.rle && settings.streaming.temporalDelta);
+    sender.setTileCache(settings.streaming.rle && settings.streaming.tileCache);
+    sender.setTileDedup(settings.streaming.rle && settings.streaming.tileDedup);
+    sender.setMotionSearch(settings.streaming.rle && settings.streaming.temporalDelta && settings.streaming.motionSearch);
+    sender.setWindow(settings.streaming.window);
+    readback.setWorkerPool(&sender.workerPool());
+    readback.setAsync(settings.streaming.asyncReadback);
+    readback.setGpuPack(settings.streaming.gpuPack);
     
     // Frame lock controller
     FrameLockController frameLock(20.0);  // Target 20 FPS
@@ -274,7 +294,22 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     
     // Timing
     sf::Clock sendClock;
-    const float sendInterval = 0.05f;  // ~20 FPS target
+    float sendInterval = 1.0f / qualia::RateController::DEFAULT_FPS;  // Paced by the sender once connected
+
+    // Stage latency percentiles: the status bar shows the last second's,
+    // the log gets all of them every 10 seconds
+    sf::Clock telemetryClock;
+    int telemetryTicks = 0;
+    qualia::Telemetry::Snapshot statusBase = sender.telemetry().snapshot();
+    qualia::Telemetry::Snapshot logBase = statusBase;
+    qualia::Telemetry::Snapshot statusWindow;
+    auto stageStatus = [&]() {
+        using qualia::Stage;
+        return std::format("p50/p99 ms: diff {:.1f}/{:.1f} enc {:.1f}/{:.1f} ack {:.0f}/{:.0f}",
+                           statusWindow.percentileMs(Stage::Diff, 0.5f), statusWindow.percentileMs(Stage::Diff, 0.99f),
+                           statusWindow.percentileMs(Stage::Encode, 0.5f), statusWindow.percentileMs(Stage::Encode, 0.99f),
+                           statusWindow.percentileMs(Stage::Ack, 0.5f), statusWindow.percentileMs(Stage::Ack, 0.99f));
+    };
     
     // Wall clock for animation
     auto startTime = std::chrono::steady_clock::now();
@@ -667,7 +702,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
             if (connected) {
                 LOG_INFO << "Resetting board...\n";
                 if (sender.sendReset()) {
-                    LOG_INFO << "Reset command sent successfully.\n";
+                    LOG_INFO << "Reset command queued.\n";
                 } else {
                     LOG_ERROR << "Failed to send reset command.\n";
                     statusMsg = "Failed to send reset command";
@@ -736,6 +771,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
                     connectBtn.setLabel("Disconnect");
                     connectBtn.setColor(sf::Color(255, 100, 100), sf::Color(255, 150, 150));
                     statusIndicator.setFillColor(sf::Color::Green);
+                    sender.setCalibrationFile(settings.getCalibrationPath(connectingIP));
                     sender.start(&connection);
                     frameLock.reset();  // Reset frame lock timing on new connection
                     pendingModeSync = true; // We want to sync mode selection after connecting
@@ -804,6 +840,30 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
             flashModeCB.setDisabled(true);
         }
 
+        // Pace frames at the rate the link and board sustain; the frame lock
+        // budget follows, and the loop runs fast enough to keep up
+        if (connected) {
+            sendInterval = sender.getSendInterval();
+            frameLock.setTargetFPS(1.0 / sendInterval);
+            unsigned int fps = std::clamp((unsigned int)std::ceil(1.0f / sendInterval), 30u,
+                                          (unsigned int)qualia::RateController::MAX_FPS);
+            if (fps != loopFps) {
+                loopFps = fps;
+                if (window.has_value()) window->setFramerateLimit(loopFps);
+            }
+        }
+
+        if (telemetryClock.getElapsedTime().asSeconds() >= 1.0f) {
+            telemetryClock.restart();
+            qualia::Telemetry::Snapshot now = sender.telemetry().snapshot();
+            statusWindow = now.since(statusBase);
+            statusBase = now;
+            if (++telemetryTicks % 10 == 0 && connected) {
+                LOG_INFO << "Pipeline ms (p50/p95/p99): " << now.since(logBase).summary() << "\n";
+                logBase = now;
+            }
+        }
+
         // Update frame lock controller
         frameLock.update();
         
@@ -826,6 +886,29 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
         if (isFlashModeActive) {
             flashedLayers = skins[skinName]->getFlashConfig().enabledLayers;
         }
+
+        // Frames sent with cpu_raster skip the render texture, which is then
+        // only drawn while there's a window to preview it in
+        bool cpuRaster = settings.streaming.cpuRaster && skins[skinName]->supportsCanvas();
+        bool drawPreview = !cpuRaster || window.has_value();
+        auto rasterFrame = [&](double animTime) {
+            qualia::StageTimer renderTimer(sender.telemetry(), qualia::Stage::Render);
+            canvasTarget.begin(sender.frameBuffer(), settings.preferences.rotate180);
+            if (isFlashModeActive) {
+                skins[skinName]->drawForFlash(canvasTarget, stats, weather, train, animTime,
+                                               flashedLayers, FLASH_TRANSPARENT_COLOR);
+            } else {
+                skins[skinName]->draw(canvasTarget, stats, weather, train, animTime);
+            }
+            readback.reset();  // The sender's buffers no longer hold what it read
+        };
+        auto queueDrawnFrame = [&]() {
+            if (cpuRaster) {
+                sender.queueFrame(drawSnapshotToPanel(skins[skinName]->getDrawSnapshot(), settings.preferences.rotate180));
+            } else {
+                sender.queueFrame(drawSnapshotToPanel(readback.frameSnapshot(), readback.frameNeg90()));
+            }
+        };
         
         // Draw to texture based on mode
         if (connected && settings.preferences.frameLock) {
@@ -834,67 +917,79 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
             if (settings.preferences.frameLockRealTimePreview) {
                 // Real-time preview: draw with wall time for display
                 // previewComposite controls what we SEE, not what we SEND
-                if (isFlashModeActive && !skins[skinName]->getFlashConfig().previewComposite) {
-                    skins[skinName]->drawForFlash(qualiaTexture, stats, weather, train, wallAnimTime, 
-                                                   flashedLayers, FLASH_TRANSPARENT_COLOR);
-                } else {
-                    skins[skinName]->draw(qualiaTexture, stats, weather, train, wallAnimTime);
+                if (drawPreview) {
+                    if (isFlashModeActive && !skins[skinName]->getFlashConfig().previewComposite) {
+                        skins[skinName]->drawForFlash(qualiaTexture, stats, weather, train, wallAnimTime, 
+                                                       flashedLayers, FLASH_TRANSPARENT_COLOR);
+                    } else {
+                        skins[skinName]->draw(qualiaTexture, stats, weather, train, wallAnimTime);
+                    }
                 }
                 
                 // Draw with locked time for sending - ALWAYS use drawForFlash when flash mode active
                 if (sendClock.getElapsedTime().asSeconds() >= sendInterval && sender.isReadyForFrame()) {
-                    if (isFlashModeActive) {
-                        skins[skinName]->drawForFlash(lockedTexture, stats, weather, train, lockedAnimTime,
-                                                       flashedLayers, FLASH_TRANSPARENT_COLOR);
+                    if (cpuRaster) {
+                        rasterFrame(lockedAnimTime);
                     } else {
-                        skins[skinName]->draw(lockedTexture, stats, weather, train, lockedAnimTime);
+                        qualia::StageTimer renderTimer(sender.telemetry(), qualia::Stage::Render);
+                        if (isFlashModeActive) {
+                            skins[skinName]->drawForFlash(lockedTexture, stats, weather, train, lockedAnimTime,
+                                                           flashedLayers, FLASH_TRANSPARENT_COLOR);
+                        } else {
+                            skins[skinName]->draw(lockedTexture, stats, weather, train, lockedAnimTime);
+                        }
                     }
                     sendClock.restart();
-                    if (settings.preferences.rotate180) {
-                        textureToRGB565RotNeg90(lockedTexture, frameBuffer);
-                    } else {
-                        textureToRGB565Rot90(lockedTexture, frameBuffer);
-                    }
+                    bool frameRead = cpuRaster ||
+                                     readback.read(lockedTexture, skins[skinName]->getDrawSnapshot(), sender.frameBuffer(),
+                                                   settings.preferences.rotate180, &sender.telemetry());
                     
                     if (isFlashModeActive) {
-                        auto flashStats = flash::buildFlashStats(stats, weather, train, skins[skinName]);
-                        sender.queueFlashUpdate(flashStats, frameBuffer);
-                    } else {
-                        sender.queueFrame(frameBuffer);
+                        if (frameRead) {
+                            auto flashStats = flash::buildFlashStats(stats, weather, train, skins[skinName]);
+                            sender.queueFlashUpdate(flashStats);
+                        }
+                    } else if (frameRead) {
+                        queueDrawnFrame();
                     }
                 }
             } else {
                 // Standard frame lock: previewComposite controls preview, always send with drawForFlash
-                if (isFlashModeActive && !skins[skinName]->getFlashConfig().previewComposite) {
-                    skins[skinName]->drawForFlash(qualiaTexture, stats, weather, train, lockedAnimTime,
-                                                   flashedLayers, FLASH_TRANSPARENT_COLOR);
-                } else {
-                    skins[skinName]->draw(qualiaTexture, stats, weather, train, lockedAnimTime);
+                if (drawPreview) {
+                    qualia::StageTimer renderTimer(sender.telemetry(), qualia::Stage::Render);
+                    if (isFlashModeActive && !skins[skinName]->getFlashConfig().previewComposite) {
+                        skins[skinName]->drawForFlash(qualiaTexture, stats, weather, train, lockedAnimTime,
+                                                       flashedLayers, FLASH_TRANSPARENT_COLOR);
+                    } else {
+                        skins[skinName]->draw(qualiaTexture, stats, weather, train, lockedAnimTime);
+                    }
                 }
                 
                 if (sendClock.getElapsedTime().asSeconds() >= sendInterval && sender.isReadyForFrame()) {
                     // For sending, ALWAYS use drawForFlash when flash mode is active
-                    if (isFlashModeActive) {
+                    if (cpuRaster) {
+                        rasterFrame(lockedAnimTime);
+                    } else if (isFlashModeActive) {
                         // Re-render with drawForFlash for sending (preview might have used draw())
                         skins[skinName]->drawForFlash(qualiaTexture, stats, weather, train, lockedAnimTime,
                                                        flashedLayers, FLASH_TRANSPARENT_COLOR);
                     }
                     sendClock.restart();
-                    if (settings.preferences.rotate180) {
-                        textureToRGB565RotNeg90(qualiaTexture, frameBuffer);
-                    } else {
-                        textureToRGB565Rot90(qualiaTexture, frameBuffer);
-                    }
+                    bool frameRead = cpuRaster ||
+                                     readback.read(qualiaTexture, skins[skinName]->getDrawSnapshot(), sender.frameBuffer(),
+                                                   settings.preferences.rotate180, &sender.telemetry());
                     
                     if (isFlashModeActive) {
-                        auto flashStats = flash::buildFlashStats(stats, weather, train, skins[skinName]);
-                        sender.queueFlashUpdate(flashStats, frameBuffer);
+                        if (frameRead) {
+                            auto flashStats = flash::buildFlashStats(stats, weather, train, skins[skinName]);
+                            sender.queueFlashUpdate(flashStats);
+                        }
                         // Re-render with composite for preview if needed
-                        if (skins[skinName]->getFlashConfig().previewComposite) {
+                        if (!cpuRaster && skins[skinName]->getFlashConfig().previewComposite) {
                             skins[skinName]->draw(qualiaTexture, stats, weather, train, lockedAnimTime);
                         }
-                    } else {
-                        sender.queueFrame(frameBuffer);
+                    } else if (frameRead) {
+                        queueDrawnFrame();
                     }
                 }
             }
@@ -905,47 +1000,58 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
             size_t packetKB = sender.getLastPacketSize() / 1024;
             std::string lockStatus = frameLock.isFrozen() ? " [FROZEN]" : "";
             std::string flashStatus = isFlashModeActive ? " [FLASH]" : "";
-            statusMsg = std::format("Connected | FPS: {:.1f} | {:.0f}% dirty ({} rects, {}KB){}{}", 
-                                   sender.getFPS(), ratio * 100.0f, rects, packetKB, lockStatus, flashStatus);
+            auto rate = sender.getRateStatus();
+            statusMsg = std::format("Connected | FPS: {:.1f}/{:.0f} | {:.0f}% dirty ({} rects, {}KB) | {} | {} {:.0f}KB/s rtt {:.0f}ms{}{}", 
+                                   sender.getFPS(), rate.fps, ratio * 100.0f, rects, packetKB, stageStatus(),
+                                   qualia::RateController::stateName(rate.state), rate.bytesPerSec / 1024.0f, rate.minRttMs,
+                                   lockStatus, flashStatus);
         } else {
             // No frame lock: previewComposite controls preview, always send with drawForFlash
-            if (isFlashModeActive && !skins[skinName]->getFlashConfig().previewComposite) {
-                skins[skinName]->drawForFlash(qualiaTexture, stats, weather, train, wallAnimTime,
-                                               flashedLayers, FLASH_TRANSPARENT_COLOR);
-            } else {
-                skins[skinName]->draw(qualiaTexture, stats, weather, train, wallAnimTime);
+            if (drawPreview) {
+                qualia::StageTimer renderTimer(sender.telemetry(), qualia::Stage::Render);
+                if (isFlashModeActive && !skins[skinName]->getFlashConfig().previewComposite) {
+                    skins[skinName]->drawForFlash(qualiaTexture, stats, weather, train, wallAnimTime,
+                                                   flashedLayers, FLASH_TRANSPARENT_COLOR);
+                } else {
+                    skins[skinName]->draw(qualiaTexture, stats, weather, train, wallAnimTime);
+                }
             }
             
             if (connected && sendClock.getElapsedTime().asSeconds() >= sendInterval) {
                 // For sending, ALWAYS use drawForFlash when flash mode is active
-                if (isFlashModeActive) {
+                if (cpuRaster) {
+                    rasterFrame(wallAnimTime);
+                } else if (isFlashModeActive) {
                     skins[skinName]->drawForFlash(qualiaTexture, stats, weather, train, wallAnimTime,
                                                    flashedLayers, FLASH_TRANSPARENT_COLOR);
                 }
                 sendClock.restart();
-                if (settings.preferences.rotate180) {
-                    textureToRGB565RotNeg90(qualiaTexture, frameBuffer);
-                } else {
-                    textureToRGB565Rot90(qualiaTexture, frameBuffer);
-                }
+                bool frameRead = cpuRaster ||
+                                 readback.read(qualiaTexture, skins[skinName]->getDrawSnapshot(), sender.frameBuffer(),
+                                               settings.preferences.rotate180, &sender.telemetry());
                 
                 if (isFlashModeActive) {
-                    auto flashStats = flash::buildFlashStats(stats, weather, train, skins[skinName]);
-                    sender.queueFlashUpdate(flashStats, frameBuffer);
+                    if (frameRead) {
+                        auto flashStats = flash::buildFlashStats(stats, weather, train, skins[skinName]);
+                        sender.queueFlashUpdate(flashStats);
+                    }
                     // Re-render with composite for preview if needed
-                    if (skins[skinName]->getFlashConfig().previewComposite) {
+                    if (!cpuRaster && skins[skinName]->getFlashConfig().previewComposite) {
                         skins[skinName]->draw(qualiaTexture, stats, weather, train, wallAnimTime);
                     }
-                } else {
-                    sender.queueFrame(frameBuffer);
+                } else if (frameRead) {
+                    queueDrawnFrame();
                 }
                 
                 float ratio = sender.getCompressionRatio();
                 int rects = sender.getLastRectCount();
                 size_t packetKB = sender.getLastPacketSize() / 1024;
                 std::string flashStatus = isFlashModeActive ? " [FLASH]" : "";
-                statusMsg = std::format("Connected | FPS: {:.1f} | {:.0f}% dirty ({} rects, {}KB){}", 
-                                       sender.getFPS(), ratio * 100.0f, rects, packetKB, flashStatus);
+                auto rate = sender.getRateStatus();
+                statusMsg = std::format("Connected | FPS: {:.1f}/{:.0f} | {:.0f}% dirty ({} rects, {}KB) | {} | {} {:.0f}KB/s rtt {:.0f}ms{}", 
+                                       sender.getFPS(), rate.fps, ratio * 100.0f, rects, packetKB, stageStatus(),
+                                       qualia::RateController::stateName(rate.state), rate.bytesPerSec / 1024.0f, rate.minRttMs,
+                                       flashStatus);
             }
         }
         
@@ -1050,7 +1156,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
         if (!window.has_value()) {
             // Sleep briefly to avoid busy loop when window is not open. When the window is open, this is handled by the framerate limit
-            std::this_thread::sleep_for(std::chrono::milliseconds(33));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1000 / loopFps));
         }
     }
 
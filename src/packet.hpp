@@ -0,0 +1,104 @@
+#pragma once
+
+#include "image.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace qualia {
+
+// Outgoing packet as a list of segments for scatter/gather sends.
+// Small headers are copied into a scratch buffer; pixel rows are referenced
+// in place in the Image, which must outlive the send. Buffers keep their
+// capacity across clear(), so a reused packet doesn't allocate per frame.
+class GatherPacket {
+public:
+    struct Segment {
+        const uint8_t* data;  // nullptr: offset into the scratch buffer
+        size_t offset;
+        size_t size;
+    };
+
+    GatherPacket() {
+        scratch_.reserve(1024);
+        segments_.reserve(256);
+    }
+
+    void clear() {
+        scratch_.clear();
+        segments_.clear();
+        size_ = 0;
+    }
+
+    // Copy bytes into the scratch buffer
+    void appendBytes(const void* data, size_t size) {
+        if (size == 0) return;
+        size_t offset = scratch_.size();
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        scratch_.insert(scratch_.end(), p, p + size);
+        if (!segments_.empty() && !segments_.back().data &&
+            segments_.back().offset + segments_.back().size == offset) {
+            segments_.back().size += size;
+        } else {
+            segments_.push_back({nullptr, offset, size});
+        }
+        size_ += size;
+    }
+
+    void appendU8(uint8_t val) {
+        appendBytes(&val, 1);
+    }
+
+    void appendU16(uint16_t val) {
+        uint8_t bytes[2] = { (uint8_t)(val & 0xFF), (uint8_t)((val >> 8) & 0xFF) };
+        appendBytes(bytes, 2);
+    }
+
+    // Reference bytes without copying; adjacent references are coalesced
+    void appendRef(const void* data, size_t size) {
+        if (size == 0) return;
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        if (!segments_.empty() && segments_.back().data &&
+            segments_.back().data + segments_.back().size == p) {
+            segments_.back().size += size;
+        } else {
+            segments_.push_back({p, 0, size});
+        }
+        size_ += size;
+    }
+
+    // Reference a rect's pixel rows (full-width rects become one segment).
+    // Pixels go out in memory order, which is little-endian RGB565 on x86.
+    void appendRectPixels(const Image& frame, int x, int y, int w, int h) {
+        for (int row = y; row < y + h; ++row) {
+            appendRef(frame.pixels.data() + (size_t)row * frame.width + x, w * sizeof(Pixel));
+        }
+    }
+
+    const std::vector<Segment>& segments() const { return segments_; }
+
+    const uint8_t* segmentData(const Segment& s) const {
+        return s.data ? s.data : scratch_.data() + s.offset;
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // Contiguous copy, for transports without gather support
+    std::vector<uint8_t> flatten() const {
+        std::vector<uint8_t> out;
+        out.reserve(size_);
+        for (const auto& s : segments_) {
+            const uint8_t* p = segmentData(s);
+            out.insert(out.end(), p, p + s.size);
+        }
+        return out;
+    }
+
+private:
+    std::vector<uint8_t> scratch_;
+    std::vector<Segment> segments_;
+    size_t size_ = 0;
+};
+
+} // namespace qualia
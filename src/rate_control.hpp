@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace qualia {
+
+// Frame pacing modelled on BBR. The bottleneck rate is the windowed max of
+// per-ACK delivery rate samples, kept both in bytes/s and in messages/s (a
+// mostly clean frame is bound by the board's per-message cost, not by its
+// size), and the round trip floor is the windowed min of send-to-ACK times.
+// Frames are paced at gain x the rate the bottleneck takes them at the
+// current frame size: the gain starts high to find the rate, cycles around
+// 1 to probe for more, and drops while round trips rise above the floor,
+// so frames don't queue up on the board.
+class RateController {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class State { Startup, Drain, ProbeBw, ProbeRtt };
+
+    static constexpr float DEFAULT_FPS = 20.0f;  // Until there are estimates
+    static constexpr float MIN_FPS = 5.0f;
+    static constexpr float MAX_FPS = 60.0f;
+
+    // Delivery state when a message was sent, kept with the message
+    struct SendState {
+        uint64_t delivered = 0;       // Bytes
+        uint64_t deliveredMsgs = 0;
+        Clock::time_point deliveredTime;
+        Clock::time_point firstSentTime;
+        Clock::time_point sentTime;
+        size_t bytes = 0;
+    };
+
+    struct Status {
+        State state = State::Startup;
+        float bytesPerSec = 0;  // Bottleneck estimates
+        float msgsPerSec = 0;
+        float minRttMs = 0;
+        float gain = 1;
+        float fps = DEFAULT_FPS;  // Current pacing
+    };
+
+    RateController() { reset(); }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        state_ = State::Startup;
+        delivered_ = 0;
+        deliveredMsgs_ = 0;
+        deliveredTime_ = firstSentTime_ = Clock::now();
+        bytesMax_.clear();
+        msgsMax_.clear();
+        minRtt_ = 0;
+        minRttStamp_ = deliveredTime_;
+        smoothedRtt_ = 0;
+        frameBytes_ = 0;
+        nextRoundDelivered_ = 0;
+        fullMsgs_ = 0;
+        fullRounds_ = 0;
+        cycleIndex_ = 0;
+        cycleStamp_ = deliveredTime_;
+        interval_ = 1.0f / DEFAULT_FPS;
+    }
+
+    // Seconds between frames; safe from any thread
+    float interval() const { return interval_; }
+
+    Status status() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Status s;
+        s.state = state_;
+        s.bytesPerSec = bytesMax_.value();
+        s.msgsPerSec = msgsMax_.value();
+        s.minRttMs = minRtt_ * 1000.0f;
+        s.gain = gain();
+        s.fps = 1.0f / interval_;
+        return s;
+    }
+
+    static const char* stateName(State state) {
+        switch (state) {
+            case State::Startup: return "startup";
+            case State::Drain: return "drain";
+            case State::ProbeBw: return "probe_bw";
+            case State::ProbeRtt: return "probe_rtt";
+        }
+        return "unknown";
+    }
+
+    // A message of bytes goes out with inFlight others unacknowledged
+    void onSend(SendState& send, size_t bytes, size_t inFlight, Clock::time_point now) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (inFlight == 0) {
+            // Restarting from idle: the gap isn't part of any delivery interval
+            firstSentTime_ = now;
+            deliveredTime_ = now;
+        }
+        send = {delivered_, deliveredMsgs_, deliveredTime_, firstSentTime_, now, bytes};
+    }
+
+    // The message was acknowledged, leaving inFlight others unacknowledged
+    void onAck(const SendState& send, size_t inFlight, Clock::time_point now) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        delivered_ += send.bytes;
+        deliveredMsgs_++;
+        deliveredTime_ = now;
+        firstSentTime_ = send.sentTime;
+
+        float rtt = seconds(now - send.sentTime);
+        smoothedRtt_ = smoothedRtt_ > 0 ? smoothedRtt_ + 0.125f * (rtt - smoothedRtt_) : rtt;
+        if (minRtt_ == 0 || rtt <= minRtt_ || now - minRttStamp_ > MIN_RTT_WINDOW) {
+            minRtt_ = rtt;
+            minRttStamp_ = now;
+        }
+        frameBytes_ = frameBytes_ > 0 ? frameBytes_ + 0.2f * ((float)send.bytes - frameBytes_) : (float)send.bytes;
+
+        // Delivery rate over the longer of the send and ACK intervals, as
+        // either can be compressed by batching
+        float elapsed = max(seconds(send.sentTime - send.firstSentTime), seconds(now - send.deliveredTime));
+        if (elapsed > 0 && elapsed >= minRtt_ * 0.5f) {
+            bytesMax_.update(now, (float)(delivered_ - send.delivered) / elapsed);
+            msgsMax_.update(now, (float)(deliveredMsgs_ - send.deliveredMsgs) / elapsed);
+        }
+
+        bool roundStart = send.delivered >= nextRoundDelivered_;
+        if (roundStart) nextRoundDelivered_ = delivered_;
+        updateState(now, inFlight, roundStart);
+        updateInterval();
+    }
+
+private:
+    // Max over a sliding time window
+    class WindowedMax {
+    public:
+        void clear() { samples_.clear(); }
+        float value() const { return samples_.empty() ? 0.0f : samples_.front().second; }
+        void update(Clock::time_point now, float v) {
+            while (!samples_.empty() && samples_.back().second <= v) samples_.pop_back();
+            samples_.emplace_back(now, v);
+            while (now - samples_.front().first > BW_WINDOW) samples_.pop_front();
+        }
+    private:
+        std::deque<std::pair<Clock::time_point, float>> samples_;
+    };
+
+    static constexpr auto BW_WINDOW = std::chrono::seconds(2);
+    static constexpr auto MIN_RTT_WINDOW = std::chrono::seconds(10);
+    static constexpr auto PROBE_RTT_TIME = std::chrono::milliseconds(200);
+    static constexpr float STARTUP_GAIN = 2.885f;  // 2/ln(2), doubles the rate every round
+    static constexpr float CYCLE_GAINS[8] = {1.25f, 0.75f, 1, 1, 1, 1, 1, 1};
+    static constexpr float QUEUE_RTT_RATIO = 1.5f;  // Round trips this far above the floor mean a queue
+
+    mutable std::mutex mutex_;
+    State state_;
+    uint64_t delivered_;
+    uint64_t deliveredMsgs_;
+    Clock::time_point deliveredTime_;
+    Clock::time_point firstSentTime_;  // Send time of the last acknowledged message
+    WindowedMax bytesMax_;
+    WindowedMax msgsMax_;
+    float minRtt_;                     // Seconds
+    Clock::time_point minRttStamp_;
+    float smoothedRtt_;
+    float frameBytes_;                 // Recent message size
+    uint64_t nextRoundDelivered_;
+    float fullMsgs_;                   // Startup: rate at the last 25% growth
+    int fullRounds_;                   // Startup: rounds since then
+    int cycleIndex_;
+    Clock::time_point cycleStamp_;
+    Clock::time_point probeRttDone_;
+    std::atomic<float> interval_;
+
+    static float seconds(Clock::duration d) { return std::chrono::duration<float>(d).count(); }
+
+    float gain() const {
+        switch (state_) {
+            case State::Startup: return STARTUP_GAIN;
+            case State::Drain: return 1.0f / STARTUP_GAIN;
+            case State::ProbeBw: return CYCLE_GAINS[cycleIndex_];
+            case State::ProbeRtt: return 1.0f;
+        }
+        return 1.0f;
+    }
+
+    void enterProbeBw(Clock::time_point now) {
+        state_ = State::ProbeBw;
+        cycleIndex_ = 2;  // Cruise first
+        cycleStamp_ = now;
+    }
+
+    void updateState(Clock::time_point now, size_t inFlight, bool roundStart) {
+        // Frames in flight the pipe holds at the bottleneck rate
+        float bdp = msgsMax_.value() * minRtt_;
+
+        switch (state_) {
+            case State::Startup:
+                if (!roundStart) break;
+                if (msgsMax_.value() >= fullMsgs_ * 1.25f) {
+                    fullMsgs_ = msgsMax_.value();
+                    fullRounds_ = 0;
+                } else if (++fullRounds_ >= 3) {
+                    state_ = State::Drain;  // Rate stopped growing: pipe full
+                }
+                break;
+            case State::Drain:
+                if (inFlight <= max(1.0f, bdp)) enterProbeBw(now);
+                break;
+            case State::ProbeBw:
+                if (CYCLE_GAINS[cycleIndex_] >= 1.0f && smoothedRtt_ > minRtt_ * QUEUE_RTT_RATIO) {
+                    cycleIndex_ = 1;  // Queue building: drain it now
+                    cycleStamp_ = now;
+                } else if (seconds(now - cycleStamp_) > max(minRtt_, interval_.load())) {
+                    cycleIndex_ = (cycleIndex_ + 1) % 8;
+                    cycleStamp_ = now;
+                }
+                break;
+            case State::ProbeRtt:
+                if (now >= probeRttDone_ && roundStart) {
+                    minRttStamp_ = now;
+                    enterProbeBw(now);
+                }
+                break;
+        }
+
+        // Floor not refreshed in a while: let the pipe empty to re-measure it
+        if (state_ != State::ProbeRtt && state_ != State::Startup && now - minRttStamp_ > MIN_RTT_WINDOW) {
+            state_ = State::ProbeRtt;
+            probeRttDone_ = now + PROBE_RTT_TIME;
+        }
+    }
+
+    void updateInterval() {
+        float fps = DEFAULT_FPS;
+        if (msgsMax_.value() > 0) {
+            fps = gain() * msgsMax_.value();
+            if (frameBytes_ > 0) fps = min(fps, gain() * bytesMax_.value() / frameBytes_);
+        }
+        float interval = 1.0f / std::clamp(fps, MIN_FPS, MAX_FPS);
+        if (state_ == State::ProbeRtt) {
+            interval = max(interval, smoothedRtt_);  // One frame in flight
+        }
+        interval_ = interval;
+    }
+};
+
+} // namespace qualia
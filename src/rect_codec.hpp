@@ -0,0 +1,165 @@
+#pragma once
+
+#include "image.hpp"
+#include "tile_compare.hpp"
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace qualia {
+
+// Per-rect payload encodings used by MSG_DIRTY_RECTS_RLE
+enum class RectCodec : uint8_t {
+    Raw = 0,  // w*h little-endian RGB565 pixels
+    Rle = 1,  // Row length table, then per-row run-length tokens
+    XorRle = 2, // Rle layout, of the pixels XORed with the device's current pixels
+    Fill = 3,   // One uint16_t little-endian color for the whole rect
+    Move = 4    // int8 dx, int8 dy, then XorRle against the device's pixels at (x - dx, y - dy)
+};
+
+// RLE payload layout for a w x h rect:
+//   [2 bytes * h]  byte length of each encoded row, uint16_t little-endian
+//   [rows]         tokens, each a uint16_t little-endian header:
+//                    bit 15 set:   repeat, (hdr & 0x7FFF) + 1 copies of the 1 pixel that follows
+//                    bit 15 clear: literal, hdr + 1 pixels follow
+// Rows are coded separately so the device can receive and decode one row at a time.
+// In XorRle payloads unchanged pixels are zero, so a repeat of 0 means "skip".
+// A Move rect is first filled from the device's own pixels, offset by (-dx, -dy),
+// and the XorRle residual is applied on top of that.
+constexpr int RLE_MIN_RUN = 3;          // Shorter runs stay inside literals
+constexpr int RLE_MAX_TOKEN = 0x8000;   // Pixels per token
+
+// True if all pixels of the w x h block are the same; sets color
+inline bool solidColor(const Pixel* p, int stride, int w, int h, Pixel& color) {
+    color = p[0];
+    for (int y = 0; y < h; ++y) {
+        const Pixel* row = p + (size_t)y * stride;
+        Pixel diff = 0;
+        for (int x = 0; x < w; ++x) diff |= row[x] ^ color;
+        if (diff) return false;
+    }
+    return true;
+}
+
+// Sets bit i of mask when row[i] == row[i + 1], for i in [0, w - 1)
+inline void equalNextMask(const Pixel* row, int w, uint64_t* mask) {
+    const int words = (w + 63) / 64;
+    for (int i = 0; i < words; ++i) mask[i] = 0;
+    int i = 0;
+#ifdef QUALIA_SIMD_X86
+    for (; i + 9 <= w; i += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i + 1));
+        // One byte per pixel, then one bit per pixel
+        __m128i eq = _mm_packs_epi16(_mm_cmpeq_epi16(a, b), _mm_setzero_si128());
+        uint64_t bits = (uint64_t)(_mm_movemask_epi8(eq) & 0xFF);
+        // i is a multiple of 8, so a group never straddles two mask words
+        mask[i / 64] |= bits << (i % 64);
+    }
+#endif
+    for (; i < w - 1; ++i) {
+        if (row[i] == row[i + 1]) mask[i / 64] |= 1ULL << (i % 64);
+    }
+}
+
+// Length of the run of equal pixels starting at i (at least 1)
+inline int runLengthAt(const uint64_t* mask, int i, int w) {
+    int len = 1;
+    while (i < w - 1) {
+        int shift = i % 64;
+        int ones = std::countr_one(mask[i / 64] >> shift);
+        if (ones < 64 - shift) {
+            return len + ones;
+        }
+        len += 64 - shift;
+        i += 64 - shift;
+    }
+    return len;
+}
+
+class RleEncoder {
+public:
+    // Appends the RLE payload of a rect to out. Gives up and restores out
+    // once the payload would reach limit bytes; returns the payload size, or
+    // 0 if it gave up.
+    size_t encodeRect(const Image& frame, int x, int y, int w, int h, std::vector<uint8_t>& out, size_t limit) {
+        return encode(frame, x, y, w, h, nullptr, 0, 0, out, limit);
+    }
+
+    // Same, for the rect's pixels XORed with reference pixels at (refX, refY)
+    size_t encodeXorRect(const Image& frame, int x, int y, int w, int h, const Image& reference, int refX, int refY,
+                         std::vector<uint8_t>& out, size_t limit) {
+        return encode(frame, x, y, w, h, &reference, refX, refY, out, limit);
+    }
+
+private:
+    uint64_t mask_[(DISPLAY_WIDTH + 63) / 64];
+    Pixel xorRow_[DISPLAY_WIDTH];
+
+    size_t encode(const Image& frame, int x, int y, int w, int h, const Image* reference, int refX, int refY,
+                  std::vector<uint8_t>& out, size_t limit) {
+        const size_t start = out.size();
+        const size_t table = start;
+        out.resize(start + (size_t)h * 2);
+
+        for (int row = 0; row < h; ++row) {
+            const Pixel* p = frame.pixels.data() + (size_t)(y + row) * frame.width + x;
+            if (reference) {
+                const Pixel* r = reference->pixels.data() + (size_t)(refY + row) * reference->width + refX;
+                for (int i = 0; i < w; ++i) xorRow_[i] = p[i] ^ r[i];
+                p = xorRow_;
+            }
+            size_t rowStart = out.size();
+            encodeRow(p, w, out);
+            size_t rowBytes = out.size() - rowStart;
+            out[table + row * 2] = (uint8_t)(rowBytes & 0xFF);
+            out[table + row * 2 + 1] = (uint8_t)((rowBytes >> 8) & 0xFF);
+            if (out.size() - start >= limit) {
+                out.resize(start);
+                return 0;
+            }
+        }
+        return out.size() - start;
+    }
+
+    static void putU16(std::vector<uint8_t>& out, uint16_t v) {
+        out.push_back((uint8_t)(v & 0xFF));
+        out.push_back((uint8_t)((v >> 8) & 0xFF));
+    }
+
+    static void putLiteral(const Pixel* p, int count, std::vector<uint8_t>& out) {
+        while (count > 0) {
+            int n = min(count, RLE_MAX_TOKEN);
+            putU16(out, (uint16_t)(n - 1));
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(p);
+            out.insert(out.end(), bytes, bytes + n * sizeof(Pixel));
+            p += n;
+            count -= n;
+        }
+    }
+
+    void encodeRow(const Pixel* p, int w, std::vector<uint8_t>& out) {
+        equalNextMask(p, w, mask_);
+        int literalStart = 0;
+        int i = 0;
+        while (i < w) {
+            int run = runLengthAt(mask_, i, w);
+            if (run < RLE_MIN_RUN) {
+                i += run;
+                continue;
+            }
+            putLiteral(p + literalStart, i - literalStart, out);
+            for (int left = run; left > 0; ) {
+                int n = min(left, RLE_MAX_TOKEN);
+                putU16(out, (uint16_t)(0x8000 | (n - 1)));
+                putU16(out, p[i]);
+                left -= n;
+            }
+            i += run;
+            literalStart = i;
+        }
+        putLiteral(p + literalStart, w - literalStart, out);
+    }
+};
+
+} // namespace qualia
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "image.hpp"
+#include "tile_compare.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace qualia {
+namespace simd {
+
+// RGBA8 to RGB565 conversion fused with the 90 degree rotation from the
+// landscape render texture to the portrait panel. The source is walked in
+// 8x8 blocks: eight 8-pixel row segments are converted, transposed in
+// registers and stored as eight 8-pixel output rows, so both sides are read
+// and written contiguously instead of one side a column at a time.
+//
+// src is srcW x srcH RGBA8 (sf::Image::getPixelsPtr()), dst is srcH x srcW:
+//   neg90 = false: dst(x, y) = src(y, srcH - 1 - x)
+//   neg90 = true:  dst(x, y) = src(srcW - 1 - y, x)
+// Strides are in pixels. A negative srcStride walks the source bottom up,
+// e.g. for glReadPixels rows; with a dstStride wider than srcH the result
+// can go straight into a sub-rect of a larger image.
+using RotateConvertFn = void (*)(const uint8_t* src, ptrdiff_t srcStride, int srcW, int srcH,
+                                 Pixel* dst, ptrdiff_t dstStride, bool neg90);
+
+enum class ConvertKernel {
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+inline const char* convertKernelName(ConvertKernel kernel) {
+    switch (kernel) {
+        case ConvertKernel::Scalar: return "scalar";
+        case ConvertKernel::SSE2:   return "sse2";
+        case ConvertKernel::AVX2:   return "avx2";
+        default:                    return "unknown";
+    }
+}
+
+inline Pixel rgbaToRgb565(const uint8_t* p) {
+    return rgb565(p[0], p[1], p[2]);
+}
+
+// Source pixel shown at dst(x, y)
+inline const uint8_t* rotatedSource(const uint8_t* src, ptrdiff_t srcStride, int srcW, int srcH,
+                                    int x, int y, bool neg90) {
+    int sx = neg90 ? srcW - 1 - y : y;
+    int sy = neg90 ? x : srcH - 1 - x;
+    return src + (sy * srcStride + sx) * 4;
+}
+
+// Pixels outside the 8x8 block grid (none for the panel's dimensions)
+inline void rotateConvertEdges(const uint8_t* src, ptrdiff_t srcStride, int srcW, int srcH,
+                               Pixel* dst, ptrdiff_t dstStride, bool neg90) {
+    const int dstW = srcH, dstH = srcW;
+    const int blockW = dstW & ~7, blockH = dstH & ~7;
+    for (int y = 0; y < dstH; ++y) {
+        for (int x = (y < blockH ? blockW : 0); x < dstW; ++x) {
+            dst[y * dstStride + x] = rgbaToRgb565(rotatedSource(src, srcStride, srcW, srcH, x, y, neg90));
+        }
+    }
+}
+
+// First pixel of source row segment i (8 pixels) of the block transposed
+// into dst block (x0, y0). Rows go to dst columns x0 + i; with neg90 the
+// segments run backwards along dst rows, so transposed rows are stored
+// bottom up.
+inline const uint8_t* blockRow(const uint8_t* src, ptrdiff_t srcStride, int srcW, int srcH,
+                               int x0, int y0, int i, bool neg90) {
+    int sy = neg90 ? x0 + i : srcH - 1 - x0 - i;
+    int sx = neg90 ? srcW - 8 - y0 : y0;
+    return src + (sy * srcStride + sx) * 4;
+}
+
+inline void rotateConvertScalar(const uint8_t* src, ptrdiff_t srcStride, int srcW, int srcH,
+                                Pixel* dst, ptrdiff_t dstStride, bool neg90) {
+    const int blockW = srcH & ~7, blockH = srcW & ~7;
+    for (int y0 = 0; y0 < blockH; y0 += 8) {
+        for (int x0 = 0; x0 < blockW; x0 += 8) {
+            const uint8_t* rows[8];
+            for (int i = 0; i < 8; ++i) rows[i] = blockRow(src, srcStride, srcW, srcH, x0, y0, i, neg90);
+            for (int j = 0; j < 8; ++j) {
+                Pixel* out = dst + (y0 + (neg90 ? 7 - j : j)) * dstStride + x0;
+                for (int i = 0; i < 8; ++i) out[i] = rgbaToRgb565(rows[i] + j * 4);
+            }
+        }
+    }
+    rotateConvertEdges(src, srcStride, srcW, srcH, dst, dstStride, neg90);
+}
+
+#ifdef QUALIA_SIMD_X86
+// 8x8 transpose of 16-bit lanes; row k of the result goes to dst row
+// (reverse ? 7 - k : k)
+inline void storeTransposed8x8(const __m128i r[8], Pixel* dst, ptrdiff_t dstStride, bool reverse) {
+    __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+    const __m128i c[8] = {
+        _mm_unpacklo_epi64(b0, b4), _mm_unpackhi_epi64(b0, b4),
+        _mm_unpacklo_epi64(b1, b5), _mm_unpackhi_epi64(b1, b5),
+        _mm_unpacklo_epi64(b2, b6), _mm_unpackhi_epi64(b2, b6),
+        _mm_unpacklo_epi64(b3, b7), _mm_unpackhi_epi64(b3, b7)
+    };
+    for (int k = 0; k < 8; ++k) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + (reverse ? 7 - k : k) * dstStride), c[k]);
+    }
+}
+
+// 4 RGBA pixels to RGB565 in the low half of each 32-bit lane
+inline __m128i rgbaToRgb565x4SSE2(__m128i v) {
+    __m128i r = _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xF8)), 8);
+    __m128i g = _mm_srli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xFC00)), 5);
+    __m128i b = _mm_srli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xF80000)), 19);
+    return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+inline __m128i rgbaToRgb565x8SSE2(const uint8_t* p) {
+    __m128i lo = rgbaToRgb565x4SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    __m128i hi = rgbaToRgb565x4SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16)));
+    // packs is signed: sign-extend the 16-bit values first so they survive
+    lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+    hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+    return _mm_packs_epi32(lo, hi);
+}
+
+inline void rotateConvertSSE2(const uint8_t* src, ptrdiff_t srcStride, int srcW, int srcH,
+                              Pixel* dst, ptrdiff_t dstStride, bool neg90) {
+    const int blockW = srcH & ~7, blockH = srcW & ~7;
+    __m128i rows[8];
+    for (int y0 = 0; y0 < blockH; y0 += 8) {
+        for (int x0 = 0; x0 < blockW; x0 += 8) {
+            for (int i = 0; i < 8; ++i) {
+                rows[i] = rgbaToRgb565x8SSE2(blockRow(src, srcStride, srcW, srcH, x0, y0, i, neg90));
+            }
+            storeTransposed8x8(rows, dst + y0 * dstStride + x0, dstStride, neg90);
+        }
+    }
+    rotateConvertEdges(src, srcStride, srcW, srcH, dst, dstStride, neg90);
+}
+
+// 8 RGBA pixels per 256-bit load, packed to one 128-bit row segment
+QUALIA_TARGET_AVX2
+inline __m128i rgbaToRgb565x8AVX2(const uint8_t* p) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i r = _mm256_slli_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0xF8)), 8);
+    __m256i g = _mm256_srli_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0xFC00)), 5);
+    __m256i b = _mm256_srli_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0xF80000)), 19);
+    __m256i c = _mm256_or_si256(_mm256_or_si256(r, g), b);
+    // Packs within 128-bit lanes, then gather the two useful quadwords
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(c, c), 0x08);
+    return _mm256_castsi256_si128(packed);
+}
+
+QUALIA_TARGET_AVX2
+inline void rotateConvertAVX2(const uint8_t* src, ptrdiff_t srcStride, int srcW, int srcH,
+                              Pixel* dst, ptrdiff_t dstStride, bool neg90) {
+    const int blockW = srcH & ~7, blockH = srcW & ~7;
+    __m128i rows[8];
+    for (int y0 = 0; y0 < blockH; y0 += 8) {
+        for (int x0 = 0; x0 < blockW; x0 += 8) {
+            for (int i = 0; i < 8; ++i) {
+                rows[i] = rgbaToRgb565x8AVX2(blockRow(src, srcStride, srcW, srcH, x0, y0, i, neg90));
+            }
+            storeTransposed8x8(rows, dst + y0 * dstStride + x0, dstStride, neg90);
+        }
+    }
+    rotateConvertEdges(src, srcStride, srcW, srcH, dst, dstStride, neg90);
+}
+#endif
+
+inline bool cpuSupports(ConvertKernel kernel) {
+    switch (kernel) {
+        case ConvertKernel::Scalar: return true;
+        case ConvertKernel::SSE2:   return cpuSupports(DiffKernel::SSE2);
+        case ConvertKernel::AVX2:   return cpuSupports(DiffKernel::AVX2);
+        default:                    return false;
+    }
+}
+
+inline RotateConvertFn getRotateConvert(ConvertKernel kernel) {
+    switch (kernel) {
+#ifdef QUALIA_SIMD_X86
+        case ConvertKernel::SSE2: return rotateConvertSSE2;
+        case ConvertKernel::AVX2: return rotateConvertAVX2;
+#endif
+        default: return rotateConvertScalar;
+    }
+}
+
+// Picks the fastest kernel the running CPU supports
+inline ConvertKernel detectConvertKernel() {
+    const ConvertKernel preferred[] = { ConvertKernel::AVX2, ConvertKernel::SSE2 };
+    for (ConvertKernel k : preferred) {
+        if (cpuSupports(k)) return k;
+    }
+    return ConvertKernel::Scalar;
+}
+
+} // namespace simd
+} // namespace qualia
@@ -2,6 +2,7 @@
 #include <toml++/toml.h>
 #include <windows.h>
 #include <string>
+#include <cctype>
 #include <filesystem>
 #include <iostream>
 #include <fstream>
@@ -45,6 +46,20 @@ public:
         bool autoMemFlash = false;
     };
 
+    // Streaming settings
+    struct StreamingConfig {
+        std::string changeDetection = "compare";  // compare, hash, hash_verify
+        bool rle = true;  // Run-length coded dirty rects (needs matching board firmware)
+        bool temporalDelta = true;  // XOR rects against the previous frame (needs rle)
+        bool tileCache = true;  // Reference tiles cached on the board (needs rle)
+        bool tileDedup = true;  // Solid tiles as fills, repeated tiles as copies (needs rle)
+        bool motionSearch = true;  // Send moved content as moves plus residual (needs temporal_delta)
+        int window = 0;  // Frames in flight before waiting for an ACK, 0 = auto (capped by the board's credits)
+        bool asyncReadback = true;  // Read the render texture through pixel buffers, one frame late
+        bool gpuPack = true;  // Rotate and pack to RGB565 in a shader before reading back
+        bool cpuRaster = false;  // Draw the frames sent on the CPU, straight into RGB565 (no render texture readback)
+    };
+
     struct TrainConfig {
         std::string apiKey;
         std::string stopId0;
@@ -56,6 +71,7 @@ public:
     // DisplayConfig display;
     NetworkConfig network;
     Preferences preferences;
+    StreamingConfig streaming;
     TrainConfig train;
     
     // Load settings from settings.toml in exe directory
@@ -110,6 +126,19 @@ public:
                 network.espDrive = (*networkTable)["esp_drive"].value_or("");
             }
 
+            if (auto streamingTable = config["streaming"].as_table()) {
+                streaming.changeDetection = (*streamingTable)["change_detection"].value_or("compare");
+                streaming.rle = (*streamingTable)["rle"].value_or(true);
+                streaming.temporalDelta = (*streamingTable)["temporal_delta"].value_or(true);
+                streaming.tileCache = (*streamingTable)["tile_cache"].value_or(true);
+                streaming.tileDedup = (*streamingTable)["tile_dedup"].value_or(true);
+                streaming.motionSearch = (*streamingTable)["motion_search"].value_or(true);
+                streaming.window = (*streamingTable)["window"].value_or(0);
+                streaming.asyncReadback = (*streamingTable)["async_readback"].value_or(true);
+                streaming.gpuPack = (*streamingTable)["gpu_pack"].value_or(true);
+                streaming.cpuRaster = (*streamingTable)["cpu_raster"].value_or(false);
+            }
+
             if (auto trainTable = config["train"].as_table()) {
                 train.apiKey = (*trainTable)["api_key"].value_or("");
                 train.stopId0 = (*trainTable)["stop_id_0"].value_or("");
@@ -169,6 +198,19 @@ public:
                 {"auto_mem_flash", preferences.autoMemFlash}
             });
 
+            config.insert_or_assign("streaming", toml::table{
+                {"change_detection", streaming.changeDetection},
+                {"rle", streaming.rle},
+                {"temporal_delta", streaming.temporalDelta},
+                {"tile_cache", streaming.tileCache},
+                {"tile_dedup", streaming.tileDedup},
+                {"motion_search", streaming.motionSearch},
+                {"window", streaming.window},
+                {"async_readback", streaming.asyncReadback},
+                {"gpu_pack", streaming.gpuPack},
+                {"cpu_raster", streaming.cpuRaster}
+            });
+
             config.insert_or_assign("train", toml::table{
                 {"api_key", train.apiKey},
                 {"stop_id_0", train.stopId0},
@@ -187,6 +229,15 @@ public:
             return false;
         }
     }
+
+    // Codec cost calibration of one board, next to the executable
+    std::filesystem::path getCalibrationPath(const std::string& boardIp) {
+        std::string name = boardIp;
+        for (char& c : name) {
+            if (!isalnum((unsigned char)c)) c = '_';
+        }
+        return getExeDirectory() / "calibration" / ("board_" + name + ".json");
+    }
     
 private:
     std::filesystem::path getExeDirectory() {
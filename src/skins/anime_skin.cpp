@@ -784,11 +784,15 @@ private:
     }
 
     // Internal draw implementation that takes explicit animation time and optional layer filtering
-    void drawWithTime(sf::RenderTexture& texture, SystemStats& stats, WeatherData& weather, TrainData& train, 
+    void drawWithTime(DrawTarget& target, SystemStats& stats, WeatherData& weather, TrainData& train, 
                       double animTime, FlashLayer skipLayers = FlashLayer::None, sf::Color bgColor = sf::Color::Black) {
         loadResources();
+        target.setResourceEpoch(damageEpoch);
 
-        texture.clear(bgColor);
+        target.clear(bgColor);
+        beginDrawSnapshot();
+        recordDrawElement(qualia::damageKey("clear"), qualia::DamageHasher().add(bgColor.toInteger()).value(),
+                          sf::FloatRect({0.0f, 0.0f}, {(float)DISPLAY_WIDTH, (float)DISPLAY_HEIGHT}));
 
         // Draw background
         bool skipBackground = hasLayer(skipLayers, FlashLayer::Background);
@@ -804,7 +808,8 @@ private:
                 (float)DISPLAY_WIDTH / texSize.x,
                 (float)DISPLAY_HEIGHT / texSize.y
             ));
-            texture.draw(bgSprite);
+            target.draw(bgSprite);
+            recordDrawElement(qualia::damageKey("background"), bgSprite);
         }
 
         // Draw character
@@ -838,7 +843,8 @@ private:
                     charSprite.setPosition(sf::Vector2f(posX, posY));
                 }
                 
-                texture.draw(charSprite);
+                target.draw(charSprite);
+                recordDrawElement(qualia::damageKey("character"), charSprite);
             }
         }
 
@@ -860,7 +866,8 @@ private:
                     weatherIconHeight / texSize.y
                 ));
                 weatherSprite.setPosition(sf::Vector2f(weatherIconX, weatherIconY));
-                texture.draw(weatherSprite);
+                target.draw(weatherSprite);
+                recordDrawElement(qualia::damageKey("weather_icon"), weatherSprite);
             }
         }
 
@@ -876,7 +883,8 @@ private:
                 sf::Text weatherText(*weatherFont, weatherStr, weatherTextSize);
                 weatherText.setPosition(sf::Vector2f(weatherTextX, weatherTextY));
                 applyFontStyle(weatherText, weatherTextFontIndex, &weatherTextColor);
-                texture.draw(weatherText);
+                target.draw(weatherText);
+                recordDrawElement(qualia::damageKey("weather_text"), weatherText);
             }
         }
 
@@ -889,7 +897,8 @@ private:
                 cpuUsageIconHeight / texSize.y
             ));
             iconSprite.setPosition(sf::Vector2f(cpuUsageIconX, cpuUsageIconY));
-            texture.draw(iconSprite);
+            target.draw(iconSprite);
+            recordDrawElement(qualia::damageKey("cpu_usage_icon"), iconSprite);
         }
 
         // Draw CPU usage text
@@ -906,14 +915,16 @@ private:
                         sf::Text cpuText(*hwmonFont, cpuStr, cpuUsageTextSize);
                         cpuText.setPosition(sf::Vector2f(cpuUsageTextX, cpuUsageTextY));
                         applyFontStyle(cpuText, hwmonTextFontIndex, &cpuUsageTextColor);
-                        texture.draw(cpuText);
+                        target.draw(cpuText);
+                        recordDrawElement(qualia::damageKey("cpu_text"), cpuText);
                         sf::Text cpuTempText(*hwmonFont, cpuTempStr, cpuUsageTextSize);
                         float cpuTextWidth = cpuCombinedFixedTextWidth;
                         cpuTextWidth += hwmonFont->getGlyph('%', cpuUsageTextSize, false).advance;
                         cpuTextWidth += hwmonFont->getGlyph('2', cpuUsageTextSize, false).advance * (stats.cpuPercent >= 10.0f ? (stats.cpuPercent >= 100.0f ? 3 : 2) : 1); // Account for extra digits if percent > 10 or 100
                         cpuTempText.setPosition(sf::Vector2f(cpuUsageTextX + cpuTextWidth, cpuUsageTextY)); // Position temp text after "CPU: XX%"
                         applyFontStyle(cpuTempText, hwmonTextFontIndex, &cpuUsageTextColor);
-                        texture.draw(cpuTempText);
+                        target.draw(cpuTempText);
+                        recordDrawElement(qualia::damageKey("cpu_temp_text"), cpuTempText);
                         goto Skip;
                     } else {
                         snprintf(cpuStr, sizeof(cpuStr), "%s%.0f%%%s%.0f\u00B0C", cpuUsageHeader.c_str(), stats.cpuPercent, cpuCombinedDivider.c_str(), stats.cpuTempC);
@@ -924,7 +935,8 @@ private:
                 sf::Text cpuText(*hwmonFont, cpuStr, cpuUsageTextSize);
                 cpuText.setPosition(sf::Vector2f(cpuUsageTextX, cpuUsageTextY));
                 applyFontStyle(cpuText, hwmonTextFontIndex, &cpuUsageTextColor);
-                texture.draw(cpuText);
+                target.draw(cpuText);
+                recordDrawElement(qualia::damageKey("cpu_text"), cpuText);
             }
         }
         Skip:
@@ -938,7 +950,8 @@ private:
                 cpuTempIconHeight / texSize.y
             ));
             iconSprite.setPosition(sf::Vector2f(cpuTempIconX, cpuTempIconY));
-            texture.draw(iconSprite);
+            target.draw(iconSprite);
+            recordDrawElement(qualia::damageKey("cpu_temp_icon"), iconSprite);
         }
 
         // Draw CPU temp text (only if not combined)
@@ -950,7 +963,8 @@ private:
                 sf::Text tempText(*hwmonFont, tempStr, cpuTempTextSize);
                 tempText.setPosition(sf::Vector2f(cpuTempTextX, cpuTempTextY));
                 applyFontStyle(tempText, hwmonTextFontIndex, &cpuTempTextColor);
-                texture.draw(tempText);
+                target.draw(tempText);
+                recordDrawElement(qualia::damageKey("temp_text"), tempText);
             }
         }
 
@@ -963,7 +977,8 @@ private:
                 memUsageIconHeight / texSize.y
             ));
             iconSprite.setPosition(sf::Vector2f(memUsageIconX, memUsageIconY));
-            texture.draw(iconSprite);
+            target.draw(iconSprite);
+            recordDrawElement(qualia::damageKey("mem_usage_icon"), iconSprite);
         }
 
         // Draw memory usage text
@@ -975,7 +990,8 @@ private:
                 sf::Text memText(*hwmonFont, memStr, memUsageTextSize);
                 memText.setPosition(sf::Vector2f(memUsageTextX, memUsageTextY));
                 applyFontStyle(memText, hwmonTextFontIndex, &memUsageTextColor);
-                texture.draw(memText);
+                target.draw(memText);
+                recordDrawElement(qualia::damageKey("mem_text"), memText);
             }
         }
 
@@ -988,7 +1004,8 @@ private:
                 trainNextIconHeight / texSize.y
             ));
             iconSprite.setPosition(sf::Vector2f(trainNextIconX, trainNextIconY));
-            texture.draw(iconSprite);
+            target.draw(iconSprite);
+            recordDrawElement(qualia::damageKey("train_icon"), iconSprite);
         }
 
         // Draw train text
@@ -1002,15 +1019,17 @@ private:
                 sf::Text trainText(*hwmonFont, trainStr, trainNextTextSize);
                 trainText.setPosition(sf::Vector2f(trainNextTextX, trainNextTextY));
                 applyFontStyle(trainText, hwmonTextFontIndex, &trainNextTextColor);
-                texture.draw(trainText);
+                target.draw(trainText);
+                recordDrawElement(qualia::damageKey("train_text"), trainText);
             }
         }
 
-        texture.display();
+        target.display();
         
         // Post-processing
-        if (jpegifyEffect.isEnabled()) {
-            jpegifyEffect.apply(texture);
+        if (jpegifyEffect.isEnabled() && target.renderTexture()) {
+            jpegifyEffect.apply(*target.renderTexture());
+            drawSnapshot.valid = false;  // Blocks mix across element bounds
         }
     }
 
@@ -1018,21 +1037,21 @@ public:
     AnimeSkin(std::string name, int width, int height) : Skin(name, width, height) {}
 
     // Original draw method - uses internal frame counter for backward compatibility
-    void draw(sf::RenderTexture& texture, SystemStats& stats, WeatherData& weather, TrainData& train) override {
+    void draw(DrawTarget& target, SystemStats& stats, WeatherData& weather, TrainData& train) override {
         double animTime = frameCount / 60.0;
-        drawWithTime(texture, stats, weather, train, animTime);
+        drawWithTime(target, stats, weather, train, animTime);
         frameCount++;
     }
 
     // Draw method with explicit animation time (for frame lock support)
-    void draw(sf::RenderTexture& texture, SystemStats& stats, WeatherData& weather, TrainData& train, double animationTime) override {
-        drawWithTime(texture, stats, weather, train, animationTime);
+    void draw(DrawTarget& target, SystemStats& stats, WeatherData& weather, TrainData& train, double animationTime) override {
+        drawWithTime(target, stats, weather, train, animationTime);
     }
     
     // Draw with flash mode support - renders only non-flashed layers
-    void drawForFlash(sf::RenderTexture& texture, SystemStats& stats, WeatherData& weather, TrainData& train, 
+    void drawForFlash(DrawTarget& target, SystemStats& stats, WeatherData& weather, TrainData& train, 
                       double animationTime, FlashLayer flashedLayers, sf::Color transparentColor) override {
-        drawWithTime(texture, stats, weather, train, animationTime, flashedLayers, transparentColor);
+        drawWithTime(target, stats, weather, train, animationTime, flashedLayers, transparentColor);
     }
     
     // Accessors for flash export
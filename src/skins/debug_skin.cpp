@@ -4,8 +4,9 @@ class DebugSkin : public Skin {
 public:
     DebugSkin(std::string name, int width, int height) : Skin(name, width, height) {}
 
-    void draw(sf::RenderTexture& texture, SystemStats& stats, WeatherData& weather, TrainData& train) override {
-        texture.clear(sf::Color::Black);
+    void draw(DrawTarget& target, SystemStats& stats, WeatherData& weather, TrainData& train) override {
+        target.setResourceEpoch(damageEpoch);
+        target.clear(sf::Color::Black);
         
         int y = 20;
         
@@ -13,28 +14,28 @@ public:
         sf::Text title(defaultFont, "SYSTEM MONITOR", 28);
         title.setPosition(sf::Vector2f(20, (float)y));
         title.setFillColor(sf::Color(100, 200, 255));
-        texture.draw(title);
+        target.draw(title);
         y += 50;
         
         // CPU section
         sf::Text cpuLabel(defaultFont, "CPU", 18);
         cpuLabel.setPosition(sf::Vector2f(20, (float)y));
         cpuLabel.setFillColor(sf::Color::White);
-        texture.draw(cpuLabel);
+        target.draw(cpuLabel);
         y += 30;
         
         // CPU bar background
         sf::RectangleShape cpuBarBg(sf::Vector2f((float)(400 - 40), 25));
         cpuBarBg.setPosition(sf::Vector2f(20, (float)y));
         cpuBarBg.setFillColor(sf::Color(0, 100, 0));
-        texture.draw(cpuBarBg);
+        target.draw(cpuBarBg);
         
         // CPU bar fill
         float cpuBarWidth = (400 - 40) * stats.cpuPercent / 100.0f;
         sf::RectangleShape cpuBarFill(sf::Vector2f(cpuBarWidth, 25));
         cpuBarFill.setPosition(sf::Vector2f(20, (float)y));
         cpuBarFill.setFillColor(sf::Color::Green);
-        texture.draw(cpuBarFill);
+        target.draw(cpuBarFill);
         
         // CPU percentage text
         char cpuText[32];
@@ -42,7 +43,7 @@ public:
         sf::Text cpuPct(defaultFont, cpuText, 18);
         cpuPct.setPosition(sf::Vector2f((float)(400 - 70), (float)(y + 2)));
         cpuPct.setFillColor(sf::Color::White);
-        texture.draw(cpuPct);
+        target.draw(cpuPct);
 
         // CPU temperature text
         char tempText[32];
@@ -50,28 +51,28 @@ public:
         sf::Text tempLabel(defaultFont, tempText, 14);
         tempLabel.setPosition(sf::Vector2f(20, (float)(y + 30)));
         tempLabel.setFillColor(sf::Color(150, 150, 150));
-        texture.draw(tempLabel);
+        target.draw(tempLabel);
         y += 45;
         
         // Memory section
         sf::Text memLabel(defaultFont, "MEMORY", 18);
         memLabel.setPosition(sf::Vector2f(20, (float)y));
         memLabel.setFillColor(sf::Color::White);
-        texture.draw(memLabel);
+        target.draw(memLabel);
         y += 30;
         
         // Memory bar background
         sf::RectangleShape memBarBg(sf::Vector2f((float)(400 - 40), 25));
         memBarBg.setPosition(sf::Vector2f(20, (float)y));
         memBarBg.setFillColor(sf::Color(0, 0, 100));
-        texture.draw(memBarBg);
+        target.draw(memBarBg);
         
         // Memory bar fill
         float memBarWidth = (400 - 40) * stats.memPercent / 100.0f;
         sf::RectangleShape memBarFill(sf::Vector2f(memBarWidth, 25));
         memBarFill.setPosition(sf::Vector2f(20, (float)y));
         memBarFill.setFillColor(sf::Color::Blue);
-        texture.draw(memBarFill);
+        target.draw(memBarFill);
         
         // Memory percentage text
         char memText[32];
@@ -79,7 +80,7 @@ public:
         sf::Text memPct(defaultFont, memText, 18);
         memPct.setPosition(sf::Vector2f((float)(400 - 70), (float)(y + 2)));
         memPct.setFillColor(sf::Color::White);
-        texture.draw(memPct);
+        target.draw(memPct);
         y += 35;
         
         // Memory usage text
@@ -90,14 +91,14 @@ public:
         sf::Text memUsageText(defaultFont, memUsage, 14);
         memUsageText.setPosition(sf::Vector2f(20, (float)y));
         memUsageText.setFillColor(sf::Color(150, 150, 150));
-        texture.draw(memUsageText);
+        target.draw(memUsageText);
 
         // Weather section
         y -= 140;
         sf::Text weatherLabel(defaultFont, "WEATHER", 18);
         weatherLabel.setPosition(sf::Vector2f(400, (float)y));
         weatherLabel.setFillColor(sf::Color::White);
-        texture.draw(weatherLabel);
+        target.draw(weatherLabel);
         y += 30;
 
         // Weather icon code 
@@ -107,14 +108,14 @@ public:
         sf::Text weatherInfo(defaultFont, weatherText, 14);
         weatherInfo.setPosition(sf::Vector2f(400, (float)y));
         weatherInfo.setFillColor(sf::Color(150, 150, 150));
-        texture.draw(weatherInfo);
+        target.draw(weatherInfo);
 
         // Train section
         y += 50;
         sf::Text trainLabel(defaultFont, "TRAIN", 18);
         trainLabel.setPosition(sf::Vector2f(400, (float)y));
         trainLabel.setFillColor(sf::Color::White);
-        texture.draw(trainLabel);
+        target.draw(trainLabel);
         y += 30;
 
         char trainText[128];
@@ -123,8 +124,8 @@ public:
         sf::Text trainInfo(defaultFont, trainText, 14);
         trainInfo.setPosition(sf::Vector2f(400, (float)y));
         trainInfo.setFillColor(sf::Color(150, 150, 150));
-        texture.draw(trainInfo);
+        target.draw(trainInfo);
         
-        texture.display();
+        target.display();
     }
 };
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "../canvas565.hpp"
+
+// What a skin draws into: a render texture, or the CPU rasterizer writing
+// straight into a panel frame. Skins build the same SFML drawables for
+// both and lay them out in render texture coordinates.
+class DrawTarget {
+public:
+    virtual ~DrawTarget() = default;
+
+    virtual void clear(sf::Color color) = 0;
+    virtual void draw(const sf::Sprite& sprite) = 0;
+    virtual void draw(const sf::Text& text) = 0;
+    virtual void draw(const sf::RectangleShape& shape) = 0;
+    virtual void display() {}
+
+    // Textures and fonts drawn from here on may have been reloaded at the
+    // same addresses if epoch differs from the last call's
+    virtual void setResourceEpoch(uint32_t epoch) {}
+
+    // The render texture behind the target, for effects that work on one
+    virtual sf::RenderTexture* renderTexture() { return nullptr; }
+};
+
+class TextureTarget : public DrawTarget {
+public:
+    explicit TextureTarget(sf::RenderTexture& texture) : texture_(texture) {}
+
+    void clear(sf::Color color) override { texture_.clear(color); }
+    void draw(const sf::Sprite& sprite) override { texture_.draw(sprite); }
+    void draw(const sf::Text& text) override { texture_.draw(text); }
+    void draw(const sf::RectangleShape& shape) override { texture_.draw(shape); }
+    void display() override { texture_.display(); }
+    sf::RenderTexture* renderTexture() override { return &texture_; }
+
+private:
+    sf::RenderTexture& texture_;
+};
+
+// Draws with qualia::Canvas565 into an RGB565 frame in panel orientation,
+// so the frame needs no readback or conversion.
+//
+// Texture pixels are copied out the first time a texture is drawn, and
+// glyphs the first time they're drawn at a size, from the page sf::Font
+// rasterized them into; GL is only touched then. Text is laid out like
+// sf::Text, regular or bold (no italics or underlines). Rects are filled
+// without outlines, and texture rects must have positive sizes.
+class CanvasTarget : public DrawTarget {
+public:
+    // Draw into frame, rotated like textureToRGB565Rot90 (neg90 = false) or
+    // textureToRGB565RotNeg90
+    void begin(qualia::Image& frame, bool neg90) { canvas_.begin(frame, neg90); }
+
+    void setResourceEpoch(uint32_t epoch) override {
+        if (epoch == epoch_) return;
+        epoch_ = epoch;
+        images_.clear();
+        glyphs_.clear();
+    }
+
+    void clear(sf::Color color) override { canvas_.clear(toRgba(color)); }
+
+    void draw(const sf::Sprite& sprite) override {
+        const sf::Image& image = imageOf(sprite.getTexture());
+        const sf::IntRect rect = sprite.getTextureRect();
+        const sf::Vector2i size(image.getSize());
+        const int x0 = std::max(rect.position.x, 0), y0 = std::max(rect.position.y, 0);
+        const int x1 = std::min(rect.position.x + rect.size.x, size.x);
+        const int y1 = std::min(rect.position.y + rect.size.y, size.y);
+        if (x0 >= x1 || y0 >= y1) return;
+
+        const qualia::Affine t = toAffine(sprite.getTransform(), sf::Vector2f((float)(x0 - rect.position.x),
+                                                                              (float)(y0 - rect.position.y)));
+        canvas_.blit(image.getPixelsPtr() + ((size_t)y0 * size.x + x0) * 4, size.x, x1 - x0, y1 - y0, t,
+                     toRgba(sprite.getColor()));
+    }
+
+    void draw(const sf::Text& text) override {
+        // Outlines all go under the fill, as sf::Text draws them
+        if (text.getOutlineThickness() != 0.0f) {
+            drawGlyphs(text, text.getOutlineThickness(), text.getOutlineColor());
+        }
+        drawGlyphs(text, 0.0f, text.getFillColor());
+    }
+
+    void draw(const sf::RectangleShape& shape) override {
+        canvas_.fill(toAffine(shape.getTransform()), shape.getSize().x, shape.getSize().y,
+                     toRgba(shape.getFillColor()));
+    }
+
+private:
+    // Pixels of one glyph, white with coverage in alpha like the font's page
+    struct GlyphPixels {
+        std::vector<uint8_t> rgba;
+        int width = 0;
+        int height = 0;
+    };
+    using GlyphKey = std::tuple<const sf::Font*, unsigned, bool, float, char32_t>;
+
+    qualia::Canvas565 canvas_;
+    uint32_t epoch_ = 0;
+    std::unordered_map<const sf::Texture*, sf::Image> images_;
+    std::map<GlyphKey, GlyphPixels> glyphs_;
+
+    static qualia::Rgba toRgba(sf::Color c) { return {c.r, c.g, c.b, c.a}; }
+
+    // offset: local position of the drawn pixels' top left corner
+    static qualia::Affine toAffine(const sf::Transform& transform, sf::Vector2f offset = {}) {
+        const float* m = transform.getMatrix();
+        qualia::Affine t;
+        t.a = m[0];
+        t.b = m[4];
+        t.tx = m[12] + m[0] * offset.x + m[4] * offset.y;
+        t.c = m[1];
+        t.d = m[5];
+        t.ty = m[13] + m[1] * offset.x + m[5] * offset.y;
+        return t;
+    }
+
+    const sf::Image& imageOf(const sf::Texture& texture) {
+        auto it = images_.find(&texture);
+        if (it == images_.end() || it->second.getSize() != texture.getSize()) {
+            it = images_.insert_or_assign(&texture, texture.copyToImage()).first;
+        }
+        return it->second;
+    }
+
+    // Copy glyph out of the font's page the first time it's drawn. page
+    // holds the page's pixels once copied.
+    const GlyphPixels& glyphPixels(const sf::Font& font, unsigned size, const GlyphKey& key, const sf::Glyph& glyph,
+                                   std::optional<sf::Image>& page) {
+        auto [it, inserted] = glyphs_.try_emplace(key);
+        if (inserted) {
+            if (!page) page = font.getTexture(size).copyToImage();
+            const sf::IntRect r = glyph.textureRect;
+            GlyphPixels& g = it->second;
+            g.width = std::max(std::min(r.size.x, (int)page->getSize().x - r.position.x), 0);
+            g.height = std::max(std::min(r.size.y, (int)page->getSize().y - r.position.y), 0);
+            g.rgba.resize((size_t)g.width * g.height * 4);
+            for (int y = 0; y < g.height; ++y) {
+                const uint8_t* src = page->getPixelsPtr() + ((size_t)(r.position.y + y) * page->getSize().x + r.position.x) * 4;
+                std::copy(src, src + (size_t)g.width * 4, g.rgba.begin() + (size_t)y * g.width * 4);
+            }
+        }
+        return it->second;
+    }
+
+    // One layer of text: outline glyphs (outline != 0) or fill glyphs,
+    // positioned as sf::Text lays them out
+    void drawGlyphs(const sf::Text& text, float outline, sf::Color color) {
+        const sf::Font& font = text.getFont();
+        const sf::String& string = text.getString();
+        const unsigned size = text.getCharacterSize();
+        const bool bold = (text.getStyle() & sf::Text::Bold) != 0;
+
+        // Rasterize the whole string first, so one page copy covers it
+        for (char32_t c : string) (void)font.getGlyph(c, size, bold, outline);
+        std::optional<sf::Image> page;
+
+        const qualia::Affine transform = toAffine(text.getTransform());
+        float whitespace = font.getGlyph(U' ', size, bold).advance;
+        const float letterSpacing = (whitespace / 3.0f) * (text.getLetterSpacing() - 1.0f);
+        whitespace += letterSpacing;
+        const float lineSpacing = font.getLineSpacing(size) * text.getLineSpacing();
+
+        float x = 0.0f;
+        float y = (float)size;
+        char32_t prev = 0;
+        for (char32_t c : string) {
+            if (c == U'\r') continue;
+            x += font.getKerning(prev, c, size, bold);
+            prev = c;
+
+            if (c == U' ' || c == U'\t' || c == U'\n') {
+                if (c == U' ') x += whitespace;
+                if (c == U'\t') x += whitespace * 4;
+                if (c == U'\n') {
+                    y += lineSpacing;
+                    x = 0.0f;
+                }
+                continue;
+            }
+
+            const sf::Glyph& glyph = font.getGlyph(c, size, bold, outline);
+            const GlyphPixels& pixels = glyphPixels(font, size, {&font, size, bold, outline, c}, glyph, page);
+            qualia::Affine t = transform;
+            const sf::Vector2f at(x + glyph.bounds.position.x, y + glyph.bounds.position.y);
+            t.tx += transform.a * at.x + transform.b * at.y;
+            t.ty += transform.c * at.x + transform.d * at.y;
+            canvas_.blit(pixels.rgba.data(), pixels.width, pixels.width, pixels.height, t, toRgba(color));
+
+            // Advance by the fill glyph, as sf::Text does for both layers
+            x += (outline != 0.0f ? font.getGlyph(c, size, bold).advance : glyph.advance) + letterSpacing;
+        }
+    }
+};
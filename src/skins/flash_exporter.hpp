@@ -62,7 +62,7 @@ struct FlashStatsMessage {
     
     uint8_t msgType = MSG_TYPE;
     uint8_t weatherIconIndex;  // 0-6, or 0xFF for none
-    uint8_t flags;             // bit0: cpu_warm, bit1: cpu_hot, bit2: weather_avail, bit3: train0_avail, bit4: train1_avail
+    uint8_t flags;             // bit0: cpu_warm, bit1: cpu_hot, bit2: weather_avail, bit3: train0_avail, bit4: train1_avail, bit5: rect_codecs, bit6: tile_ops
     uint16_t cpuPercent10;     // CPU percent * 10
     uint16_t cpuTemp10;        // CPU temp * 10
     uint16_t memPercent10;     // Memory percent * 10
@@ -76,6 +76,8 @@ struct FlashStatsMessage {
     static constexpr uint8_t FLAG_WEATHER_AVAIL = 0x04;
     static constexpr uint8_t FLAG_TRAIN0_AVAIL = 0x08;
     static constexpr uint8_t FLAG_TRAIN1_AVAIL = 0x10;
+    static constexpr uint8_t FLAG_RECT_CODECS = 0x20;   // Rect headers carry a codec byte (MSG_DIRTY_RECTS_RLE layout)
+    static constexpr uint8_t FLAG_TILE_OPS = 0x40;      // Tile op lists precede the rects (see dirty_rects.hpp)
     
     // Serialize to bytes (fixed 16-byte header)
     std::vector<uint8_t> serialize(uint8_t rectCount) const {
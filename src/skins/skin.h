@@ -4,6 +4,8 @@
 #include <string>
 #include <unordered_map>
 #include <filesystem>
+#include <algorithm>
+#include <cmath>
 
 #include "../log.hpp"
 #include "../system_stats.h"
@@ -11,6 +13,8 @@
 #include "../weather.hpp"
 #include "../train.hpp"
 #include "../utils/jpegify.hpp"
+#include "../damage.hpp"
+#include "draw_target.h"
 
 // Flash mode layer flags
 enum class FlashLayer : uint8_t {
@@ -90,6 +94,49 @@ protected:
     // Effects
     JpegifyEffect jpegifyEffect;
 
+    // Damage tracking: elements of the last draw, in texture coordinates
+    qualia::DamageSnapshot drawSnapshot;
+    uint32_t damageEpoch = 0;
+
+    void beginDrawSnapshot() {
+        drawSnapshot.elements.clear();
+        drawSnapshot.valid = true;
+        drawSnapshot.epoch = damageEpoch;
+        drawSnapshot.layout = 0;
+    }
+
+    // Record a drawn element by its global bounds. content should hash
+    // everything else that affects its pixels; draw order is mixed in here.
+    void recordDrawElement(uint32_t key, uint64_t content, const sf::FloatRect& bounds) {
+        // Round outward, with a pixel of slack for antialiasing
+        int x0 = std::clamp((int)std::floor(bounds.position.x) - 1, 0, DISPLAY_WIDTH);
+        int y0 = std::clamp((int)std::floor(bounds.position.y) - 1, 0, DISPLAY_HEIGHT);
+        int x1 = std::clamp((int)std::ceil(bounds.position.x + bounds.size.x) + 1, 0, DISPLAY_WIDTH);
+        int y1 = std::clamp((int)std::ceil(bounds.position.y + bounds.size.y) + 1, 0, DISPLAY_HEIGHT);
+        uint64_t ordered = qualia::DamageHasher().add(content).add(drawSnapshot.elements.size()).value();
+        drawSnapshot.elements.push_back({key, ordered,
+            {(uint16_t)x0, (uint16_t)y0, (uint16_t)(x1 - x0), (uint16_t)(y1 - y0)}});
+    }
+
+    void recordDrawElement(uint32_t key, const sf::Sprite& sprite) {
+        const sf::Transform& t = sprite.getTransform();
+        qualia::DamageHasher h;
+        h.add(&sprite.getTexture()).add(sprite.getTextureRect()).add(sprite.getColor().toInteger());
+        h.add(t.getMatrix(), 16 * sizeof(float));
+        recordDrawElement(key, h.value(), sprite.getGlobalBounds());
+    }
+
+    void recordDrawElement(uint32_t key, const sf::Text& text) {
+        const sf::Transform& t = text.getTransform();
+        qualia::DamageHasher h;
+        h.add(&text.getFont()).add(std::string_view((const char*)text.getString().getData(),
+                                                      text.getString().getSize() * sizeof(char32_t)));
+        h.add(text.getCharacterSize()).add(text.getFillColor().toInteger()).add(text.getOutlineColor().toInteger());
+        h.add(text.getOutlineThickness()).add(text.getStyle());
+        h.add(t.getMatrix(), 16 * sizeof(float));
+        recordDrawElement(key, h.value(), text.getGlobalBounds());
+    }
+
     // Helper to determine character temperature state
     CharacterTempState getCharacterTempState(float measure) const {
         if (measure >= hotThreshold) return CharacterTempState::Hot;
@@ -280,6 +327,8 @@ public:
         loadFlashConfig();
         loadFonts();
         loadEffectsConfig();
+        damageEpoch = qualia::newDamageEpoch();  // Resources reload on next draw
+        drawSnapshot.valid = false;
         parametersRefreshed = true;
         initialized = true;
         return 0;
@@ -329,6 +378,11 @@ public:
         }
     }
     
+    // Elements drawn by the last draw call, in texture coordinates. Diff two
+    // snapshots with qualia::diffDamageSnapshots to get the regions that may
+    // have changed between them. Invalid for skins that don't track damage.
+    const qualia::DamageSnapshot& getDrawSnapshot() const { return drawSnapshot; }
+
     // Get flash configuration
     const FlashConfig& getFlashConfig() const { return flashConfig; }
     FlashConfig& getFlashConfig() { return flashConfig; }
@@ -346,21 +400,42 @@ public:
     bool getThresholdsUsingPercentage() const { return thresholdsUsingPercentage; }
 
     // Original draw method - uses internal frame counter
-    virtual void draw(sf::RenderTexture& texture, SystemStats& stats, WeatherData& weather, TrainData& train) = 0;
+    virtual void draw(DrawTarget& target, SystemStats& stats, WeatherData& weather, TrainData& train) = 0;
 
     // Draw method with explicit animation time (for frame lock support)
     // Default implementation calls the original draw method for backward compatibility
-    virtual void draw(sf::RenderTexture& texture, SystemStats& stats, WeatherData& weather, TrainData& train, double animationTime) {
-        draw(texture, stats, weather, train);
+    virtual void draw(DrawTarget& target, SystemStats& stats, WeatherData& weather, TrainData& train, double animationTime) {
+        draw(target, stats, weather, train);
     }
     
     // Draw with flash mode support - renders only non-flashed layers
     // flashedLayers: which layers are handled by remote (skip rendering these)
     // transparentColor: color to use for areas that remote will fill
-    virtual void drawForFlash(sf::RenderTexture& texture, SystemStats& stats, WeatherData& weather, TrainData& train, 
+    virtual void drawForFlash(DrawTarget& target, SystemStats& stats, WeatherData& weather, TrainData& train, 
                               double animationTime, FlashLayer flashedLayers, sf::Color transparentColor) {
         // Default: just call normal draw (override in derived classes)
-        draw(texture, stats, weather, train, animationTime);
+        draw(target, stats, weather, train, animationTime);
+    }
+
+    // Whether the skin can draw to a CanvasTarget; effects that post-process
+    // the render texture need a TextureTarget
+    virtual bool supportsCanvas() const { return !jpegifyEffect.isEnabled(); }
+
+    // Render texture overloads of the above
+    void draw(sf::RenderTexture& texture, SystemStats& stats, WeatherData& weather, TrainData& train) {
+        TextureTarget target(texture);
+        draw(target, stats, weather, train);
+    }
+
+    void draw(sf::RenderTexture& texture, SystemStats& stats, WeatherData& weather, TrainData& train, double animationTime) {
+        TextureTarget target(texture);
+        draw(target, stats, weather, train, animationTime);
+    }
+
+    void drawForFlash(sf::RenderTexture& texture, SystemStats& stats, WeatherData& weather, TrainData& train,
+                      double animationTime, FlashLayer flashedLayers, sf::Color transparentColor) {
+        TextureTarget target(texture);
+        drawForFlash(target, stats, weather, train, animationTime, flashedLayers, transparentColor);
     }
 
     virtual ~Skin() = default;
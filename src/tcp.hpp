@@ -2,9 +2,11 @@
 
 #include <winsock2.h>
 #include <atomic>
+#include <chrono>
 
 #include "image.hpp"
 #include "dirty_rects.hpp"
+#include "packet.hpp"
 
 #include <ws2tcpip.h>
 
@@ -17,7 +19,7 @@ enum class ConnectionState {
 
 class TcpConnection {
 public:
-    TcpConnection() : sock_(INVALID_SOCKET) {
+    TcpConnection() {
         WSADATA wsaData;
         WSAStartup(MAKEWORD(2, 2), &wsaData);
     }
@@ -33,29 +35,28 @@ public:
         disconnect();
         cancelConnect_ = false;
         
-        sock_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-        if (sock_ == INVALID_SOCKET) return false;
+        // Built up locally and published once connected
+        SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (sock == INVALID_SOCKET) return false;
         
         // Set non-blocking mode for connect
         u_long mode = 1;
-        ioctlsocket(sock_, FIONBIO, &mode);
+        ioctlsocket(sock, FIONBIO, &mode);
         
         sockaddr_in serverAddr = {};
         serverAddr.sin_family = AF_INET;
         serverAddr.sin_port = htons(tcp_port);
         
         if (inet_pton(AF_INET, host.c_str(), &serverAddr.sin_addr) != 1) {
-            closesocket(sock_);
-            sock_ = INVALID_SOCKET;
+            closesocket(sock);
             return false;
         }
         
         // Start non-blocking connect
-        int result = ::connect(sock_, (sockaddr*)&serverAddr, sizeof(serverAddr));
+        int result = ::connect(sock, (sockaddr*)&serverAddr, sizeof(serverAddr));
         LOG_INFO << "Non-blocking connect returned, entering poll loop\n";
         if (result == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
-            closesocket(sock_);
-            sock_ = INVALID_SOCKET;
+            closesocket(sock);
             return false;
         }
         
@@ -66,38 +67,37 @@ public:
         
         while (elapsed < totalTimeoutMs) {
             if (cancelConnect_) {
-                closesocket(sock_);
-                sock_ = INVALID_SOCKET;
+                closesocket(sock);
                 return false;
             }
             
             fd_set writeSet, errorSet;
             FD_ZERO(&writeSet);
             FD_ZERO(&errorSet);
-            FD_SET(sock_, &writeSet);
-            FD_SET(sock_, &errorSet);
+            FD_SET(sock, &writeSet);
+            FD_SET(sock, &errorSet);
             
             timeval tv = { 0, pollIntervalMs * 1000 };
             result = select(0, nullptr, &writeSet, &errorSet, &tv);
             
             if (result > 0) {
-                if (FD_ISSET(sock_, &errorSet)) {
+                if (FD_ISSET(sock, &errorSet)) {
                     // Connection failed
-                    closesocket(sock_);
-                    sock_ = INVALID_SOCKET;
+                    closesocket(sock);
                     return false;
                 }
-                if (FD_ISSET(sock_, &writeSet)) {
+                if (FD_ISSET(sock, &writeSet)) {
                     // Connected! Set back to blocking mode
                     mode = 0;
-                    ioctlsocket(sock_, FIONBIO, &mode);
+                    ioctlsocket(sock, FIONBIO, &mode);
                     
                     // Set socket options
                     int flag = 1;
-                    setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(flag));
+                    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(flag));
                     int bufSize = 256 * 1024;
-                    setsockopt(sock_, SOL_SOCKET, SO_SNDBUF, (char*)&bufSize, sizeof(bufSize));
+                    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char*)&bufSize, sizeof(bufSize));
                     
+                    sock_ = sock;
                     return true;
                 }
             }
@@ -106,8 +106,7 @@ public:
         }
         
         // Timeout
-        closesocket(sock_);
-        sock_ = INVALID_SOCKET;
+        closesocket(sock);
         return false;
     }
 
@@ -115,10 +114,12 @@ public:
         cancelConnect_ = true;
     }
     
+    // Safe to call from several threads at once: only the caller that takes
+    // the socket closes it
     void disconnect() {
-        if (sock_ != INVALID_SOCKET) {
-            closesocket(sock_);
-            sock_ = INVALID_SOCKET;
+        SOCKET sock = sock_.exchange(INVALID_SOCKET);
+        if (sock != INVALID_SOCKET) {
+            closesocket(sock);
         }
     }
     
@@ -143,40 +144,101 @@ public:
         return true;
     }
     
+    // Send a packet's segments with WSASend, without flattening it first
+    bool sendGather(const qualia::GatherPacket& packet) {
+        if (!isConnected()) return false;
+
+        wsaBufs_.clear();
+        for (const auto& seg : packet.segments()) {
+            WSABUF buf;
+            buf.buf = reinterpret_cast<CHAR*>(const_cast<uint8_t*>(packet.segmentData(seg)));
+            buf.len = static_cast<ULONG>(seg.size);
+            wsaBufs_.push_back(buf);
+        }
+
+        size_t first = 0;
+        while (first < wsaBufs_.size()) {
+            // Keep each call's buffer count modest
+            DWORD count = static_cast<DWORD>(min(wsaBufs_.size() - first, (size_t)MAX_GATHER_BUFFERS));
+            DWORD sent = 0;
+            if (WSASend(sock_, &wsaBufs_[first], count, &sent, 0, nullptr, nullptr) == SOCKET_ERROR) {
+                disconnect();
+                return false;
+            }
+            // A blocking WSASend normally sends everything; resume after a partial send
+            while (first < wsaBufs_.size() && sent >= wsaBufs_[first].len) {
+                sent -= wsaBufs_[first].len;
+                first++;
+            }
+            if (sent > 0) {
+                wsaBufs_[first].buf += sent;
+                wsaBufs_[first].len -= sent;
+            }
+        }
+        return true;
+    }
+    
     bool sendFrame(const uint16_t* data, size_t pixelCount) {
         return sendPacket(reinterpret_cast<const uint8_t*>(data), pixelCount * 2);
     }
     
+    // Receive up to size bytes, waiting at most timeoutMs for any to arrive.
+    // The wait is a select, and recv only runs once the socket is readable,
+    // so a timeout leaves the socket as it was (unlike an SO_RCVTIMEO
+    // expiry). Returns the byte count, 0 on timeout, or -1 if the
+    // connection failed, in which case it is closed.
+    int receiveSome(void* data, size_t size, int timeoutMs) {
+        SOCKET sock = sock_;
+        if (sock == INVALID_SOCKET) return -1;
+
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(sock, &readSet);
+        timeval tv = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+        int result = select(0, &readSet, nullptr, nullptr, &tv);
+        if (result == 0) return 0;
+        if (result > 0) {
+            result = recv(sock, static_cast<char*>(data), static_cast<int>(size), 0);
+            if (result > 0) return result;
+        }
+        // Error, or closed by the remote
+        disconnect();
+        return -1;
+    }
+
+    // Receive exactly size bytes (with timeout). A timeout before the first
+    // byte leaves the connection open; anything else that fails closes it,
+    // since the stream can't be resynced.
+    bool receiveExact(void* data, size_t size, int timeoutMs) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        char* ptr = static_cast<char*>(data);
+        size_t received = 0;
+        while (received < size) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            int result = receiveSome(ptr + received, size - received, max(0, (int)left.count()));
+            if (result < 0) return false;
+            if (result == 0) {
+                if (received == 0) return false;  // Nothing arrived - don't disconnect
+                disconnect();
+                return false;
+            }
+            received += result;
+        }
+        return true;
+    }
+
     // Wait for ACK byte from remote (with timeout)
     // Returns true if ACK received, false on timeout or error
     bool waitForAck(int timeoutMs = 5000) {
-        if (!isConnected()) return false;
-        
-        // Set receive timeout
-        DWORD timeout = timeoutMs;
-        setsockopt(sock_, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
-        
         char ack;
-        int result = recv(sock_, &ack, 1, 0);
-        
-        if (result == 1) {
-            return true;  // ACK received
-        } else if (result == 0) {
-            // Connection closed
-            disconnect();
-            return false;
-        } else {
-            // Error or timeout
-            int err = WSAGetLastError();
-            if (err == WSAETIMEDOUT) {
-                return false;  // Timeout - don't disconnect
-            }
-            disconnect();
-            return false;
-        }
+        return receiveExact(&ack, 1, timeoutMs);
     }
     
 private:
-    SOCKET sock_;
+    static constexpr size_t MAX_GATHER_BUFFERS = 1024;
+
+    // The send and ACK stages both use the socket, and either may drop it
+    std::atomic<SOCKET> sock_{INVALID_SOCKET};
+    std::vector<WSABUF> wsaBufs_;  // Reused by sendGather
     std::atomic<bool> cancelConnect_{false};
 };
\ No newline at end of file
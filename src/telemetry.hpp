@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace qualia {
+
+// Frame pipeline stages, in the order a frame goes through them
+enum class Stage : uint8_t {
+    Render,    // Skin draw
+    Readback,  // GPU texture to CPU image
+    Convert,   // RGBA to rotated RGB565
+    Diff,      // Dirty detection
+    Encode,    // Packet building
+    Queue,     // Encoded, waiting for a window slot
+    Send,      // Socket send
+    Ack,       // Sent to ACKed
+    Count
+};
+
+constexpr int STAGE_COUNT = (int)Stage::Count;
+
+inline const char* stageName(Stage stage) {
+    switch (stage) {
+        case Stage::Render: return "render";
+        case Stage::Readback: return "readback";
+        case Stage::Convert: return "convert";
+        case Stage::Diff: return "diff";
+        case Stage::Encode: return "encode";
+        case Stage::Queue: return "queue";
+        case Stage::Send: return "send";
+        case Stage::Ack: return "ack";
+        case Stage::Count: break;
+    }
+    return "unknown";
+}
+
+// Log-linear histogram of microsecond durations, HDR style: exact below 16,
+// then 16 sub-buckets per power of two (at most ~6% error) up to 2^32.
+// Recording is one relaxed atomic increment, from any thread.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BUCKETS = 16;
+    static constexpr int BUCKETS = SUB_BUCKETS + (32 - 4) * SUB_BUCKETS;
+    using Counts = std::array<uint32_t, BUCKETS>;
+
+    void record(uint32_t us) {
+        buckets_[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void copyTo(Counts& counts) const {
+        for (int i = 0; i < BUCKETS; ++i) counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    }
+
+    static int bucketOf(uint32_t us) {
+        if (us < SUB_BUCKETS) return (int)us;
+        int e = std::bit_width(us) - 1;  // 4..31
+        return SUB_BUCKETS + (e - 4) * SUB_BUCKETS + (int)(us >> (e - 4)) - SUB_BUCKETS;
+    }
+
+    // Middle of the bucket's range
+    static float valueOf(int bucket) {
+        if (bucket < SUB_BUCKETS) return (float)bucket;
+        int e = (bucket - SUB_BUCKETS) / SUB_BUCKETS + 4;
+        float width = (float)(1u << (e - 4));
+        return (SUB_BUCKETS + (bucket - SUB_BUCKETS) % SUB_BUCKETS) * width + width * 0.5f;
+    }
+
+private:
+    std::array<std::atomic<uint32_t>, BUCKETS> buckets_{};
+};
+
+// Lock-free pipeline telemetry: a latency histogram per stage, plus the
+// delivered frame count. Writers record from any thread; readers take
+// snapshots, and subtract an earlier one for the figures of an interval.
+class Telemetry {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Snapshot {
+        Clock::time_point time;
+        uint64_t frames = 0;  // Delivered (ACKed) frames
+        std::array<LatencyHistogram::Counts, STAGE_COUNT> counts{};
+
+        // What was recorded between earlier and this one
+        Snapshot since(const Snapshot& earlier) const {
+            Snapshot d = *this;
+            d.frames -= earlier.frames;
+            for (int s = 0; s < STAGE_COUNT; ++s) {
+                for (int i = 0; i < LatencyHistogram::BUCKETS; ++i) d.counts[s][i] -= earlier.counts[s][i];
+            }
+            return d;
+        }
+
+        uint32_t count(Stage stage) const {
+            uint32_t n = 0;
+            for (uint32_t c : counts[(int)stage]) n += c;
+            return n;
+        }
+
+        // p in [0, 1]; 0 if nothing was recorded
+        float percentileMs(Stage stage, float p) const {
+            const auto& c = counts[(int)stage];
+            uint32_t n = count(stage);
+            if (n == 0) return 0;
+            uint32_t rank = max(1u, (uint32_t)(p * n + 0.5f));
+            uint32_t seen = 0;
+            for (int i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+                seen += c[i];
+                if (seen >= rank) return LatencyHistogram::valueOf(i) / 1000.0f;
+            }
+            return 0;
+        }
+
+        // "stage p50/p95/p99" for each stage with samples, in ms
+        std::string summary() const {
+            std::string out;
+            for (int s = 0; s < STAGE_COUNT; ++s) {
+                Stage stage = (Stage)s;
+                if (count(stage) == 0) continue;
+                char text[64];
+                snprintf(text, sizeof(text), "%s%s %.1f/%.1f/%.1f", out.empty() ? "" : ", ", stageName(stage),
+                         percentileMs(stage, 0.5f), percentileMs(stage, 0.95f), percentileMs(stage, 0.99f));
+                out += text;
+            }
+            return out;
+        }
+    };
+
+    void record(Stage stage, Clock::duration elapsed) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        stages_[(int)stage].record((uint32_t)std::clamp<int64_t>(us, 0, UINT32_MAX));
+    }
+
+    void record(Stage stage, Clock::time_point start, Clock::time_point end) {
+        record(stage, end - start);
+    }
+
+    // A frame was ACKed (one writer)
+    void noteFrameDelivered(Clock::time_point now) {
+        uint64_t n = frames_.load(std::memory_order_relaxed);
+        deliveredAt_[n % FPS_HISTORY].store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        frames_.store(n + 1, std::memory_order_release);
+    }
+
+    // Delivered frames per second over the last window frames
+    double fps(int window) const {
+        uint64_t n = frames_.load(std::memory_order_acquire);
+        uint64_t k = std::clamp<uint64_t>(window, 2, FPS_HISTORY - 1);
+        if (n < k) k = n;
+        if (k < 2) return 0.0;
+        Clock::rep latest = deliveredAt_[(n - 1) % FPS_HISTORY].load(std::memory_order_relaxed);
+        Clock::rep oldest = deliveredAt_[(n - k) % FPS_HISTORY].load(std::memory_order_relaxed);
+        double span = std::chrono::duration<double>(Clock::duration(latest - oldest)).count();
+        return span > 0.0 ? (k - 1) / span : 0.0;
+    }
+
+    Snapshot snapshot() const {
+        Snapshot s;
+        s.time = Clock::now();
+        s.frames = frames_.load(std::memory_order_acquire);
+        for (int i = 0; i < STAGE_COUNT; ++i) stages_[i].copyTo(s.counts[i]);
+        return s;
+    }
+
+private:
+    static constexpr uint64_t FPS_HISTORY = 64;
+
+    std::array<LatencyHistogram, STAGE_COUNT> stages_;
+    std::atomic<uint64_t> frames_{0};
+    std::array<std::atomic<Clock::rep>, FPS_HISTORY> deliveredAt_{};
+};
+
+// Records the time from construction to destruction as one stage
+class StageTimer {
+public:
+    StageTimer(Telemetry& telemetry, Stage stage)
+        : telemetry_(telemetry), stage_(stage), start_(Telemetry::Clock::now()) {}
+    ~StageTimer() { telemetry_.record(stage_, start_, Telemetry::Clock::now()); }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    Telemetry& telemetry_;
+    Stage stage_;
+    Telemetry::Clock::time_point start_;
+};
+
+} // namespace qualia
@@ -0,0 +1,120 @@
+# board_emulator.py - Stand-in for the board on a local TCP port, for
+# pipeline_throughput_test.cpp: decodes with esp32/network.py as the board
+# does, holds each ACK back to emulate the Wi-Fi round trip, and sleeps
+# after each message to emulate decode time. Prints per connection how many
+# messages it decoded and a CRC of the frame it ended with.
+#
+# Usage: python src/test/board_emulator.py [--port 8765] [--ack-delay-ms 30]
+#            [--decode-ms 5] [--legacy]
+# --legacy skips the caps message, like boards from before the handshake,
+# so the host falls back to stop-and-wait with plain ACKs.
+
+import argparse
+import heapq
+import os
+import socket
+import sys
+import threading
+import time
+import zlib
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'esp32'))
+import network
+
+FRAME_WIDTH = 240
+FRAME_HEIGHT = 960
+
+
+class DelayedLink:
+    """Socket wrapper whose sends go out ack_delay seconds later, in order."""
+
+    def __init__(self, sock, ack_delay):
+        self.sock = sock
+        self.ack_delay = ack_delay
+        self.queue = []
+        self.count = 0
+        self.closed = False
+        self.cv = threading.Condition()
+        threading.Thread(target=self.run, daemon=True).start()
+
+    def recv_into(self, mv):
+        return self.sock.recv_into(mv)
+
+    def send(self, data):
+        with self.cv:
+            heapq.heappush(self.queue, (time.monotonic() + self.ack_delay, self.count, bytes(data)))
+            self.count += 1
+            self.cv.notify()
+
+    def close(self):
+        with self.cv:
+            self.closed = True
+            self.cv.notify()
+
+    def run(self):
+        while True:
+            with self.cv:
+                while not self.queue and not self.closed:
+                    self.cv.wait()
+                if self.closed:
+                    return
+                due, _, data = self.queue[0]
+                now = time.monotonic()
+                if due > now:
+                    self.cv.wait(due - now)
+                    continue
+                heapq.heappop(self.queue)
+            try:
+                self.sock.sendall(data)
+            except OSError:
+                return
+
+
+def serve(conn, args, frame):
+    link = DelayedLink(conn, args.ack_delay_ms / 1000.0)
+    if args.legacy:
+        network.ack_window = 0
+        network.ack_seq = 0
+    else:
+        network.send_caps(link)
+
+    messages = 0
+    start = time.monotonic()
+    while True:
+        result = network.handle_frame_streaming(link)
+        if result is False:
+            break
+        messages += 1
+        time.sleep(args.decode_ms / 1000.0)
+    elapsed = time.monotonic() - start
+    link.close()
+    conn.close()
+    print(f'Disconnected: {messages} messages in {elapsed:.1f} s, frame crc {zlib.crc32(frame):08x}', flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Emulated board for throughput tests')
+    parser.add_argument('--port', type=int, default=8765)
+    parser.add_argument('--ack-delay-ms', type=float, default=30.0)
+    parser.add_argument('--decode-ms', type=float, default=5.0)
+    parser.add_argument('--legacy', action='store_true')
+    args = parser.parse_args()
+
+    # Frame and tile cache persist across connections, as on the board
+    frame = bytearray(FRAME_WIDTH * FRAME_HEIGHT * 2)
+    network.init_buffers(bytearray(256), memoryview(frame), None, FRAME_WIDTH, FRAME_HEIGHT)
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(('127.0.0.1', args.port))
+    server.listen(1)
+    print(f'Listening on 127.0.0.1:{args.port} (ACK delay {args.ack_delay_ms} ms, decode {args.decode_ms} ms'
+          f'{", legacy" if args.legacy else ""})', flush=True)
+    while True:
+        conn, _ = server.accept()
+        conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        serve(conn, args, frame)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,161 @@
+// canvas565_test.cpp
+// Golden image test for the CPU rasterizer (skins/draw_target.h): draws the
+// same scene of sprites, rects and text through a TextureTarget, read back
+// with TextureReadback, and through a CanvasTarget, and compares the two
+// panel frames for both rotations. Opaque pixels must match exactly;
+// blended ones may be off by one step per channel, as the canvas blends
+// against the RGB565 frame where the GPU has 8 bits. Mismatching frames
+// are saved as PNGs.
+//
+// Build (x64 Native Tools Command Prompt, SFML 3 and nlohmann json on the
+// include path):
+//   cl /EHsc /O2 /std:c++20 src/test/canvas565_test.cpp /Fe:canvas565_test.exe
+//      /link sfml-graphics.lib sfml-window.lib sfml-system.lib opengl32.lib
+// Text is drawn with C:\Windows\Fonts\arial.ttf, and skipped without it.
+
+#include <windows.h>
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <random>
+#include <string>
+
+#include "../utils/texture_readback.h"
+#include "../skins/draw_target.h"
+
+using namespace qualia;
+
+// Render texture dimensions: the panel on its side
+constexpr unsigned TEXTURE_WIDTH = DISPLAY_HEIGHT;
+constexpr unsigned TEXTURE_HEIGHT = DISPLAY_WIDTH;
+
+// Noise with a translucent band, so sprites exercise both blit paths
+static sf::Image makeSprite(sf::Vector2u size, uint32_t seed) {
+    sf::Image image(size);
+    std::mt19937 rng(seed);
+    for (unsigned y = 0; y < size.y; ++y) {
+        for (unsigned x = 0; x < size.x; ++x) {
+            uint8_t alpha = y < size.y / 2 ? 255 : (uint8_t)rng();
+            image.setPixel({x, y}, sf::Color((uint8_t)rng(), (uint8_t)rng(), (uint8_t)rng(), alpha));
+        }
+    }
+    return image;
+}
+
+struct Scene {
+    sf::Texture background;
+    sf::Texture sprite;
+    std::optional<sf::Font> font;
+};
+
+// Everything is placed on whole pixels and scaled by whole factors, so
+// pixel centers never land on an edge and both rasterizers cover the same
+// pixels
+static void drawScene(DrawTarget& target, const Scene& scene) {
+    target.clear(sf::Color(20, 40, 60));
+
+    sf::Sprite background(scene.background);
+    background.setScale({4.0f, 4.0f});
+    target.draw(background);
+
+    sf::Sprite plain(scene.sprite);
+    plain.setPosition({30.0f, 20.0f});
+    target.draw(plain);
+
+    sf::Sprite tinted(scene.sprite, sf::IntRect({8, 4}, {40, 50}));
+    tinted.setPosition({400.0f, 100.0f});
+    tinted.setScale({-2.0f, 2.0f});
+    tinted.setColor(sf::Color(255, 128, 64, 200));
+    target.draw(tinted);
+
+    sf::RectangleShape rect({300.0f, 90.0f});
+    rect.setPosition({500.0f, 30.0f});
+    rect.setFillColor(sf::Color(255, 255, 255, 128));
+    target.draw(rect);
+
+    if (scene.font) {
+        sf::Text text(*scene.font, "Sketchbook 12:34\nCPU 56%", 32);
+        text.setPosition({600.0f, 120.0f});
+        text.setFillColor(sf::Color(250, 220, 10));
+        text.setOutlineColor(sf::Color::Black);
+        text.setOutlineThickness(2.0f);
+        target.draw(text);
+    }
+    target.display();
+}
+
+static void savePanel(const Image& panel, const std::string& path) {
+    sf::Image image({(unsigned)panel.width, (unsigned)panel.height});
+    for (int y = 0; y < panel.height; ++y) {
+        for (int x = 0; x < panel.width; ++x) {
+            Pixel p = panel.pixels[y * panel.width + x];
+            image.setPixel({(unsigned)x, (unsigned)y}, sf::Color(rgb565_r(p), rgb565_g(p), rgb565_b(p)));
+        }
+    }
+    (void)image.saveToFile(path);
+}
+
+static int failures = 0;
+
+static void runCase(const Scene& scene, bool neg90) {
+    std::cout << "[" << (neg90 ? "rot-90" : "rot90") << "]\n";
+
+    sf::RenderTexture texture({TEXTURE_WIDTH, TEXTURE_HEIGHT});
+    TextureTarget textureTarget(texture);
+    drawScene(textureTarget, scene);
+    TextureReadback readback;
+    Image expected;
+    if (!readback.read(texture, DamageSnapshot{}, expected, neg90)) {
+        std::cout << "  no frame\n";
+        failures++;
+        return;
+    }
+
+    CanvasTarget canvasTarget;
+    Image frame;
+    canvasTarget.setResourceEpoch(newDamageEpoch());
+    canvasTarget.begin(frame, neg90);
+    drawScene(canvasTarget, scene);
+
+    int exact = 0, close = 0, wrong = 0;
+    for (size_t i = 0; i < expected.pixels.size(); ++i) {
+        Pixel a = frame.pixels[i], b = expected.pixels[i];
+        if (a == b) {
+            exact++;
+        } else if (std::abs((a >> 11) - (b >> 11)) <= 1 && std::abs(((a >> 5) & 0x3F) - ((b >> 5) & 0x3F)) <= 1 &&
+                   std::abs((a & 0x1F) - (b & 0x1F)) <= 1) {
+            close++;
+        } else {
+            wrong++;
+        }
+    }
+    std::cout << "  " << (wrong == 0 ? "ok" : "MISMATCH") << " (" << exact << " exact, " << close << " off by one, "
+              << wrong << " wrong)\n";
+    if (wrong > 0) {
+        failures++;
+        std::string name = neg90 ? "rotneg90" : "rot90";
+        savePanel(expected, "canvas565_golden_" + name + ".png");
+        savePanel(frame, "canvas565_actual_" + name + ".png");
+    }
+}
+
+int main() {
+    Scene scene;
+    if (!scene.background.loadFromImage(makeSprite({TEXTURE_WIDTH / 4, TEXTURE_HEIGHT / 4}, 1)) ||
+        !scene.sprite.loadFromImage(makeSprite({64, 96}, 2))) {
+        std::cout << "Couldn't create textures\n";
+        return 1;
+    }
+    scene.font.emplace();
+    if (!scene.font->openFromFile("C:\\Windows\\Fonts\\arial.ttf")) {
+        std::cout << "arial.ttf not found, skipping text\n";
+        scene.font.reset();
+    }
+
+    for (bool neg90 : {false, true}) {
+        runCase(scene, neg90);
+    }
+    std::cout << (failures == 0 ? "PASS" : "FAIL") << "\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+# codec_replay.py - Replay packets recorded by codec_replay_test.cpp
+# through esp32/network.py, as the board decodes them, and check each
+# decoded frame against the CRC of the frame the host encoded.
+#
+# Usage: python src/test/codec_replay.py codec_replay_<config>.bin ...
+
+import os
+import struct
+import sys
+import zlib
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'esp32'))
+import network
+
+FRAME_WIDTH = 240
+FRAME_HEIGHT = 960
+
+
+class ReplayClient:
+    """Socket stand-in that hands out one packet in uneven chunks, like TCP segments."""
+
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+        self.sent = bytearray()
+        self.chunk = 1
+
+    def recv_into(self, mv):
+        self.chunk = self.chunk * 7 % 1453 + 1
+        n = min(len(mv), len(self.data) - self.pos, self.chunk)
+        mv[:n] = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return n
+
+    def send(self, data):
+        self.sent += data
+
+
+CODEC_NAMES = {network.CODEC_RAW: 'raw', network.CODEC_RLE: 'rle', network.CODEC_XOR_RLE: 'xor',
+               network.CODEC_FILL: 'fill', network.CODEC_MOVE: 'move'}
+
+
+def count_codecs(packet, counts):
+    """Tally the tile ops and rect codecs in a coded rect message."""
+    pos = 1
+    if packet[0] == network.MSG_TILE_OPS:
+        for name in ('tile ref', 'tile fill', 'tile copy', 'tile store'):
+            n = packet[pos] | (packet[pos + 1] << 8)
+            counts[name] = counts.get(name, 0) + n
+            pos += 2 + n * 4
+    elif packet[0] != network.MSG_DIRTY_RECTS_RLE:
+        return
+    for i in range(packet[pos]):
+        name = CODEC_NAMES.get(packet[pos + 1 + i * 9 + 8], 'unknown')
+        counts[name] = counts.get(name, 0) + 1
+
+
+def replay(path):
+    """Decode every recorded packet; returns the number of bad frames."""
+    with open(path, 'rb') as f:
+        recording = f.read()
+
+    frame = bytearray(FRAME_WIDTH * FRAME_HEIGHT * 2)
+    network.init_buffers(bytearray(256), memoryview(frame), None, FRAME_WIDTH, FRAME_HEIGHT)
+    network.send_caps(ReplayClient(b''))  # Plain ACKs, as on a new connection
+
+    counts = {}
+    bad = 0
+    first_bad = None
+    pos = 0
+    index = 0
+    while pos < len(recording):
+        size = struct.unpack_from('<I', recording, pos)[0]
+        packet = recording[pos + 4:pos + 4 + size]
+        crc = struct.unpack_from('<I', recording, pos + 4 + size)[0]
+        pos += size + 8
+
+        client = ReplayClient(packet)
+        ok = network.handle_frame_streaming(client) is True
+        ok = ok and client.pos == len(packet) and len(client.sent) == 1
+        ok = ok and zlib.crc32(frame) == crc
+        count_codecs(packet, counts)
+        if not ok:
+            bad += 1
+            if first_bad is None:
+                first_bad = index
+        index += 1
+
+    used = ', '.join(f'{name} {n}' for name, n in sorted(counts.items()))
+    status = 'ok' if bad == 0 else f'MISMATCH from frame {first_bad}'
+    print(f'  {os.path.basename(path)}: {status} ({bad} of {index} bad)')
+    print(f'    {used or "raw rects only"}')
+    return bad
+
+
+def main():
+    if len(sys.argv) < 2:
+        print('Usage: python codec_replay.py codec_replay_<config>.bin ...')
+        return 2
+    failures = sum(1 for path in sys.argv[1:] if replay(path) > 0)
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,200 @@
+// codec_replay_test.cpp
+// End to end check of the streaming codecs against the board's decoder:
+// encodes a synthetic animation with DirtyRectTracker::buildPacket in each
+// codec configuration (raw, RLE, XOR delta, move, tile cache, fills and
+// copies), records the packets with a CRC of each source frame, then runs
+// codec_replay.py to feed them through esp32/network.py's
+// handle_frame_streaming and compare each decoded frame.
+//
+// The XOR, move and tile codecs code against the host's mirror of the
+// board's frame and tile cache; if those drift from what network.py
+// decodes, the panel stays corrupted without any error, so this is the
+// only thing that catches it.
+//
+// Build (x64 Native Tools Command Prompt, nlohmann json on the include path):
+//   cl /EHsc /O2 /std:c++20 src/test/codec_replay_test.cpp /Fe:codec_replay_test.exe
+// Run from the repository root, with Python 3 on the path:
+//   codec_replay_test.exe [python command]
+
+#include <windows.h>
+#include <iostream>
+#include <fstream>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../dirty_rects.hpp"
+
+using namespace qualia;
+
+constexpr int FRAMES = 300;
+
+// zlib's CRC-32, which codec_replay.py checks with zlib.crc32
+static uint32_t crc32(const uint8_t* data, size_t size) {
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+struct Config {
+    const char* name;
+    bool rle, temporalDelta, motionSearch, tileCache, tileDedup, motionHints;
+};
+
+static const Config CONFIGS[] = {
+    {"raw", false, false, false, false, false, false},
+    {"rle", true, false, false, false, false, false},
+    {"xor", true, true, false, false, false, false},
+    {"move", true, true, true, false, false, false},
+    {"move_hints", true, true, true, false, false, true},
+    {"tile_cache", true, false, false, true, false, false},
+    {"tile_dedup", true, true, false, false, true, false},
+    {"all", true, true, true, true, true, true},
+};
+
+// Sprites and loop frames, shared by every configuration so they all
+// encode the same animation
+struct Scene {
+    std::vector<Pixel> sprite;                 // 72x96, flat with speckles
+    std::vector<std::vector<Pixel>> loop;      // 64x64 frames of a looping animation
+    Pixel motif[16 * 16];                      // Repeated across a strip
+
+    Scene() {
+        std::mt19937 rng(7);
+        sprite.resize(72 * 96);
+        for (auto& p : sprite) p = rng() % 8 == 0 ? (Pixel)rng() : (Pixel)0x4208;
+        loop.resize(6);
+        for (auto& f : loop) {
+            f.resize(64 * 64);
+            for (auto& p : f) p = (Pixel)rng();
+        }
+        for (auto& p : motif) p = (Pixel)rng();
+    }
+};
+
+// Frame n: banded background that changes wholesale every 100 frames, a bobbing
+// sprite, a tile aligned loop, a solid panel changing color, a strip of a
+// repeated motif, a noise patch, sparse flips over a noise texture and a
+// counter that only changes some frames
+static void drawFrame(const Scene& scene, int n, Image& f, MotionHint& hint) {
+    const int era = n / 100;
+    for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
+        for (int x = 0; x < DISPLAY_WIDTH; ++x) {
+            f.at(x, y) = x % 60 == 0 ? (Pixel)0xFFFF : (Pixel)((y / 32 + 1) * (0x0841 + era * 0x1000));
+        }
+    }
+
+    auto bob = [](int i) { return (int)std::lround(12.0 * std::sin(i * 0.4)); };
+    const int sx = 40 + bob(n), sy = 300 + bob(n + 3);
+    for (int y = 0; y < 96; ++y) {
+        for (int x = 0; x < 72; ++x) f.at(sx + x, sy + y) = scene.sprite[y * 72 + x];
+    }
+    hint = {{(uint16_t)sx, (uint16_t)sy, 72, 96}, bob(n) - bob(n - 1), bob(n + 3) - bob(n + 2)};
+
+    const std::vector<Pixel>& loopFrame = scene.loop[n % scene.loop.size()];
+    for (int y = 0; y < 64; ++y) {
+        for (int x = 0; x < 64; ++x) f.at(128 + x, 96 + y) = loopFrame[y * 64 + x];
+    }
+
+    const Pixel panel = (Pixel)(0x1234 * (n / 10 + 1));
+    for (int y = 608; y < 656; ++y) {
+        for (int x = 0; x < DISPLAY_WIDTH; ++x) f.at(x, y) = panel;
+    }
+
+    const int shift = n % 16;
+    for (int y = 704; y < 736; ++y) {
+        for (int x = 0; x < 128; ++x) f.at(x, y) = scene.motif[((y + shift) % 16) * 16 + x % 16];
+    }
+
+    std::mt19937 noise(n);
+    for (int y = 800; y < 830; ++y) {
+        for (int x = 200; x < 220; ++x) f.at(x, y) = (Pixel)noise();
+    }
+
+    // Busy content with a few pixels changing, where only XOR pays off
+    std::mt19937 texture(1);
+    for (int y = 460; y < 508; ++y) {
+        for (int x = 150; x < 214; ++x) {
+            Pixel p = (Pixel)texture();
+            f.at(x, y) = (x * 7 + y * 13 + n) % 23 == 0 ? (Pixel)~p : p;
+        }
+    }
+
+    const int counter = n / 3;
+    for (int y = 880; y < 900; ++y) {
+        for (int x = 20; x < 180; ++x) f.at(x, y) = ((x / 8 + counter) * 7 + y / 5) % 3 ? 0xFFFF : 0x0000;
+    }
+}
+
+// Cost model for a slow link, so the codecs that save bytes win often
+// enough to be exercised; the default one mostly sends raw rects
+static const char* COSTS_PATH = "codec_replay_costs.json";
+static const char* COSTS = R"({"wire_us_per_byte": 8.0, "message_us": 3000.0})";
+
+// Per frame: packet size (uint32 LE), packet, CRC-32 of the frame's pixels
+// (uint32 LE)
+static bool record(const Scene& scene, const Config& config, const std::string& path) {
+    DirtyRectTracker tracker;
+    if (!tracker.getCodecCosts().load(COSTS_PATH)) return false;
+    tracker.setRleEnabled(config.rle);
+    tracker.setTemporalDelta(config.temporalDelta);
+    tracker.setMotionSearch(config.motionSearch);
+    tracker.setTileCache(config.tileCache);
+    tracker.setTileDedup(config.tileDedup);
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    Image frame(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    GatherPacket packet;
+    size_t bytes = 0;
+    for (int n = 0; n < FRAMES; ++n) {
+        MotionHint hint;
+        drawFrame(scene, n, frame, hint);
+        if (config.motionHints) tracker.setMotionHints({hint});
+        auto rects = tracker.findDirtyRects(frame);
+        tracker.buildPacket(frame, rects, packet);
+
+        std::vector<uint8_t> data = packet.flatten();
+        uint32_t size = (uint32_t)data.size();
+        uint32_t crc = crc32(frame.data(), frame.dataSize());
+        out.write(reinterpret_cast<const char*>(&size), 4);
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        out.write(reinterpret_cast<const char*>(&crc), 4);
+        bytes += data.size();
+    }
+    std::cout << "  " << config.name << ": " << FRAMES << " frames, " << bytes / FRAMES << " bytes/frame\n";
+    return (bool)out;
+}
+
+int main(int argc, char* argv[]) {
+    const std::string python = argc > 1 ? argv[1] : "python";
+    Scene scene;
+
+    std::ofstream(COSTS_PATH) << COSTS;
+    std::cout << "Recording\n";
+    std::string command = python + " src/test/codec_replay.py";
+    for (const Config& config : CONFIGS) {
+        std::string path = std::string("codec_replay_") + config.name + ".bin";
+        if (!record(scene, config, path)) {
+            std::cout << "Couldn't write " << path << "\n";
+            return 1;
+        }
+        command += " " + path;
+    }
+
+    std::cout << "Replaying through esp32/network.py\n" << std::flush;
+    int result = std::system(command.c_str());
+    std::cout << (result == 0 ? "PASS" : "FAIL") << "\n";
+    return result == 0 ? 0 : 1;
+}
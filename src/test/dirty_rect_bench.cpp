@@ -0,0 +1,173 @@
+// dirty_rect_bench.cpp
+// Microbenchmark for the dirty rect tile comparison kernels
+// Compares the original per-pixel Image::at() sweep against each SIMD kernel,
+// then times findDirtyRects on scattered 4x4 leaves, which stresses planRects
+//
+// Build (x64 Native Tools Command Prompt):
+//   cl /EHsc /O2 /std:c++20 src/test/dirty_rect_bench.cpp /Fe:dirty_rect_bench.exe
+
+#include <windows.h>
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "../dirty_rects.hpp"
+
+using namespace qualia;
+
+// Original implementation of DirtyRectTracker::isTileDirty
+static bool isTileDirtyReference(const Image& current, const Image& prev, int tx, int ty) {
+    int startX = tx * TILE_WIDTH;
+    int startY = ty * TILE_HEIGHT;
+    int endX = min(startX + TILE_WIDTH, DISPLAY_WIDTH);
+    int endY = min(startY + TILE_HEIGHT, DISPLAY_HEIGHT);
+
+    for (int y = startY; y < endY; ++y) {
+        for (int x = startX; x < endX; ++x) {
+            if (current.at(x, y) != prev.at(x, y)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static int sweepReference(const Image& current, const Image& prev) {
+    int dirty = 0;
+    for (int ty = 0; ty < TILES_Y; ++ty) {
+        for (int tx = 0; tx < TILES_X; ++tx) {
+            if (isTileDirtyReference(current, prev, tx, ty)) dirty++;
+        }
+    }
+    return dirty;
+}
+
+static int sweepKernel(const Image& current, const Image& prev, simd::TileDiffFn fn) {
+    int dirty = 0;
+    for (int ty = 0; ty < TILES_Y; ++ty) {
+        for (int tx = 0; tx < TILES_X; ++tx) {
+            int startX = tx * TILE_WIDTH;
+            int startY = ty * TILE_HEIGHT;
+            int w = min(TILE_WIDTH, DISPLAY_WIDTH - startX);
+            int h = min(TILE_HEIGHT, DISPLAY_HEIGHT - startY);
+            size_t offset = (size_t)startY * DISPLAY_WIDTH + startX;
+            if (fn(current.pixels.data() + offset, prev.pixels.data() + offset, DISPLAY_WIDTH, w, h)) dirty++;
+        }
+    }
+    return dirty;
+}
+
+template <typename F>
+static double timeIt(int iterations, F&& f, int& result) {
+    // Warm up caches
+    result = f();
+    volatile int sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        sink = f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    (void)sink;
+    return std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+}
+
+static void runCase(const char* name, const Image& currentFrame, const Image& prevFrame, int iterations) {
+    std::cout << "\n[" << name << "]\n";
+
+    // Read the frames through volatile pointers so the sweep can't be hoisted out of the timing loop
+    const Image* volatile currentPtr = &currentFrame;
+    const Image* volatile prevPtr = &prevFrame;
+    auto current = [&]() -> const Image& { return *currentPtr; };
+    auto prev = [&]() -> const Image& { return *prevPtr; };
+
+    int refDirty = 0;
+    double refUs = timeIt(iterations, [&] { return sweepReference(current(), prev()); }, refDirty);
+    std::cout << "  reference (at)   " << refUs << " us/frame, " << refDirty << " dirty tiles\n";
+
+    const simd::DiffKernel kernels[] = {
+        simd::DiffKernel::Scalar, simd::DiffKernel::SSE2, simd::DiffKernel::NEON, simd::DiffKernel::AVX2
+    };
+    for (simd::DiffKernel k : kernels) {
+        if (!simd::cpuSupports(k)) continue;
+        int dirty = 0;
+        double us = timeIt(iterations, [&] { return sweepKernel(current(), prev(), simd::getTileDiff(k)); }, dirty);
+        std::cout << "  " << simd::diffKernelName(k) << std::string(17 - strlen(simd::diffKernelName(k)), ' ')
+                  << us << " us/frame, " << dirty << " dirty tiles, "
+                  << (us > 0.0 ? refUs / us : 0.0) << "x"
+                  << (dirty != refDirty ? "  MISMATCH" : "") << "\n";
+    }
+}
+
+// One changed pixel every spacing px over a frame that was quiet, so every
+// block resolves to 4x4 leaves and planRects gets thousands of rects
+static void runPlanCase(int spacing, const Image& prev, int iterations) {
+    Image scattered = prev;
+    for (int y = spacing / 2; y < DISPLAY_HEIGHT; y += spacing) {
+        for (int x = spacing / 2; x < DISPLAY_WIDTH; x += spacing) scattered.at(x, y) ^= 0xFFFF;
+    }
+
+    double totalUs = 0.0;
+    double worstUs = 0.0;
+    size_t rects = 0;
+    for (int i = 0; i < iterations; ++i) {
+        // A new tracker each time: the first frame sets the reference, and
+        // leaf activity starts quiet
+        DirtyRectTracker tracker;
+        tracker.findDirtyRects(prev);
+        auto start = std::chrono::steady_clock::now();
+        rects = tracker.findDirtyRects(scattered).size();
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        totalUs += us;
+        worstUs = max(worstUs, us);
+    }
+    const int leaves = ((DISPLAY_WIDTH + spacing / 2) / spacing) * ((DISPLAY_HEIGHT + spacing / 2) / spacing);
+    std::cout << "  every " << spacing << " px" << std::string(spacing < 10 ? 3 : 2, ' ') << (int)(totalUs / iterations)
+              << " us/frame (worst " << (int)worstUs << "), " << leaves << " leaves, " << rects << " rects\n";
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = (argc >= 2) ? atoi(argv[1]) : 500;
+    if (iterations <= 0) iterations = 500;
+
+    std::cout << "Tile diff benchmark: " << DISPLAY_WIDTH << "x" << DISPLAY_HEIGHT << ", "
+              << TILES_X * TILES_Y << " tiles, " << iterations << " iterations\n";
+    std::cout << "Detected kernel: " << simd::diffKernelName(simd::detectDiffKernel()) << "\n";
+
+    std::mt19937 rng(1234);
+    Image prev(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    for (auto& p : prev.pixels) p = (Pixel)rng();
+
+    // Fully static: identical frames, every tile must be scanned to the end
+    Image staticFrame = prev;
+    runCase("static", staticFrame, prev, iterations);
+
+    // Sparse: a few text-sized changes, most tiles still scanned fully
+    Image sparse = prev;
+    for (int i = 0; i < 12; ++i) {
+        int x = rng() % (DISPLAY_WIDTH - 8);
+        int y = rng() % (DISPLAY_HEIGHT - 12);
+        sparse.fillRect(x, y, 8, 12, (Pixel)rng());
+    }
+    runCase("sparse", sparse, prev, iterations);
+
+    // Fully dirty: the last pixel of every tile differs (worst case for early exit)
+    Image dirty = prev;
+    for (int ty = 0; ty < TILES_Y; ++ty) {
+        for (int tx = 0; tx < TILES_X; ++tx) {
+            int x = min((tx + 1) * TILE_WIDTH, DISPLAY_WIDTH) - 1;
+            int y = min((ty + 1) * TILE_HEIGHT, DISPLAY_HEIGHT) - 1;
+            dirty.at(x, y) ^= 0xFFFF;
+        }
+    }
+    runCase("fully dirty", dirty, prev, iterations);
+
+    std::cout << "\n[scattered leaves, findDirtyRects]\n";
+    for (int spacing : {8, 12, 16, 32}) {
+        runPlanCase(spacing, prev, max(1, iterations / 50));
+    }
+
+    return 0;
+}
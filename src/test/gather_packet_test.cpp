@@ -0,0 +1,154 @@
+// gather_packet_test.cpp
+// Checks that GatherPacket (packet.hpp) sends the same bytes as the
+// contiguous packet builder it replaced: DirtyRectTracker::buildPacket's
+// flattened packets against the old builder for random frames, and random
+// mixes of copied and referenced segments against a plain byte vector.
+//
+// Build (x64 Native Tools Command Prompt, nlohmann json on the include path):
+//   cl /EHsc /O2 /std:c++20 src/test/gather_packet_test.cpp /Fe:gather_packet_test.exe
+
+#include <windows.h>
+#include <iostream>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "../dirty_rects.hpp"
+
+using namespace qualia;
+
+// The builder GatherPacket replaced: headers and pixels pushed into one vector
+static void appendU16(std::vector<uint8_t>& packet, uint16_t val) {
+    packet.push_back(val & 0xFF);
+    packet.push_back((val >> 8) & 0xFF);
+}
+
+static std::vector<uint8_t> buildPacketReference(const Image& frame, const std::vector<DirtyRect>& rects) {
+    std::vector<uint8_t> packet;
+    if (rects.empty()) {
+        packet.push_back(MSG_NO_CHANGE);
+        return packet;
+    }
+    bool isFullFrame = (rects.size() == 1 && rects[0].x == 0 && rects[0].y == 0 &&
+                        rects[0].w == DISPLAY_WIDTH && rects[0].h == DISPLAY_HEIGHT);
+    if (isFullFrame) {
+        packet.push_back(MSG_FULL_FRAME);
+        const uint8_t* data = frame.data();
+        packet.insert(packet.end(), data, data + frame.dataSize());
+        return packet;
+    }
+    packet.push_back(MSG_DIRTY_RECTS);
+    packet.push_back(static_cast<uint8_t>(rects.size()));
+    for (const auto& rect : rects) {
+        appendU16(packet, rect.x);
+        appendU16(packet, rect.y);
+        appendU16(packet, rect.w);
+        appendU16(packet, rect.h);
+    }
+    for (const auto& rect : rects) {
+        for (int y = rect.y; y < rect.y + rect.h; ++y) {
+            for (int x = rect.x; x < rect.x + rect.w; ++x) {
+                Pixel p = frame.at(x, y);
+                packet.push_back(p & 0xFF);
+                packet.push_back((p >> 8) & 0xFF);
+            }
+        }
+    }
+    return packet;
+}
+
+static int failures = 0;
+
+static void check(const char* name, int mismatches, int total) {
+    std::cout << "  " << name << ": " << (mismatches == 0 ? "ok" : "MISMATCH") << " (" << mismatches << " of "
+              << total << ")\n";
+    if (mismatches > 0) failures++;
+}
+
+// Frames with a few random boxes changed each time, and a full frame
+// change now and then
+static void testTrackerPackets() {
+    std::cout << "[buildPacket vs old builder]\n";
+    DirtyRectTracker tracker;
+    GatherPacket packet;
+    Image frame(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    std::mt19937 rng(1);
+    const int FRAMES = 200;
+    int mismatches = 0;
+    for (int n = 0; n < FRAMES; ++n) {
+        if (n % 50 == 0) {
+            for (auto& p : frame.pixels) p = (Pixel)rng();
+        }
+        const int boxes = n % 7 == 3 ? 0 : (int)(rng() % 12);
+        for (int i = 0; i < boxes; ++i) {
+            int w = 1 + rng() % 64, h = 1 + rng() % 64;
+            int x = rng() % (DISPLAY_WIDTH - w), y = rng() % (DISPLAY_HEIGHT - h);
+            Pixel color = (Pixel)rng();
+            for (int yy = y; yy < y + h; ++yy) {
+                for (int xx = x; xx < x + w; ++xx) frame.at(xx, yy) = rng() % 4 ? color : (Pixel)rng();
+            }
+        }
+        auto rects = tracker.findDirtyRects(frame);
+        tracker.buildPacket(frame, rects, packet);
+        if (packet.flatten() != buildPacketReference(frame, rects)) mismatches++;
+    }
+    check("packets", mismatches, FRAMES);
+}
+
+// Random appends, including adjacent references that coalesce and
+// references broken up by copies
+static void testSegments() {
+    std::cout << "[segments vs byte vector]\n";
+    std::mt19937 rng(2);
+    std::vector<uint8_t> source(64 * 1024);
+    for (auto& b : source) b = (uint8_t)rng();
+    GatherPacket packet;
+    const int ROUNDS = 1000;
+    int mismatches = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        packet.clear();  // Reused, as FrameSender does
+        std::vector<uint8_t> expected;
+        size_t cursor = rng() % source.size();
+        const int appends = rng() % 40;
+        for (int i = 0; i < appends; ++i) {
+            size_t size = rng() % 300;
+            switch (rng() % 4) {
+            case 0: {
+                uint8_t val = (uint8_t)rng();
+                packet.appendU8(val);
+                expected.push_back(val);
+                break;
+            }
+            case 1: {
+                uint16_t val = (uint16_t)rng();
+                packet.appendU16(val);
+                appendU16(expected, val);
+                break;
+            }
+            case 2:
+                // Continues the last reference when cursor wasn't moved
+                if (cursor + size > source.size()) cursor = 0;
+                packet.appendRef(source.data() + cursor, size);
+                expected.insert(expected.end(), source.begin() + cursor, source.begin() + cursor + size);
+                cursor += size;
+                if (rng() % 3 == 0) cursor = rng() % source.size();
+                break;
+            default: {
+                size_t offset = rng() % (source.size() - size);
+                packet.appendBytes(source.data() + offset, size);
+                expected.insert(expected.end(), source.begin() + offset, source.begin() + offset + size);
+                break;
+            }
+            }
+        }
+        if (packet.flatten() != expected || packet.size() != expected.size()) mismatches++;
+    }
+    check("segments", mismatches, ROUNDS);
+}
+
+int main() {
+    testTrackerPackets();
+    testSegments();
+    std::cout << (failures == 0 ? "PASS" : "FAIL") << "\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+// pipeline_throughput_test.cpp
+// Frame rate of FrameSender against a board with a slow ACK path, for each
+// pipelining window: stop-and-wait, fixed windows and the auto window.
+// Meant to run against board_emulator.py, which decodes with the board's
+// network.py and delays its ACKs, or against a real board.
+//
+// Each window gets its own connection, so the handshake, windowed ACK
+// sequence numbers and credits are exercised every time. The last frame's
+// CRC is printed; it should match the one the emulator prints when the
+// connection closes.
+//
+// Build (x64 Native Tools Command Prompt, nlohmann json on the include path):
+//   cl /EHsc /O2 /std:c++20 src/test/pipeline_throughput_test.cpp /Fe:pipeline_throughput_test.exe
+//      /link ws2_32.lib
+// Run:
+//   python src/test/board_emulator.py --ack-delay-ms 30 --decode-ms 5
+//   pipeline_throughput_test.exe [host] [port] [frames]
+
+#include <winsock2.h>
+#include <windows.h>
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "../frame.hpp"
+
+using namespace qualia;
+
+// zlib's CRC-32, as board_emulator.py prints
+static uint32_t crc32(const uint8_t* data, size_t size) {
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Static background with a box moving across it, so every frame is a small
+// dirty rect message
+static void drawFrame(Image& f, int n) {
+    for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
+        for (int x = 0; x < DISPLAY_WIDTH; ++x) f.at(x, y) = (Pixel)((y / 32 + 1) * 0x0841);
+    }
+    const int bx = (n * 3) % (DISPLAY_WIDTH - 40), by = (n * 11) % (DISPLAY_HEIGHT - 40);
+    for (int y = by; y < by + 40; ++y) {
+        for (int x = bx; x < bx + 40; ++x) f.at(x, y) = (Pixel)(n * 97 + x);
+    }
+}
+
+static bool runWindow(const std::string& host, int port, int window, int frames) {
+    TcpConnection connection;
+    FrameSender sender;
+    sender.setRleEnabled(true);
+    sender.setTemporalDelta(true);
+    sender.setWindow(window);
+    if (!connection.connect(host, port)) {
+        std::cout << "Couldn't connect to " << host << ":" << port << "\n";
+        return false;
+    }
+    sender.start(&connection);
+
+    std::chrono::steady_clock::time_point start;
+    uint32_t crc = 0;
+    for (int n = 0; n < frames; ++n) {
+        // One frame at a time, as with frame lock, so none are replaced
+        while (!sender.isReadyForFrame()) {
+            if (sender.hadError()) {
+                std::cout << "  window " << window << ": send error at frame " << n << "\n";
+                sender.stop();
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        // The first frame is full and waits for the handshake; time the rest
+        if (n == 1) start = std::chrono::steady_clock::now();
+        Image& frame = sender.frameBuffer();
+        drawFrame(frame, n);
+        crc = crc32(frame.data(), frame.dataSize());
+        sender.queueFrame();
+    }
+    while (!sender.isReadyForFrame() && !sender.hadError()) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Let the frames in flight land before closing
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    const bool error = sender.hadError();
+    const DeviceCaps caps = sender.getDeviceCaps();
+    sender.stop();
+    connection.disconnect();
+
+    char crcText[9];
+    std::snprintf(crcText, sizeof(crcText), "%08x", crc);
+    std::cout << "  window " << (window > 0 ? std::to_string(window) : "auto") << ": " << (frames - 1) / seconds
+              << " fps (protocol v" << (int)caps.version << ", credits " << (int)caps.credits << "), frame crc "
+              << crcText << (error ? ", SEND ERROR" : "") << "\n";
+    return !error;
+}
+
+int main(int argc, char* argv[]) {
+    const std::string host = argc > 1 ? argv[1] : "127.0.0.1";
+    const int port = argc > 2 ? std::atoi(argv[2]) : 8765;
+    const int frames = argc > 3 ? std::atoi(argv[3]) : 300;
+
+    std::cout << frames << " frames to " << host << ":" << port << "\n";
+    bool ok = true;
+    for (int window : {1, 2, 4, 0}) {
+        ok = runWindow(host, port, window, frames) && ok;
+    }
+    return ok ? 0 : 1;
+}
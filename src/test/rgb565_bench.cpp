@@ -0,0 +1,125 @@
+// rgb565_bench.cpp
+// Microbenchmark for the fused RGBA -> RGB565 convert + rotate kernels
+// Compares the original per-pixel getPixel() loop against each blocked kernel,
+// for both rotations, and checks they produce the same panel image
+//
+// Build (x64 Native Tools Command Prompt):
+//   cl /EHsc /O2 /std:c++20 src/test/rgb565_bench.cpp /Fe:rgb565_bench.exe
+
+#include <windows.h>
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "../rgb565_convert.hpp"
+
+using namespace qualia;
+
+// Render texture dimensions: the panel on its side
+constexpr int TEXTURE_WIDTH = DISPLAY_HEIGHT;
+constexpr int TEXTURE_HEIGHT = DISPLAY_WIDTH;
+
+struct Color { uint8_t r, g, b, a; };
+
+// What sf::Image::getPixel does: index, then copy out one RGBA pixel
+static Color getPixel(const std::vector<uint8_t>& rgba, int x, int y) {
+    const uint8_t* p = &rgba[((size_t)y * TEXTURE_WIDTH + x) * 4];
+    return {p[0], p[1], p[2], p[3]};
+}
+
+// Original textureToRGB565Rot90 / textureToRGB565RotNeg90 loops
+static void convertReference(const std::vector<uint8_t>& rgba, Image& image, bool neg90) {
+    for (int y = 0; y < image.height; y++) {
+        for (int x = 0; x < image.width; x++) {
+            Color c = neg90 ? getPixel(rgba, image.height - 1 - y, x) : getPixel(rgba, y, image.width - 1 - x);
+            image.at(x, y) = rgb565(c.r, c.g, c.b);
+        }
+    }
+}
+
+template <typename F>
+static double timeIt(int iterations, F&& f) {
+    // Warm up caches
+    f();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+}
+
+static void runCase(const char* name, const std::vector<uint8_t>& rgba, bool neg90, int iterations) {
+    std::cout << "\n[" << name << "]\n";
+
+    // Read the source through a volatile pointer so the conversion can't be hoisted out of the timing loop
+    const std::vector<uint8_t>* volatile srcPtr = &rgba;
+
+    Image reference(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    double refUs = timeIt(iterations, [&] { convertReference(*srcPtr, reference, neg90); });
+    std::cout << "  reference (getPixel) " << refUs << " us/frame\n";
+
+    const simd::ConvertKernel kernels[] = {
+        simd::ConvertKernel::Scalar, simd::ConvertKernel::SSE2, simd::ConvertKernel::AVX2
+    };
+    for (simd::ConvertKernel k : kernels) {
+        if (!simd::cpuSupports(k)) continue;
+        Image out(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+        simd::RotateConvertFn fn = simd::getRotateConvert(k);
+        double us = timeIt(iterations, [&] {
+            fn(srcPtr->data(), TEXTURE_WIDTH, TEXTURE_WIDTH, TEXTURE_HEIGHT, out.pixels.data(), DISPLAY_WIDTH, neg90);
+        });
+        bool match = out.pixels == reference.pixels;
+        const char* kernelName = simd::convertKernelName(k);
+        std::cout << "  " << kernelName << std::string(21 - strlen(kernelName), ' ')
+                  << us << " us/frame, " << (us > 0.0 ? refUs / us : 0.0) << "x"
+                  << (match ? "" : "  MISMATCH") << "\n";
+    }
+
+    // Partial readback: a texture sub-rect read bottom up like glReadPixels,
+    // converted in place into its panel rect
+    const int rx = 101, ry = 17, rw = 37, rh = 53;
+    std::vector<uint8_t> rows((size_t)rw * rh * 4);
+    for (int y = 0; y < rh; ++y) {
+        memcpy(&rows[(size_t)y * rw * 4], &rgba[((size_t)(ry + rh - 1 - y) * TEXTURE_WIDTH + rx) * 4], (size_t)rw * 4);
+    }
+    const int px = neg90 ? ry : TEXTURE_HEIGHT - (ry + rh);
+    const int py = neg90 ? TEXTURE_WIDTH - (rx + rw) : rx;
+    for (simd::ConvertKernel k : kernels) {
+        if (!simd::cpuSupports(k)) continue;
+        Image out = reference;
+        std::fill(out.pixels.begin(), out.pixels.end(), 0);
+        simd::getRotateConvert(k)(rows.data() + (size_t)(rh - 1) * rw * 4, -rw, rw, rh,
+                                  &out.at(px, py), DISPLAY_WIDTH, neg90);
+        bool match = true;
+        for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
+            for (int x = 0; x < DISPLAY_WIDTH; ++x) {
+                bool inside = x >= px && x < px + rh && y >= py && y < py + rw;
+                if (out.at(x, y) != (inside ? reference.at(x, y) : 0)) match = false;
+            }
+        }
+        std::cout << "  " << simd::convertKernelName(k) << " sub-rect " << (match ? "ok" : "MISMATCH") << "\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = (argc >= 2) ? atoi(argv[1]) : 500;
+    if (iterations <= 0) iterations = 500;
+
+    std::cout << "RGB565 convert + rotate benchmark: " << TEXTURE_WIDTH << "x" << TEXTURE_HEIGHT
+              << " RGBA -> " << DISPLAY_WIDTH << "x" << DISPLAY_HEIGHT << ", " << iterations << " iterations\n";
+    std::cout << "Detected kernel: " << simd::convertKernelName(simd::detectConvertKernel()) << "\n";
+
+    std::mt19937 rng(1234);
+    std::vector<uint8_t> rgba((size_t)TEXTURE_WIDTH * TEXTURE_HEIGHT * 4);
+    for (auto& b : rgba) b = (uint8_t)rng();
+
+    runCase("rot90", rgba, false, iterations);
+    runCase("rot-90", rgba, true, iterations);
+
+    return 0;
+}
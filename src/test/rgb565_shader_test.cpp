@@ -0,0 +1,164 @@
+// rgb565_shader_test.cpp
+// Golden image test for the GPU RGB565 pack pass (utils/rgb565_shader.h):
+// renders a test pattern with every channel value into a landscape render
+// texture, reads it back through TextureReadback with and without GPU
+// packing, and checks both against a golden panel image built on the CPU
+// with qualia::rgb565, for both rotations, full and partial reads, and
+// synchronous and pixel buffer readback. Mismatching frames are saved as
+// PNGs next to the golden one.
+//
+// Build (x64 Native Tools Command Prompt, SFML 3 and nlohmann json on the
+// include path):
+//   cl /EHsc /O2 /std:c++20 src/test/rgb565_shader_test.cpp /Fe:rgb565_shader_test.exe
+//      /link sfml-graphics.lib sfml-window.lib sfml-system.lib opengl32.lib
+// Run it under a software GL to check the shader against a reference
+// implementation: copy opengl32.dll from a Mesa3D for Windows release next
+// to the exe and set GALLIUM_DRIVER=llvmpipe.
+
+#include <windows.h>
+#include <iostream>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../utils/texture_readback.h"
+
+using namespace qualia;
+
+// Render texture dimensions: the panel on its side
+constexpr unsigned TEXTURE_WIDTH = DISPLAY_HEIGHT;
+constexpr unsigned TEXTURE_HEIGHT = DISPLAY_WIDTH;
+
+// Ramps through every value of each channel, with noise so neighbouring
+// pixels differ in all bits
+static sf::Image makePattern(uint32_t seed) {
+    sf::Image image({TEXTURE_WIDTH, TEXTURE_HEIGHT});
+    std::mt19937 rng(seed);
+    for (unsigned y = 0; y < TEXTURE_HEIGHT; ++y) {
+        for (unsigned x = 0; x < TEXTURE_WIDTH; ++x) {
+            uint8_t noise = (uint8_t)rng();
+            image.setPixel({x, y}, sf::Color((uint8_t)x, (uint8_t)(y + noise), (uint8_t)(x * 7 + y * 3) ^ noise,
+                                             (uint8_t)rng()));
+        }
+    }
+    return image;
+}
+
+// What the panel should show, from qualia::rgb565
+static Image golden(const sf::Image& image, bool neg90) {
+    Image out(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    for (int y = 0; y < out.height; ++y) {
+        for (int x = 0; x < out.width; ++x) {
+            sf::Vector2u src = neg90 ? sf::Vector2u(TEXTURE_WIDTH - 1 - y, x) : sf::Vector2u(y, TEXTURE_HEIGHT - 1 - x);
+            sf::Color c = image.getPixel(src);
+            out.at(x, y) = rgb565(c.r, c.g, c.b);
+        }
+    }
+    return out;
+}
+
+static void savePanel(const Image& panel, const std::string& path) {
+    sf::Image image({(unsigned)panel.width, (unsigned)panel.height});
+    for (int y = 0; y < panel.height; ++y) {
+        for (int x = 0; x < panel.width; ++x) {
+            Pixel p = panel.pixels[y * panel.width + x];
+            image.setPixel({(unsigned)x, (unsigned)y}, sf::Color(rgb565_r(p), rgb565_g(p), rgb565_b(p)));
+        }
+    }
+    (void)image.saveToFile(path);
+}
+
+// Copy image into texture pixel for pixel
+static void drawPattern(sf::RenderTexture& texture, const sf::Image& image, const sf::IntRect& area) {
+    sf::Texture pattern(image);
+    sf::Sprite sprite(pattern, area);
+    sprite.setPosition(sf::Vector2f(area.position));
+    texture.draw(sprite, sf::RenderStates(sf::BlendNone));
+    texture.display();
+}
+
+static int failures = 0;
+
+static void check(const char* name, const Image& frame, const Image& expected) {
+    int wrong = 0;
+    for (size_t i = 0; i < expected.pixels.size(); ++i) {
+        if (frame.pixels[i] != expected.pixels[i]) wrong++;
+    }
+    std::cout << "  " << name << ": " << (wrong == 0 ? "ok" : "MISMATCH") << " (" << wrong << " pixels)\n";
+    if (wrong > 0) {
+        failures++;
+        savePanel(expected, std::string("rgb565_golden_") + name + ".png");
+        savePanel(frame, std::string("rgb565_actual_") + name + ".png");
+    }
+}
+
+static void runCase(bool gpuPack, bool async, bool neg90) {
+    std::cout << "[" << (gpuPack ? "gpu pack" : "cpu convert") << ", " << (async ? "pixel buffers" : "sync") << ", "
+              << (neg90 ? "rot-90" : "rot90") << "]\n";
+
+    sf::RenderTexture texture({TEXTURE_WIDTH, TEXTURE_HEIGHT});
+    TextureReadback readback;
+    readback.setGpuPack(gpuPack);
+    readback.setAsync(async);
+
+    // One element covering the texture, plus one that changes
+    const sf::IntRect changed({101, 17}, {37, 53});
+    DamageSnapshot snapshot;
+    snapshot.valid = true;
+    snapshot.epoch = newDamageEpoch();
+    snapshot.elements.push_back({damageKey("background"), 1, {0, 0, (uint16_t)TEXTURE_WIDTH, (uint16_t)TEXTURE_HEIGHT}});
+    snapshot.elements.push_back({damageKey("changed"), 1,
+                                 {(uint16_t)changed.position.x, (uint16_t)changed.position.y,
+                                  (uint16_t)changed.size.x, (uint16_t)changed.size.y}});
+
+    sf::Image first = makePattern(1);
+    drawPattern(texture, first, sf::IntRect({0, 0}, {(int)TEXTURE_WIDTH, (int)TEXTURE_HEIGHT}));
+    Image frame;
+    bool got = readback.read(texture, snapshot, frame, neg90);
+    if (async) {
+        // Frames come out one read late: a second read of the same content delivers the first
+        got = readback.read(texture, snapshot, frame, neg90);
+    }
+    if (!got) {
+        std::cout << "  no frame\n";
+        failures++;
+        return;
+    }
+    check("full", frame, golden(first, neg90));
+
+    // Redraw only the changed element; the readback should fetch just that
+    sf::Image second = first;
+    sf::Image patch = makePattern(2);
+    for (int y = changed.position.y; y < changed.position.y + changed.size.y; ++y) {
+        for (int x = changed.position.x; x < changed.position.x + changed.size.x; ++x) {
+            second.setPixel({(unsigned)x, (unsigned)y}, patch.getPixel({(unsigned)x, (unsigned)y}));
+        }
+    }
+    drawPattern(texture, second, changed);
+    snapshot.elements[1].content = 2;
+    readback.read(texture, snapshot, frame, neg90);
+    if (async) readback.read(texture, snapshot, frame, neg90);
+    check("partial", frame, golden(second, neg90));
+
+    if (gpuPack && !readback.isGpuPacking()) {
+        std::cout << "  GPU packing unavailable, fell back to the CPU\n";
+        failures++;
+    }
+}
+
+int main() {
+    if (!sf::Shader::isAvailable()) {
+        std::cout << "Shaders unavailable\n";
+        return 1;
+    }
+    for (bool gpuPack : {true, false}) {
+        for (bool async : {false, true}) {
+            for (bool neg90 : {false, true}) {
+                runCase(gpuPack, async, neg90);
+            }
+        }
+    }
+    std::cout << (failures == 0 ? "PASS" : "FAIL") << "\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "image.hpp"
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace qualia {
+
+constexpr int TILE_CACHE_TILE = 16;         // Cached tiles are 16x16, on the dirty tile grid
+constexpr int TILE_CACHE_SLOTS = 1024;      // Must match TILE_CACHE_SLOTS in esp32/network.py (512 KB of PSRAM)
+constexpr int TILE_CACHE_SEEN_SIZE = 4096;  // Admission filter entries
+constexpr int MAX_TILE_STORES = 64;         // New cache entries per frame
+
+// Host mirror of the device's tile cache: which tile contents the board
+// holds in which slot. Slots are evicted least recently used. Tiles are
+// only admitted once their hash has been seen before, so one-off content
+// (text, graphs) doesn't push out looping animation frames.
+class TileCache {
+public:
+    explicit TileCache(int slots = TILE_CACHE_SLOTS)
+        : hashes_(slots, 0)
+        , pixels_((size_t)slots * TILE_CACHE_TILE * TILE_CACHE_TILE)
+        , prev_(slots)
+        , next_(slots)
+        , seen_(TILE_CACHE_SEEN_SIZE, 0) {
+        slotOf_.reserve(slots * 2);
+        clear();
+    }
+
+    int slotCount() const { return (int)hashes_.size(); }
+
+    // Forget everything (device state unknown)
+    void clear() {
+        slotOf_.clear();
+        std::fill(seen_.begin(), seen_.end(), 0);
+        const int n = slotCount();
+        for (int i = 0; i < n; ++i) {
+            prev_[i] = i - 1;
+            next_[i] = i + 1 < n ? i + 1 : -1;
+        }
+        head_ = n > 0 ? 0 : -1;
+        tail_ = n - 1;
+    }
+
+    // Slot holding this tile, or -1. Pixels are compared so a hash
+    // collision can't draw the wrong tile. Hits become most recently used.
+    int find(uint64_t hash, const Pixel* tile, int stride) {
+        auto it = slotOf_.find(hash);
+        if (it == slotOf_.end()) return -1;
+        int slot = it->second;
+        const Pixel* cached = slotPixels(slot);
+        for (int y = 0; y < TILE_CACHE_TILE; ++y) {
+            if (std::memcmp(cached + y * TILE_CACHE_TILE, tile + (size_t)y * stride,
+                            TILE_CACHE_TILE * sizeof(Pixel)) != 0) {
+                return -1;
+            }
+        }
+        touch(slot);
+        return slot;
+    }
+
+    // True if the tile was seen recently (and remembers it for next time)
+    bool seenBefore(uint64_t hash) {
+        uint64_t& entry = seen_[hash % TILE_CACHE_SEEN_SIZE];
+        bool seen = entry == hash;
+        entry = hash;
+        return seen;
+    }
+
+    // Store a tile in the least recently used slot; returns the slot
+    int insert(uint64_t hash, const Pixel* tile, int stride) {
+        int slot = tail_;
+        auto old = slotOf_.find(hashes_[slot]);
+        if (old != slotOf_.end() && old->second == slot) slotOf_.erase(old);
+        hashes_[slot] = hash;
+        slotOf_[hash] = slot;
+        Pixel* dst = slotPixels(slot);
+        for (int y = 0; y < TILE_CACHE_TILE; ++y) {
+            std::memcpy(dst + y * TILE_CACHE_TILE, tile + (size_t)y * stride, TILE_CACHE_TILE * sizeof(Pixel));
+        }
+        touch(slot);
+        return slot;
+    }
+
+private:
+    std::unordered_map<uint64_t, int> slotOf_;
+    std::vector<uint64_t> hashes_;
+    std::vector<Pixel> pixels_;
+    std::vector<int> prev_;   // LRU list, head is most recently used
+    std::vector<int> next_;
+    int head_ = -1;
+    int tail_ = -1;
+    std::vector<uint64_t> seen_;
+
+    Pixel* slotPixels(int slot) {
+        return pixels_.data() + (size_t)slot * TILE_CACHE_TILE * TILE_CACHE_TILE;
+    }
+
+    void touch(int slot) {
+        if (slot == head_) return;
+        // Unlink
+        next_[prev_[slot]] = next_[slot];
+        if (next_[slot] >= 0) {
+            prev_[next_[slot]] = prev_[slot];
+        } else {
+            tail_ = prev_[slot];
+        }
+        // Push front
+        prev_[slot] = -1;
+        next_[slot] = head_;
+        prev_[head_] = slot;
+        head_ = slot;
+    }
+};
+
+} // namespace qualia
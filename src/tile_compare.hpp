@@ -0,0 +1,275 @@
+#pragma once
+
+#include "image.hpp"
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define QUALIA_SIMD_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define QUALIA_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// MSVC emits AVX2 intrinsics without /arch:AVX2; GCC/Clang need a per-function target
+#if defined(QUALIA_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define QUALIA_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define QUALIA_TARGET_AVX2
+#endif
+
+namespace qualia {
+namespace simd {
+
+// Available tile comparison kernels, fastest last
+enum class DiffKernel {
+    Scalar,
+    SSE2,
+    NEON,
+    AVX2
+};
+
+inline const char* diffKernelName(DiffKernel kernel) {
+    switch (kernel) {
+        case DiffKernel::Scalar: return "scalar";
+        case DiffKernel::SSE2:   return "sse2";
+        case DiffKernel::NEON:   return "neon";
+        case DiffKernel::AVX2:   return "avx2";
+        default:                 return "unknown";
+    }
+}
+
+// Compares a w x h block of two images with the same row stride (in pixels).
+// Returns true as soon as any pixel differs.
+using TileDiffFn = bool (*)(const Pixel* a, const Pixel* b, int stride, int w, int h);
+
+inline bool tileDiffScalar(const Pixel* a, const Pixel* b, int stride, int w, int h) {
+    for (int y = 0; y < h; ++y) {
+        // memcmp is already word-at-a-time in every CRT we ship with
+        if (std::memcmp(a, b, w * sizeof(Pixel)) != 0) {
+            return true;
+        }
+        a += stride;
+        b += stride;
+    }
+    return false;
+}
+
+#ifdef QUALIA_SIMD_X86
+// 8 pixels per 128-bit load, so a 16-pixel tile row is two loads
+inline bool tileDiffSSE2(const Pixel* a, const Pixel* b, int stride, int w, int h) {
+    const int vecEnd = w & ~7;
+    for (int y = 0; y < h; ++y) {
+        __m128i acc = _mm_setzero_si128();
+        int x = 0;
+        for (; x < vecEnd; x += 8) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+            acc = _mm_or_si128(acc, _mm_xor_si128(va, vb));
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF) {
+            return true;
+        }
+        for (; x < w; ++x) {
+            if (a[x] != b[x]) return true;
+        }
+        a += stride;
+        b += stride;
+    }
+    return false;
+}
+
+// 16 pixels per 256-bit load, so a 16-pixel tile row is a single load
+QUALIA_TARGET_AVX2
+inline bool tileDiffAVX2(const Pixel* a, const Pixel* b, int stride, int w, int h) {
+    const int vecEnd = w & ~15;
+    for (int y = 0; y < h; ++y) {
+        __m256i acc = _mm256_setzero_si256();
+        int x = 0;
+        for (; x < vecEnd; x += 16) {
+            __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + x));
+            __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + x));
+            acc = _mm256_or_si256(acc, _mm256_xor_si256(va, vb));
+        }
+        if (!_mm256_testz_si256(acc, acc)) {
+            return true;
+        }
+        for (; x < w; ++x) {
+            if (a[x] != b[x]) return true;
+        }
+        a += stride;
+        b += stride;
+    }
+    return false;
+}
+#endif
+
+#ifdef QUALIA_SIMD_NEON
+inline bool tileDiffNEON(const Pixel* a, const Pixel* b, int stride, int w, int h) {
+    const int vecEnd = w & ~7;
+    for (int y = 0; y < h; ++y) {
+        uint16x8_t acc = vdupq_n_u16(0);
+        int x = 0;
+        for (; x < vecEnd; x += 8) {
+            acc = vorrq_u16(acc, veorq_u16(vld1q_u16(a + x), vld1q_u16(b + x)));
+        }
+        if (vmaxvq_u16(acc) != 0) {
+            return true;
+        }
+        for (; x < w; ++x) {
+            if (a[x] != b[x]) return true;
+        }
+        a += stride;
+        b += stride;
+    }
+    return false;
+}
+#endif
+
+inline bool cpuSupports(DiffKernel kernel) {
+    switch (kernel) {
+        case DiffKernel::Scalar:
+            return true;
+#ifdef QUALIA_SIMD_X86
+        case DiffKernel::SSE2:
+            return true;  // x64 baseline
+        case DiffKernel::AVX2: {
+#ifdef _MSC_VER
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7) return false;
+            __cpuid(info, 1);
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            bool avx = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx) return false;
+            // OS must save YMM state on context switch
+            if ((_xgetbv(0) & 0x6) != 0x6) return false;
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            return __builtin_cpu_supports("avx2");
+#endif
+        }
+#endif
+#ifdef QUALIA_SIMD_NEON
+        case DiffKernel::NEON:
+            return true;  // AArch64 baseline
+#endif
+        default:
+            return false;
+    }
+}
+
+inline TileDiffFn getTileDiff(DiffKernel kernel) {
+    switch (kernel) {
+#ifdef QUALIA_SIMD_X86
+        case DiffKernel::SSE2: return tileDiffSSE2;
+        case DiffKernel::AVX2: return tileDiffAVX2;
+#endif
+#ifdef QUALIA_SIMD_NEON
+        case DiffKernel::NEON: return tileDiffNEON;
+#endif
+        default: return tileDiffScalar;
+    }
+}
+
+// Picks the fastest kernel the running CPU supports
+inline DiffKernel detectDiffKernel() {
+    const DiffKernel preferred[] = { DiffKernel::AVX2, DiffKernel::NEON, DiffKernel::SSE2 };
+    for (DiffKernel k : preferred) {
+        if (cpuSupports(k)) return k;
+    }
+    return DiffKernel::Scalar;
+}
+
+// Index of the first pixel in [0, n) where a and b differ, or n if none
+inline int firstDiff(const Pixel* a, const Pixel* b, int n) {
+    int x = 0;
+#ifdef QUALIA_SIMD_X86
+    for (; x + 8 <= n; x += 8) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+        unsigned eq = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(va, vb));
+        if (eq != 0xFFFF) {
+            return x + std::countr_zero(~eq & 0xFFFFu) / 2;
+        }
+    }
+#endif
+    for (; x < n; ++x) {
+        if (a[x] != b[x]) return x;
+    }
+    return n;
+}
+
+// Index of the last pixel in [0, n) where a and b differ, or -1 if none
+inline int lastDiff(const Pixel* a, const Pixel* b, int n) {
+    int x = n;
+#ifdef QUALIA_SIMD_X86
+    for (; x - 8 >= 0; x -= 8) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x - 8));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x - 8));
+        unsigned neq = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(va, vb)) & 0xFFFFu;
+        if (neq != 0) {
+            return x - 8 + (31 - std::countl_zero(neq)) / 2;
+        }
+    }
+#endif
+    for (--x; x >= 0; --x) {
+        if (a[x] != b[x]) return x;
+    }
+    return -1;
+}
+
+// 64-bit non-cryptographic hash of a w x h block (stride in pixels).
+// Four independent multiply-rotate lanes, one per 64-bit word of a 16-pixel
+// tile row, so the multiplies pipeline instead of forming one long chain.
+inline uint64_t rotl64(uint64_t v, int r) {
+    return (v << r) | (v >> (64 - r));
+}
+
+inline uint64_t hashRound(uint64_t acc, uint64_t word) {
+    acc += word * 0xC2B2AE3D27D4EB4FULL;
+    acc = rotl64(acc, 31);
+    return acc * 0x9E3779B185EBCA87ULL;
+}
+
+inline uint64_t hashTile(const Pixel* p, int stride, int w, int h) {
+    uint64_t lanes[4] = {
+        0x60EA27EEADC0B5D6ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0x9E3779B185EBCA87ULL
+    };
+    const int words = w / 4;
+    for (int y = 0; y < h; ++y) {
+        const Pixel* row = p + (size_t)y * stride;
+        int i = 0;
+        for (; i < words; ++i) {
+            uint64_t word;
+            std::memcpy(&word, row + i * 4, sizeof(word));
+            lanes[i & 3] = hashRound(lanes[i & 3], word);
+        }
+        // Partial word at the right edge of a tile narrower than a multiple of 4
+        int tail = w - words * 4;
+        if (tail > 0) {
+            uint64_t word = 0;
+            std::memcpy(&word, row + words * 4, tail * sizeof(Pixel));
+            lanes[i & 3] = hashRound(lanes[i & 3], word);
+        }
+    }
+    uint64_t h64 = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+    h64 ^= (uint64_t)w << 32 | (uint32_t)h;
+    // Final avalanche (xxHash64 finalizer)
+    h64 ^= h64 >> 33;
+    h64 *= 0xC2B2AE3D27D4EB4FULL;
+    h64 ^= h64 >> 29;
+    h64 *= 0x165667B19E3779F9ULL;
+    h64 ^= h64 >> 32;
+    return h64;
+}
+
+} // namespace simd
+} // namespace qualia
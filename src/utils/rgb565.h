@@ -1,42 +1,73 @@
 
 #include <SFML/Graphics.hpp>
 #include "../image.hpp"
+#include "../damage.hpp"
+#include "../telemetry.hpp"
+#include "../rgb565_convert.hpp"
 
 // Convert RenderTexture to RGB565 for Qualia
-void textureToRGB565(sf::RenderTexture& texture, qualia::Image& image) {
+void textureToRGB565(sf::RenderTexture& texture, qualia::Image& image, qualia::Telemetry* telemetry = nullptr) {
+    auto start = qualia::Telemetry::Clock::now();
     sf::Image sfImg = texture.getTexture().copyToImage();
+    auto readBack = qualia::Telemetry::Clock::now();
     
+    const uint8_t* rgba = sfImg.getPixelsPtr();
     for (int y = 0; y < image.height; y++) {
         for (int x = 0; x < image.width; x++) {
-            sf::Color c = sfImg.getPixel(sf::Vector2u(x, y));
-            image.at(x, y) = qualia::rgb565(c.r, c.g, c.b);
+            image.at(x, y) = qualia::simd::rgbaToRgb565(rgba + ((size_t)y * sfImg.getSize().x + x) * 4);
         }
     }
+    if (telemetry) {
+        telemetry->record(qualia::Stage::Readback, start, readBack);
+        telemetry->record(qualia::Stage::Convert, readBack, qualia::Telemetry::Clock::now());
+    }
 }
 
-// Rotate 90 degrees clockwise during conversion
-void textureToRGB565Rot90(sf::RenderTexture& texture, qualia::Image& image) {
+// Convert and rotate in one pass, with the fastest kernel for this CPU
+// texture is (height, width), output is (width, height)
+void textureToRGB565Rotated(sf::RenderTexture& texture, qualia::Image& image, bool neg90,
+                            qualia::Telemetry* telemetry) {
+    static const qualia::simd::RotateConvertFn convert =
+        qualia::simd::getRotateConvert(qualia::simd::detectConvertKernel());
+    auto start = qualia::Telemetry::Clock::now();
     sf::Image sfImg = texture.getTexture().copyToImage();
-    
-    // texture is (height, width), output is (width, height)
-    // Output pixel (x, y) comes from input pixel (y, width-1-x)
-    for (int y = 0; y < image.height; y++) {
-        for (int x = 0; x < image.width; x++) {
-            sf::Color c = sfImg.getPixel(sf::Vector2u(y, image.width - 1 - x));
-            image.at(x, y) = qualia::rgb565(c.r, c.g, c.b);
-        }
+    auto readBack = qualia::Telemetry::Clock::now();
+
+    sf::Vector2u size = sfImg.getSize();
+    image.resize((int)size.y, (int)size.x);
+    convert(sfImg.getPixelsPtr(), size.x, (int)size.x, (int)size.y, image.pixels.data(), image.width, neg90);
+    if (telemetry) {
+        telemetry->record(qualia::Stage::Readback, start, readBack);
+        telemetry->record(qualia::Stage::Convert, readBack, qualia::Telemetry::Clock::now());
     }
 }
 
-// Rotate 90 degrees counter-clockwise during conversion  
-void textureToRGB565RotNeg90(sf::RenderTexture& texture, qualia::Image& image) {
-    sf::Image sfImg = texture.getTexture().copyToImage();
-    
-    // Output pixel (x, y) comes from input pixel (height-1-y, x)
-    for (int y = 0; y < image.height; y++) {
-        for (int x = 0; x < image.width; x++) {
-            sf::Color c = sfImg.getPixel(sf::Vector2u(image.height - 1 - y, x));
-            image.at(x, y) = qualia::rgb565(c.r, c.g, c.b);
+// Rotate 90 degrees clockwise during conversion
+// Output pixel (x, y) comes from input pixel (y, width-1-x)
+void textureToRGB565Rot90(sf::RenderTexture& texture, qualia::Image& image, qualia::Telemetry* telemetry = nullptr) {
+    textureToRGB565Rotated(texture, image, false, telemetry);
+}
+
+// Rotate 90 degrees counter-clockwise during conversion
+// Output pixel (x, y) comes from input pixel (height-1-y, x)
+void textureToRGB565RotNeg90(sf::RenderTexture& texture, qualia::Image& image, qualia::Telemetry* telemetry = nullptr) {
+    textureToRGB565Rotated(texture, image, true, telemetry);
+}
+
+// Map a skin's draw snapshot from texture to panel coordinates, matching
+// textureToRGB565Rot90 (rotNeg90 = false) or textureToRGB565RotNeg90
+qualia::DamageSnapshot drawSnapshotToPanel(const qualia::DamageSnapshot& snapshot, bool rotNeg90) {
+    qualia::DamageSnapshot panel = snapshot;
+    panel.layout = rotNeg90 ? 2 : 1;
+    for (auto& e : panel.elements) {
+        const qualia::DirtyRect r = e.bounds;
+        if (rotNeg90) {
+            // Panel (x, y) shows texture (960-1-y, x)
+            e.bounds = {r.y, (uint16_t)(qualia::DISPLAY_HEIGHT - (r.x + r.w)), r.h, r.w};
+        } else {
+            // Panel (x, y) shows texture (y, 240-1-x)
+            e.bounds = {(uint16_t)(qualia::DISPLAY_WIDTH - (r.y + r.h)), r.x, r.h, r.w};
         }
     }
+    return panel;
 }
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <vector>
+#include "../log.hpp"
+#include "../image.hpp"
+#include "../dirty_rects.hpp"
+
+// Final render pass that rotates the landscape render texture into the
+// panel's 240x960 orientation and packs it to RGB565 on the GPU. Two panel
+// pixels go in each RGBA8 texel of a 120x960 target as little endian
+// uint16, so a row of the target is a row of qualia::Image: readback moves
+// half the bytes and there is nothing left to convert.
+class Rgb565Packer {
+public:
+    // Integer math in floats (exact below 2^24), bit identical to
+    // qualia::rgb565 and the CPU kernels
+    static constexpr const char* SHADER = R"(
+uniform sampler2D source;
+uniform vec2 sourceSize;
+uniform bool neg90;
+
+// RGB565 of panel pixel p as (low byte, high byte)
+vec2 pack565(vec2 p) {
+    // Panel (x, y) shows texture (y, h-1-x), or (w-1-y, x) with neg90;
+    // the texture's rows are stored bottom up
+    vec2 t = neg90 ? vec2(sourceSize.x - 1.0 - p.y, sourceSize.y - 1.0 - p.x) : p.yx;
+    vec3 c = floor(texture2D(source, (t + 0.5) / sourceSize).rgb * 255.0 + 0.5);
+    float r = floor(c.r / 8.0);
+    float g = floor(c.g / 4.0);
+    float b = floor(c.b / 8.0);
+    return vec2(mod(g, 8.0) * 32.0 + b, r * 8.0 + floor(g / 8.0));
+}
+
+void main() {
+    // Target row y is panel row y (read back bottom up), texel x holds
+    // panel pixels 2x and 2x + 1
+    vec2 p = vec2(floor(gl_FragCoord.x) * 2.0, floor(gl_FragCoord.y));
+    // A quarter step over the byte so rounding and truncating both give it
+    gl_FragColor = (vec4(pack565(p), pack565(p + vec2(1.0, 0.0))) + 0.25) / 255.0;
+}
+)";
+
+    // Set up for a texture of textureSize. False if shaders or render
+    // textures aren't available; it isn't retried after that.
+    bool prepare(sf::Vector2u textureSize) {
+        if (failed_) return false;
+        const sf::Vector2u targetSize(textureSize.y / 2, textureSize.x);
+        if (ready_ && target_.getSize() == targetSize) return true;
+
+        ready_ = textureSize.y % 2 == 0 && sf::Shader::isAvailable() &&
+                 shader_.loadFromMemory(SHADER, sf::Shader::Type::Fragment) && target_.resize(targetSize);
+        if (!ready_) {
+            LOG_WARN << "RGB565 shader unavailable, converting on the CPU\n";
+            failed_ = true;
+        }
+        return ready_;
+    }
+
+    // Pack panel rects (even x and width) of texture into target(), rotated
+    // like textureToRGB565Rot90 (neg90 = false) or textureToRGB565RotNeg90
+    void pack(const sf::Texture& texture, bool neg90, const std::vector<qualia::DirtyRect>& rects) {
+        const float panelHeight = (float)texture.getSize().x;
+        shader_.setUniform("source", texture);
+        shader_.setUniform("sourceSize", sf::Glsl::Vec2(texture.getSize()));
+        shader_.setUniform("neg90", neg90);
+
+        // Target rows count up from the bottom, view y from the top
+        quads_.clear();
+        for (const auto& r : rects) {
+            const float x0 = r.x / 2.0f, x1 = (r.x + r.w) / 2.0f;
+            const float y0 = panelHeight - (r.y + r.h), y1 = panelHeight - r.y;
+            const sf::Vector2f corners[6] = {{x0, y0}, {x1, y0}, {x0, y1}, {x0, y1}, {x1, y0}, {x1, y1}};
+            for (const auto& c : corners) quads_.append(sf::Vertex{c});
+        }
+
+        sf::RenderStates states;
+        states.shader = &shader_;
+        states.blendMode = sf::BlendNone;  // Alpha holds pixel data
+        target_.draw(quads_, states);
+        target_.display();
+    }
+
+    bool isReady() const { return ready_; }
+
+    // GL row y (counted from the bottom, as glReadPixels does) holds panel
+    // row y, in panel width / 2 texels
+    sf::RenderTexture& target() { return target_; }
+
+private:
+    sf::Shader shader_;
+    sf::RenderTexture target_;
+    sf::VertexArray quads_{sf::PrimitiveType::Triangles};
+    bool ready_ = false;
+    bool failed_ = false;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free queue for one producer thread and one consumer thread.
+// push() and pop() never block. Either side can block in wait() until a
+// condition on the ring holds; every push, pop and wake() re-checks it.
+template <typename T, size_t N>
+class SpscRing {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+    // Producer side; false if full
+    bool push(const T& value) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == N) return false;
+        items_[tail & (N - 1)] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        signal();
+        return true;
+    }
+
+    // Consumer side; false if empty
+    bool pop(T& value) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) return false;
+        value = items_[head & (N - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        signal();
+        return true;
+    }
+
+    // Consumer side; oldest item, which must exist
+    const T& front() const {
+        return items_[head_.load(std::memory_order_relaxed) & (N - 1)];
+    }
+
+    size_t size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return size() == 0; }
+    static constexpr size_t capacity() { return N; }
+
+    // Only while neither side is running
+    void clear() {
+        head_.store(0);
+        tail_.store(0);
+    }
+
+    // Block until ready() holds
+    template <typename Ready>
+    void wait(Ready ready) const {
+        while (!ready()) {
+            uint32_t seen = signal_.load(std::memory_order_acquire);
+            if (ready()) return;
+            signal_.wait(seen);
+        }
+    }
+
+    // Make waiters re-check their condition (e.g. after a stop flag changed)
+    void wake() { signal(); }
+
+private:
+    std::array<T, N> items_{};
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    mutable std::atomic<uint32_t> signal_{0};
+
+    void signal() {
+        signal_.fetch_add(1, std::memory_order_release);
+        signal_.notify_all();
+    }
+};
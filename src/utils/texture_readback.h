@@ -0,0 +1,525 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <SFML/OpenGL.hpp>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include "../log.hpp"
+#include "../image.hpp"
+#include "../damage.hpp"
+#include "../telemetry.hpp"
+#include "../rgb565_convert.hpp"
+#include "worker_pool.h"
+#include "rgb565_shader.h"
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+// Pixel buffer objects (GL 2.1) and fences (GL 3.2 / ARB_sync), which the
+// GL 1.1 headers Windows ships don't declare. Loaded through SFML.
+namespace glext {
+
+using GLsync = struct __GLsync*;
+
+constexpr GLenum PIXEL_PACK_BUFFER = 0x88EB;
+constexpr GLenum STREAM_READ = 0x88E1;
+constexpr GLenum READ_ONLY = 0x88B8;
+constexpr GLenum SYNC_GPU_COMMANDS_COMPLETE = 0x9117;
+constexpr GLbitfield SYNC_FLUSH_COMMANDS_BIT = 0x1;
+constexpr GLenum ALREADY_SIGNALED = 0x911A;
+constexpr GLenum CONDITION_SATISFIED = 0x911C;
+
+struct Functions {
+    void (APIENTRY* genBuffers)(GLsizei, GLuint*) = nullptr;
+    void (APIENTRY* deleteBuffers)(GLsizei, const GLuint*) = nullptr;
+    void (APIENTRY* bindBuffer)(GLenum, GLuint) = nullptr;
+    void (APIENTRY* bufferData)(GLenum, ptrdiff_t, const void*, GLenum) = nullptr;
+    void* (APIENTRY* mapBuffer)(GLenum, GLenum) = nullptr;
+    GLboolean (APIENTRY* unmapBuffer)(GLenum) = nullptr;
+    GLsync (APIENTRY* fenceSync)(GLenum, GLbitfield) = nullptr;
+    GLenum (APIENTRY* clientWaitSync)(GLsync, GLbitfield, uint64_t) = nullptr;
+    void (APIENTRY* deleteSync)(GLsync) = nullptr;
+
+    // Needs a current context. False if there are no pixel buffer objects;
+    // fences are optional (without them mapping waits for the copy).
+    bool load() {
+        int major = 0, minor = 0;
+        const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+        if (!version || sscanf(version, "%d.%d", &major, &minor) != 2) return false;
+        int v = major * 10 + minor;
+        if (v < 21) return false;
+
+        get(genBuffers, "glGenBuffers");
+        get(deleteBuffers, "glDeleteBuffers");
+        get(bindBuffer, "glBindBuffer");
+        get(bufferData, "glBufferData");
+        get(mapBuffer, "glMapBuffer");
+        get(unmapBuffer, "glUnmapBuffer");
+        if (v >= 32) {
+            get(fenceSync, "glFenceSync");
+            get(clientWaitSync, "glClientWaitSync");
+            get(deleteSync, "glDeleteSync");
+        }
+        return genBuffers && deleteBuffers && bindBuffer && bufferData && mapBuffer && unmapBuffer;
+    }
+
+    bool hasFences() const { return fenceSync && clientWaitSync && deleteSync; }
+
+private:
+    template <typename F>
+    static void get(F& fn, const char* name) {
+        fn = reinterpret_cast<F>(sf::Context::getFunction(name));
+    }
+};
+
+} // namespace glext
+
+// Reads a render texture back as a rotated RGB565 frame, pulling only the
+// regions the skin's draw snapshot says changed since the last read with
+// glReadPixels on the texture's FBO, so steady state cost scales with what
+// changed instead of the whole 960x240 texture.
+//
+// The last read is kept converted in a panel sized mirror. Frames handed in
+// are brought up to it in place by copying just the rects read since that
+// frame was last filled: the sender cycles several buffers, so the one
+// given is usually a few reads behind. Anything that can't be tracked (no
+// snapshot, new epoch, other texture or rotation, unknown buffer) takes a
+// full read or copy.
+//
+// With async reads, two pixel buffer objects take turns: a read only
+// queues the copy into one, with a fence, and the other's pixels from the
+// read before are mapped and converted while the GPU works on the newer
+// frame. The render loop doesn't wait on the GPU; frames come out one read
+// late. Without pixel buffer objects reads stay synchronous.
+//
+// With GPU packing, Rgb565Packer rotates and packs the damaged rects first
+// and those are read instead: half the bytes, and only copies on the CPU.
+class TextureReadback {
+public:
+    TextureReadback() = default;
+    TextureReadback(const TextureReadback&) = delete;
+    TextureReadback& operator=(const TextureReadback&) = delete;
+
+    // GL objects are deleted with the texture's context: destroy this first
+    ~TextureReadback() { releaseBuffers(); }
+
+    // Convert on a pool (not owned; nullptr converts on the caller)
+    void setWorkerPool(WorkerPool* pool) { pool_ = pool; }
+
+    void setAsync(bool async) {
+        if (async == async_) return;
+        async_ = async;
+        reset();  // A read left in a pixel buffer is dropped
+    }
+
+    bool isAsync() const { return async_ && pboSupported_; }
+
+    // Pack to RGB565 on the GPU before reading (falls back to the CPU
+    // kernels without shader support)
+    void setGpuPack(bool gpuPack) { gpuPack_ = gpuPack; }
+
+    // Whether reads are being packed on the GPU
+    bool isGpuPacking() const { return gpuPack_ && packer_.isReady(); }
+
+    // texture is (height, width), image becomes (width, height), rotated
+    // like textureToRGB565Rot90 (neg90 = false) or textureToRGB565RotNeg90.
+    // snapshot is the skin's last draw into texture. Returns true if image
+    // got a frame: with async reads it is the one read before, described by
+    // frameSnapshot() and frameNeg90(), and there is none on the first read.
+    bool read(sf::RenderTexture& texture, const qualia::DamageSnapshot& snapshot, qualia::Image& image,
+              bool neg90, qualia::Telemetry* telemetry = nullptr) {
+        auto start = qualia::Telemetry::Clock::now();
+        Pass& pass = passes_[nextPass_];
+        plan(pass, texture, snapshot, neg90, gpuPack_ && packer_.prepare(texture.getSize()));
+        if (pass.packed) {
+            packer_.pack(texture.getTexture(), neg90, pass.rects);
+        }
+
+        // The FBO to read from
+        sf::RenderTexture& source = pass.packed ? packer_.target() : texture;
+        if (!source.setActive(true)) {
+            LOG_WARN << "Texture readback: couldn't activate render texture\n";
+            reset();
+            return false;
+        }
+        if (async_ && !glLoaded_) {
+            glLoaded_ = true;
+            pboSupported_ = gl_.load();
+            if (pboSupported_) {
+                LOG_INFO << "Texture readback: async through pixel buffers" << (gl_.hasFences() ? "" : " (no fences)") << "\n";
+            } else {
+                LOG_WARN << "Texture readback: no pixel buffer objects, reading synchronously\n";
+            }
+        }
+
+        if (!isAsync()) {
+            scratch_.resize(pass.bytes());
+            readRects(pass, scratch_.data());
+            (void)source.setActive(false);
+            auto readBack = qualia::Telemetry::Clock::now();
+            apply(pass, scratch_.data());
+            updateFrame(image);
+            record(telemetry, start, readBack);
+            return true;
+        }
+
+        issue(pass, source);
+        Pass& previous = passes_[nextPass_ ^ 1];
+        nextPass_ ^= 1;
+        if (!previous.pending) {
+            (void)source.setActive(false);
+            if (telemetry) telemetry->record(qualia::Stage::Readback, start, qualia::Telemetry::Clock::now());
+            return false;
+        }
+
+        previous.pending = false;
+        if (previous.fence) {
+            GLenum status = gl_.clientWaitSync(previous.fence, glext::SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS);
+            if (status != glext::ALREADY_SIGNALED && status != glext::CONDITION_SATISFIED) {
+                LOG_WARN << "Texture readback: fence wait failed (" << status << ")\n";
+            }
+        }
+        gl_.bindBuffer(glext::PIXEL_PACK_BUFFER, previous.pbo);
+        const uint8_t* pixels = static_cast<const uint8_t*>(gl_.mapBuffer(glext::PIXEL_PACK_BUFFER, glext::READ_ONLY));
+        auto readBack = qualia::Telemetry::Clock::now();
+        if (!pixels) {
+            // Fall back for good; the read just queued is dropped
+            LOG_WARN << "Texture readback: couldn't map pixel buffer, reading synchronously\n";
+            gl_.bindBuffer(glext::PIXEL_PACK_BUFFER, 0);
+            releaseBuffers();
+            pboSupported_ = false;
+            reset();
+            return false;
+        }
+        apply(previous, pixels);
+        gl_.unmapBuffer(glext::PIXEL_PACK_BUFFER);
+        gl_.bindBuffer(glext::PIXEL_PACK_BUFFER, 0);
+        (void)source.setActive(false);
+
+        updateFrame(image);
+        record(telemetry, start, readBack);
+        return true;
+    }
+
+    // Draw snapshot and rotation of the frame the last successful read gave
+    const qualia::DamageSnapshot& frameSnapshot() const { return frameSnapshot_; }
+    bool frameNeg90() const { return frameNeg90_; }
+
+    // Forget the last read; the next one reads the whole texture
+    void reset() {
+        texture_ = nullptr;
+        history_.clear();
+        filled_.clear();
+        for (auto& pass : passes_) pass.pending = false;
+    }
+
+private:
+    static constexpr size_t HISTORY = 32;          // Reads remembered for catching up stale frames
+    static constexpr size_t MAX_READ_RECTS = 16;   // More than this are read as their bounding box
+    static constexpr float FULL_READ_RATIO = 0.6f; // Damage covering more of the texture: read it all
+    static constexpr size_t MAX_TRACKED_FRAMES = 64;
+    static constexpr int CONVERT_BAND = 64;        // Texture columns per pool work item
+    static constexpr uint64_t FENCE_TIMEOUT_NS = 1000000000;
+
+    // One read of the texture, and where its pixels went
+    struct Pass {
+        std::vector<qualia::DirtyRect> rects;  // Texture coordinates, or panel ones if packed
+        bool full = false;
+        bool packed = false;  // Read from the RGB565 packer
+        bool neg90 = false;
+        int texW = 0, texH = 0;
+        qualia::DamageSnapshot snapshot;
+        // Async reads
+        GLuint pbo = 0;
+        size_t capacity = 0;
+        glext::GLsync fence = nullptr;
+        bool pending = false;  // Copy queued, not converted yet
+
+        size_t bytes() const {
+            if (packed) return (size_t)texW * texH * 2;  // Laid out as the panel image
+            size_t n = 0;
+            for (const auto& r : rects) n += (size_t)r.w * r.h * 4;
+            return n;
+        }
+    };
+
+    // One rotated conversion: a band of a read rect
+    struct ConvertItem {
+        const uint8_t* src;  // Bottom row
+        ptrdiff_t srcStride;
+        int w, h;
+        qualia::Pixel* dst;
+    };
+
+    // One read applied to the mirror, with the panel rects it updated
+    struct Read {
+        uint64_t generation;
+        bool full;
+        std::vector<qualia::DirtyRect> rects;
+    };
+
+    WorkerPool* pool_ = nullptr;
+    bool async_ = false;
+    bool glLoaded_ = false;
+    bool pboSupported_ = false;
+    glext::Functions gl_;
+    sf::RenderTexture* glOwner_ = nullptr;  // Context the pixel buffers were made in
+    bool gpuPack_ = false;
+    Rgb565Packer packer_;
+
+    // Last read planned
+    sf::RenderTexture* texture_ = nullptr;
+    bool neg90_ = false;
+    int texW_ = 0, texH_ = 0;
+    qualia::DamageSnapshot lastSnapshot_;
+
+    std::array<Pass, 2> passes_;
+    int nextPass_ = 0;
+    std::vector<uint8_t> scratch_;
+    std::vector<ConvertItem> items_;
+
+    // Last read applied
+    qualia::Image mirror_;
+    uint64_t generation_ = 0;
+    std::deque<Read> history_;
+    std::unordered_map<const qualia::Pixel*, uint64_t> filled_;  // Frame buffer -> generation it holds
+    qualia::DamageSnapshot frameSnapshot_;
+    bool frameNeg90_ = false;
+
+    static void record(qualia::Telemetry* telemetry, qualia::Telemetry::Clock::time_point start,
+                       qualia::Telemetry::Clock::time_point readBack) {
+        if (telemetry) {
+            telemetry->record(qualia::Stage::Readback, start, readBack);
+            telemetry->record(qualia::Stage::Convert, readBack, qualia::Telemetry::Clock::now());
+        }
+    }
+
+    // Same mapping as drawSnapshotToPanel
+    static qualia::DirtyRect toPanel(const qualia::DirtyRect& r, int texW, int texH, bool neg90) {
+        if (neg90) {
+            return {r.y, (uint16_t)(texW - (r.x + r.w)), r.h, r.w};
+        }
+        return {(uint16_t)(texH - (r.y + r.h)), r.x, r.h, r.w};
+    }
+
+    // Decide what pass reads: the damage since the last read planned
+    void plan(Pass& pass, sf::RenderTexture& texture, const qualia::DamageSnapshot& snapshot, bool neg90,
+              bool packed) {
+        const sf::Vector2u size = texture.getSize();
+        pass.texW = (int)size.x;
+        pass.texH = (int)size.y;
+        pass.neg90 = neg90;
+        pass.packed = packed;
+        pass.snapshot = snapshot;
+        pass.full = &texture != texture_ || neg90 != neg90_ || pass.texW != texW_ || pass.texH != texH_ ||
+                    !qualia::diffDamageSnapshots(lastSnapshot_, snapshot, pass.rects) ||
+                    !mergeReads(pass.rects, pass.texW, pass.texH);
+        if (pass.full) {
+            pass.rects.assign(1, {0, 0, (uint16_t)pass.texW, (uint16_t)pass.texH});
+        }
+        if (packed) {
+            // Packed texels hold two panel pixels: widen to even columns
+            for (auto& r : pass.rects) {
+                qualia::DirtyRect p = toPanel(r, pass.texW, pass.texH, neg90);
+                int x0 = p.x & ~1, x1 = (p.x + p.w + 1) & ~1;
+                r = {(uint16_t)x0, p.y, (uint16_t)(x1 - x0), p.h};
+            }
+        }
+        texture_ = &texture;
+        neg90_ = neg90;
+        texW_ = pass.texW;
+        texH_ = pass.texH;
+        lastSnapshot_ = snapshot;
+    }
+
+    // Clip the damage to the texture and merge it into few reads. Returns
+    // false if a full read is cheaper.
+    static bool mergeReads(std::vector<qualia::DirtyRect>& rects, int texW, int texH) {
+        size_t n = 0;
+        for (const auto& r : rects) {
+            int x0 = max(0, (int)r.x), y0 = max(0, (int)r.y);
+            int x1 = min(texW, r.x + r.w), y1 = min(texH, r.y + r.h);
+            if (x1 > x0 && y1 > y0) rects[n++] = {(uint16_t)x0, (uint16_t)y0, (uint16_t)(x1 - x0), (uint16_t)(y1 - y0)};
+        }
+        rects.resize(n);
+
+        // Merge pairs whose bounding box costs no more than reading both
+        bool merged = true;
+        while (merged) {
+            merged = false;
+            for (size_t a = 0; a < rects.size() && !merged; ++a) {
+                for (size_t b = a + 1; b < rects.size(); ++b) {
+                    qualia::DirtyRect box = qualia::boundingRect(rects[a], rects[b]);
+                    if (box.pixelCount() <= rects[a].pixelCount() + rects[b].pixelCount()) {
+                        rects[a] = box;
+                        rects.erase(rects.begin() + b);
+                        merged = true;
+                        break;
+                    }
+                }
+            }
+        }
+        if (rects.size() > MAX_READ_RECTS) {
+            qualia::DirtyRect box = rects[0];
+            for (const auto& r : rects) box = qualia::boundingRect(box, r);
+            rects.assign(1, box);
+        }
+
+        int area = 0;
+        for (const auto& r : rects) area += r.pixelCount();
+        return area <= FULL_READ_RATIO * texW * texH;
+    }
+
+    // glReadPixels pass's rects from the active FBO to dst (a pointer, or
+    // an offset into the bound pixel buffer). Plain rects go back to back,
+    // packed ones where they sit in the panel image.
+    static void readRects(const Pass& pass, uint8_t* dst) {
+        if (pass.packed) {
+            glPixelStorei(GL_PACK_ROW_LENGTH, pass.texH / 2);
+            for (const auto& r : pass.rects) {
+                glReadPixels(r.x / 2, r.y, r.w / 2, r.h, GL_RGBA, GL_UNSIGNED_BYTE,
+                             dst + ((size_t)r.y * pass.texH + r.x) * 2);
+            }
+            glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+            return;
+        }
+        for (const auto& r : pass.rects) {
+            // GL rows count up from the bottom of the texture
+            glReadPixels(r.x, pass.texH - r.y - r.h, r.w, r.h, GL_RGBA, GL_UNSIGNED_BYTE, dst);
+            dst += (size_t)r.w * r.h * 4;
+        }
+    }
+
+    // Queue pass's copy into its pixel buffer (source's context active)
+    void issue(Pass& pass, sf::RenderTexture& source) {
+        if (!pass.pbo) {
+            gl_.genBuffers(1, &pass.pbo);
+            pass.capacity = 0;
+            glOwner_ = &source;
+        }
+        gl_.bindBuffer(glext::PIXEL_PACK_BUFFER, pass.pbo);
+        size_t bytes = pass.bytes();
+        if (bytes > pass.capacity) {
+            pass.capacity = (size_t)pass.texW * pass.texH * 4;
+            gl_.bufferData(glext::PIXEL_PACK_BUFFER, (ptrdiff_t)pass.capacity, nullptr, glext::STREAM_READ);
+        }
+        // With a pack buffer bound the pointer is an offset into it
+        readRects(pass, nullptr);
+        gl_.bindBuffer(glext::PIXEL_PACK_BUFFER, 0);
+        if (gl_.hasFences()) {
+            if (pass.fence) gl_.deleteSync(pass.fence);
+            pass.fence = gl_.fenceSync(glext::SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();  // The wait may come from another texture's context
+        }
+        pass.pending = true;
+    }
+
+    // Convert pass's pixels (its rects back to back, rows bottom up) into
+    // the mirror, or copy them if they were packed on the GPU
+    void apply(const Pass& pass, const uint8_t* pixels) {
+        static const qualia::simd::RotateConvertFn convert =
+            qualia::simd::getRotateConvert(qualia::simd::detectConvertKernel());
+        if (pass.full) {
+            mirror_.resize(pass.texH, pass.texW);
+            history_.clear();
+            filled_.clear();
+        }
+
+        Read read{++generation_, pass.full, {}};
+        if (pass.packed) {
+            const qualia::Pixel* packed = reinterpret_cast<const qualia::Pixel*>(pixels);
+            for (const auto& r : pass.rects) {
+                for (int y = r.y; y < r.y + r.h; ++y) {
+                    size_t offset = (size_t)y * mirror_.width + r.x;
+                    memcpy(&mirror_.pixels[offset], packed + offset, r.w * sizeof(qualia::Pixel));
+                }
+            }
+            read.rects = pass.rects;
+            finishApply(pass, std::move(read));
+            return;
+        }
+
+        items_.clear();
+        for (const auto& r : pass.rects) {
+            const uint8_t* bottom = pixels + (size_t)(r.h - 1) * r.w * 4;
+            // Column bands of the texture are row bands of the panel
+            for (int c0 = 0; c0 < r.w; c0 += CONVERT_BAND) {
+                int w = min(CONVERT_BAND, r.w - c0);
+                qualia::DirtyRect p = toPanel({(uint16_t)(r.x + c0), r.y, (uint16_t)w, r.h}, pass.texW, pass.texH, pass.neg90);
+                items_.push_back({bottom + (size_t)c0 * 4, -(ptrdiff_t)r.w, w, r.h,
+                                  mirror_.pixels.data() + (size_t)p.y * mirror_.width + p.x});
+            }
+            read.rects.push_back(toPanel(r, pass.texW, pass.texH, pass.neg90));
+            pixels += (size_t)r.w * r.h * 4;
+        }
+
+        auto convertItem = [&](int i) {
+            const ConvertItem& item = items_[i];
+            convert(item.src, item.srcStride, item.w, item.h, item.dst, mirror_.width, pass.neg90);
+        };
+        if (pool_) {
+            pool_->parallelFor((int)items_.size(), convertItem);
+        } else {
+            for (int i = 0; i < (int)items_.size(); ++i) convertItem(i);
+        }
+
+        finishApply(pass, std::move(read));
+    }
+
+    void finishApply(const Pass& pass, Read read) {
+        history_.push_back(std::move(read));
+        if (history_.size() > HISTORY) history_.pop_front();
+        frameSnapshot_ = pass.snapshot;
+        frameNeg90_ = pass.neg90;
+    }
+
+    // Bring image up to the mirror
+    void updateFrame(qualia::Image& image) {
+        bool known = image.width == mirror_.width && image.height == mirror_.height;
+        image.resize(mirror_.width, mirror_.height);
+
+        auto it = known ? filled_.find(image.pixels.data()) : filled_.end();
+        bool copyAll = it == filled_.end() || history_.front().generation > it->second + 1;
+        if (!copyAll) {
+            for (const auto& read : history_) {
+                if (read.generation > it->second && read.full) copyAll = true;
+            }
+        }
+
+        if (copyAll) {
+            memcpy(image.pixels.data(), mirror_.pixels.data(), mirror_.pixels.size() * sizeof(qualia::Pixel));
+        } else {
+            for (const auto& read : history_) {
+                if (read.generation <= it->second) continue;
+                for (const auto& r : read.rects) {
+                    for (int y = r.y; y < r.y + r.h; ++y) {
+                        size_t offset = (size_t)y * mirror_.width + r.x;
+                        memcpy(&image.pixels[offset], &mirror_.pixels[offset], r.w * sizeof(qualia::Pixel));
+                    }
+                }
+            }
+        }
+
+        if (filled_.size() >= MAX_TRACKED_FRAMES) filled_.clear();
+        filled_[image.pixels.data()] = generation_;
+    }
+
+    void releaseBuffers() {
+        if (!glOwner_ || !glOwner_->setActive(true)) return;
+        for (auto& pass : passes_) {
+            if (pass.fence) gl_.deleteSync(pass.fence);
+            if (pass.pbo) gl_.deleteBuffers(1, &pass.pbo);
+            pass.fence = nullptr;
+            pass.pbo = 0;
+            pass.capacity = 0;
+            pass.pending = false;
+        }
+        (void)glOwner_->setActive(false);
+        glOwner_ = nullptr;
+    }
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Latest-value handoff between one producer thread and one consumer thread.
+// The producer fills back() and publish()es it; the consumer acquire()s the
+// most recently published buffer as front(). Unread buffers are overwritten,
+// so the consumer always gets the newest one. Buffers change hands by index
+// swaps only: nothing is copied and neither side ever blocks.
+template <typename T>
+class TripleBuffer {
+public:
+    // Producer side: the buffer to fill next
+    T& back() { return buffers_[back_]; }
+
+    // Producer side: hand back() over and take a new one
+    void publish() {
+        uint8_t old = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel);
+        back_ = old & INDEX;
+    }
+
+    // Consumer side; false if nothing was published since the last acquire
+    bool acquire() {
+        if (!(middle_.load(std::memory_order_relaxed) & FRESH)) return false;
+        uint8_t old = middle_.exchange(front_, std::memory_order_acq_rel);
+        front_ = old & INDEX;
+        return true;
+    }
+
+    // Consumer side: the last acquired buffer
+    T& front() { return buffers_[front_]; }
+
+    // A published buffer is waiting for the consumer
+    bool fresh() const { return middle_.load(std::memory_order_acquire) & FRESH; }
+
+    // All three buffers, only while neither side is running
+    std::array<T, 3>& buffers() { return buffers_; }
+
+private:
+    static constexpr uint8_t INDEX = 3;
+    static constexpr uint8_t FRESH = 4;
+
+    std::array<T, 3> buffers_;
+    alignas(64) uint8_t back_ = 0;
+    alignas(64) std::atomic<uint8_t> middle_{1};
+    alignas(64) uint8_t front_ = 2;
+};
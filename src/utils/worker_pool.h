@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small persistent thread pool for splitting per-frame work into bands.
+// parallelFor() also runs items on the calling thread and returns once every
+// item has finished, so callers can treat it like a plain loop. Calls from
+// several threads run side by side: each is its own job, and idle workers
+// help whichever job still has items left.
+class WorkerPool {
+public:
+    explicit WorkerPool(int threads = defaultThreadCount()) {
+        for (int i = 0; i < threads; ++i) {
+            workers_.emplace_back(&WorkerPool::workerLoop, this);
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : workers_) {
+            if (t.joinable()) t.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Threads available to parallelFor, including the caller
+    int size() const { return (int)workers_.size() + 1; }
+
+    // Leave one core for the render thread and cap it; a frame is only a few
+    // hundred KB, so more threads just add wake-up latency
+    static int defaultThreadCount() {
+        int cores = (int)std::thread::hardware_concurrency();
+        return std::clamp(cores - 2, 0, 3);
+    }
+
+    // Run fn(i) for every i in [0, count)
+    void parallelFor(int count, const std::function<void(int)>& fn) {
+        if (workers_.empty() || count <= 1) {
+            for (int i = 0; i < count; ++i) fn(i);
+            return;
+        }
+
+        Job job(fn, count);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(&job);
+        }
+        cv_.notify_all();
+
+        job.runItems();
+
+        // All items are claimed; stop workers joining, and wait for those
+        // still running theirs
+        std::unique_lock<std::mutex> lock(mutex_);
+        jobs_.erase(std::find(jobs_.begin(), jobs_.end(), &job));
+        doneCv_.wait(lock, [&] { return job.active == 0; });
+    }
+
+private:
+    // One parallelFor call, on its caller's stack
+    struct Job {
+        const std::function<void(int)>& fn;
+        const int count;
+        std::atomic<int> next{0};
+        int active = 0;  // Workers running its items (under mutex_)
+
+        Job(const std::function<void(int)>& fn, int count) : fn(fn), count(count) {}
+
+        bool hasItems() const { return next.load() < count; }
+
+        void runItems() {
+            int i;
+            while ((i = next.fetch_add(1)) < count) {
+                fn(i);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable doneCv_;
+    std::vector<Job*> jobs_;  // Open jobs, oldest first
+    bool stopping_ = false;
+
+    // Oldest job with unclaimed items, or null (under mutex_)
+    Job* findJob() const {
+        for (Job* job : jobs_) {
+            if (job->hasItems()) return job;
+        }
+        return nullptr;
+    }
+
+    void workerLoop() {
+        while (true) {
+            Job* job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [&] { return stopping_ || (job = findJob()) != nullptr; });
+                if (stopping_) return;
+                job->active++;
+            }
+
+            job->runItems();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                job->active--;
+            }
+            // Callers wait on their own job
+            doneCv_.notify_all();
+        }
+    }
+};